@@ -30,26 +30,27 @@ uint8_t io_nxt_init(uint16_t buffer_size) {
 	return result == RS485_OK;
 }
 
-void io_nxt_send(io_message_type type, uint8_t *data, uint8_t len) {
+void io_nxt_send(io_message_type type, uint8_t tag, uint8_t *data, uint8_t len) {
 	int i;
 	uint8_t crc = 0;
 	uint8_t max_overhead = (len/254)+1;
-	uint8_t *tmp = (uint8_t*) malloc(len+2); //Space for data + one byte for CRC + one byte for message type
-	uint8_t *encoded_data = (uint8_t*) malloc(len+2+max_overhead); //Space for encoded data (data + CRC+ type) and the worst case overhead for COBS (one byte for every 254 bytes)
+	uint8_t *tmp = (uint8_t*) malloc(len+3); //Space for data + one byte for CRC + one byte for message type + one byte for the tag
+	uint8_t *encoded_data = (uint8_t*) malloc(len+3+max_overhead+1); //Space for encoded data (data + CRC + type + tag), the worst case overhead for COBS (one byte for every 254 bytes) and the message delimiter
 	if(tmp == NULL || encoded_data == NULL) {
 		free(tmp);
 		free(encoded_data);
 		return;
 	}
 	tmp[0] = type;
-	memcpy(tmp+1, data, len);
+	tmp[1] = tag;
+	memcpy(tmp+2, data, len);
 	
-	for(i=0;i<len+1;i++) {
+	for(i=0;i<len+2;i++) {
 		crc = _crc_ibutton_update(crc, tmp[i]);
 	}
-	tmp[len+1] = crc;
+	tmp[len+2] = crc;
 
-	cobs_encode_result result = cobs_encode(encoded_data, len+2+max_overhead, tmp, len+2);
+	cobs_encode_result result = cobs_encode(encoded_data, len+3+max_overhead, tmp, len+3);
 	if(result.status != COBS_ENCODE_OK) {
 		free(tmp);
 		free(encoded_data);
@@ -66,7 +67,8 @@ void io_nxt_send(io_message_type type, uint8_t *data, uint8_t len) {
 // Gets a message from the RS485 input-buffer
 // Messages are sent and stored in the buffer as COBS-encoded. 
 // This function finds the first message and decodes it. The decoded message has the format
-// | Type (1 byte) | Raw data (variable bytes) | CRC (1 byte) |
+// | Type (1 byte) | Tag (1 byte) | Raw data (variable bytes) | CRC (1 byte) |
+// The tag is sent back in the response, so the NXT can match it with the request
 uint8_t io_nxt_get_message(uint8_t *data) {
 	if(data == NULL) return 0;
 	
@@ -80,7 +82,7 @@ uint8_t io_nxt_get_message(uint8_t *data) {
 	if(rs_result.num_received_bytes > 0) {
 		cobs_result = cobs_decode(data, _buffer_size, message, rs_result.num_received_bytes-1);	
 				
-		if(cobs_result.status != COBS_DECODE_OK) {
+		if(cobs_result.status != COBS_DECODE_OK || cobs_result.out_len < 3) {
 			return 0;
 		}
 		uint8_t i;
@@ -96,4 +98,15 @@ uint8_t io_nxt_get_message(uint8_t *data) {
 	}
 	return 0;
 	
+}
+
+// Returns 1 if no bytes have been received since the last call. The NXT sends a burst of messages back to back,
+// so the burst is complete when the line has been idle for a while. The RS485 bus is half duplex, and answering
+// before the burst is complete would make the transceivers drive the bus at the same time
+uint8_t io_nxt_line_idle(void) {
+	static uint8_t last_count = 0;
+	uint8_t count = rs485_receive_count();
+	uint8_t idle = (count == last_count);
+	last_count = count;
+	return idle;
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #ifndef IO_NXT_H_
 #define IO_NXT_H_
 
+#define PUSH_SLACK_MS 1 //A SENSOR_DATA push this late still keeps the rate, later pushes start a new period. The NXT keeps the line free for its PUSH_GUARD_MS
+
 struct to_nxt {
 	uint8_t		dist_0;
 	uint8_t		dist_90;
@@ -20,6 +22,8 @@ struct to_nxt {
 	int16_t		compass_x;
 	int16_t		compass_y;
 	int16_t		compass_z;
+	uint16_t	sample_count;	//Increased for every sample taken
+	uint16_t	sample_tick;	//tick_ms() when the gyro was read, the NXT maps it to its own clock
 	uint8_t		dongle_status;
 };
 
@@ -29,7 +33,8 @@ typedef enum
 	SEND_BT				= 0x02,
 	RECEIVE_BT			= 0x03,
 	RECEIVE_SENSORS		= 0x04,
-	ALIVE_TEST			= 0x05
+	ALIVE_TEST			= 0x05,
+	SUBSCRIBE_SENSORS	= 0x06
 } nxt_message_type;
 
 typedef enum
@@ -40,7 +45,8 @@ typedef enum
 } io_message_type;
 
 uint8_t io_nxt_init(uint16_t buffer_size);
-void io_nxt_send(io_message_type type, uint8_t *data, uint8_t len);
+void io_nxt_send(io_message_type type, uint8_t tag, uint8_t *data, uint8_t len);
 uint8_t io_nxt_get_message(uint8_t *data);
+uint8_t io_nxt_line_idle(void);
 
 #endif /* IO_NXT_H_ */
\ No newline at end of file
@@ -24,7 +24,9 @@
 #include "com_HMC5883L.h"
 #include "LSM6DS3.h"
 #include "uart.h"
+#include "tick.h"
 uint8_t moving_average(uint8_t avg, uint8_t sample);
+void sample_sensors(struct to_nxt *values);
 
 int main(void)
 {
@@ -36,6 +38,7 @@ int main(void)
 	
 	uint8_t init_success = 1;
 	adc_init();
+	tick_init();
 	init_success *= gyro_init();
 	init_success *= vCOM_init();
 	init_success *= io_nxt_init(IO_NXT_BUFFER_SIZE);
@@ -55,44 +58,68 @@ int main(void)
 	values.dist_90 = 100;
 	values.dist_180 = 100;
 	values.dist_270 = 100;
+	values.sample_count = 0;
 	uint8_t count = 0;
+	uint8_t push_period = 0; //Milliseconds between SENSOR_DATA pushes, 0 until the NXT subscribes
+	uint16_t push_tick = 0; //When the current push period started
 	PORTB = 0x00;
 
 	while (1) 
     {
-		if(++count > 50) {
+		if(!push_period && ++count > 50) { //When subscribed, the sensors are sampled right before each push instead
 			count = 0;
-			vCOM_getData(&values.compass_x,&values.compass_y,&values.compass_z);
-			gyro_getData(&values.gyro_x,&values.gyro_y,&values.gyro_z);
-			values.dist_0 = moving_average(values.dist_0, adc_read(0));
-			values.dist_90 = moving_average(values.dist_90, adc_read(1));
-			values.dist_180 = moving_average(values.dist_180, adc_read(2));
-			values.dist_270 = moving_average(values.dist_270, adc_read(3));
-			values.dongle_status = DONGLE_CONNECTED;
+			sample_sensors(&values);
 		}
 
-		num_bytes = io_nxt_get_message(message);
-		if(num_bytes > 0){
+		uint8_t idle = io_nxt_line_idle();
+		while(idle && (num_bytes = io_nxt_get_message(message)) > 0){ //The NXT sends several messages in one burst, wait until all of them are received and answer them before it sends again
+			uint8_t tag = message[1];
 			if(message[0] == ALIVE_TEST) {
-				io_nxt_send(ALIVE_RESPONSE, NULL, 0);
+				io_nxt_send(ALIVE_RESPONSE, tag, NULL, 0);
 			}
 			if(message[0] == SET_LED) { //Format: 0b1tcccryg (c=change, g=green, r=red, y=yellow, t=toggle)
-				if(message[1] & 0x40) PORTB ^= (0b00000111 & (message[1] & (message[1] >> 3))); //Toggle
-				else PORTB = (PORTB & (0b11111000 | ~(message[1] >> 3))) | message[1];
+				if(message[2] & 0x40) PORTB ^= (0b00000111 & (message[2] & (message[2] >> 3))); //Toggle
+				else PORTB = (PORTB & (0b11111000 | ~(message[2] >> 3))) | message[2];
 			} else if(message[0] == RECEIVE_SENSORS) {
-				io_nxt_send(SENSOR_DATA, (uint8_t*) &values, sizeof(values));
+				push_tick = tick_ms(); //The NXT times the next push from every SENSOR_DATA message
+				io_nxt_send(SENSOR_DATA, tag, (uint8_t*) &values, sizeof(values));
 			} else if(message[0] == SEND_BT) {
-				bt_send(&message[1], num_bytes-1);
+				bt_send(&message[2], num_bytes-2);
 			} else if(message[0] == RECEIVE_BT) {
 				uint8_t bt_msg[IO_DONGLE_BUFFER_SIZE];
 				bt_receive_result bt_result = bt_receive(bt_msg, IO_DONGLE_BUFFER_SIZE);
-				io_nxt_send(BT_DATA, bt_msg, bt_result.num_received_bytes);
+				io_nxt_send(BT_DATA, tag, bt_msg, bt_result.num_received_bytes);
+			} else if(message[0] == SUBSCRIBE_SENSORS && num_bytes > 2) {
+				push_period = message[2];
+				push_tick = tick_ms();
+				sample_sensors(&values);
+				io_nxt_send(SENSOR_DATA, tag, (uint8_t*) &values, sizeof(values)); //The first sample is the response
 			}
 		}
+		
+		uint16_t since_push = tick_ms() - push_tick;
+		if(push_period && idle && since_push >= push_period) { //The NXT keeps the line free around the time a push is due, but may still be finishing a burst
+			if(since_push - push_period <= PUSH_SLACK_MS) push_tick += push_period;
+			else push_tick += since_push; //Late because the line was busy, the NXT times the next push from this one
+			sample_sensors(&values);
+			io_nxt_send(SENSOR_DATA, 0, (uint8_t*) &values, sizeof(values)); //Tag 0, not a response to a request
+		}
 		_delay_us(500);
     }
 }
 
+void sample_sensors(struct to_nxt *values) {
+	vCOM_getData(&values->compass_x,&values->compass_y,&values->compass_z);
+	values->sample_tick = tick_ms();
+	gyro_getData(&values->gyro_x,&values->gyro_y,&values->gyro_z);
+	values->dist_0 = moving_average(values->dist_0, adc_read(0));
+	values->dist_90 = moving_average(values->dist_90, adc_read(1));
+	values->dist_180 = moving_average(values->dist_180, adc_read(2));
+	values->dist_270 = moving_average(values->dist_270, adc_read(3));
+	values->dongle_status = DONGLE_CONNECTED;
+	values->sample_count++;
+}
+
 uint8_t moving_average(uint8_t avg, uint8_t sample) {
 	avg -= avg/3;
 	avg += sample/3;
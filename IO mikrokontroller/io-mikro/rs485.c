@@ -60,3 +60,8 @@ rs485_receive_result rs485_receive_token(uint8_t *data, uint8_t token) {
 	
 	return rs_result;
 }
+
+// Number of bytes received so far, wraps around. Used to see if the line has been idle
+uint8_t rs485_receive_count(void) {
+	return uart0_receive_count();
+}
@@ -24,6 +24,7 @@ typedef struct
 rs485_status rs485_init(uint8_t buffer_size);
 rs485_receive_result rs485_receive(uint8_t *data, uint8_t len);
 rs485_receive_result rs485_receive_token(uint8_t *data, uint8_t token);
+uint8_t rs485_receive_count(void);
 rs485_status rs485_send(uint8_t *data, uint8_t len);
 
 #endif /* RS485_H_ */
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+ * tick.c
+ *
+ * Millisecond tick counter driven by timer 0
+ */ 
+#define F_CPU		7372800UL
+
+#define TICK_PRESCALER	64
+#define TICK_COMPARE	((F_CPU/TICK_PRESCALER/1000) - 1) //114, gives a tick every 0.998 ms
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "tick.h"
+
+volatile uint16_t tick_count = 0;
+
+void tick_init(void) {
+	TCCR0A = 1<<WGM01; //Clear timer on compare match
+	TCCR0B = 0<<CS02 | 1<<CS01 | 1<<CS00; //Prescaler 64
+	OCR0A = (uint8_t) TICK_COMPARE;
+	TIMSK0 = 1<<OCIE0A;
+}
+
+// Milliseconds since tick_init, wraps around after 65 seconds
+uint16_t tick_ms(void) {
+	uint16_t ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { //The counter is two bytes, and can change between reading them
+		ticks = tick_count;
+	}
+	return ticks;
+}
+
+ISR(TIMER0_COMPA_vect) {
+	tick_count++;
+}
@@ -0,0 +1,15 @@
+/*
+ * tick.h
+ *
+ * Millisecond tick counter driven by timer 0
+ */ 
+
+
+#ifndef TICK_H_
+#define TICK_H_
+
+void tick_init(void);
+uint16_t tick_ms(void);
+
+
+#endif /* TICK_H_ */
@@ -8,7 +8,7 @@
 
 #define BAUD0			230400
 #define BAUD_REG0		((F_CPU/(16*BAUD0)) - 1)
-#define SEND_LIMIT0		100
+#define SEND_LIMIT0		255		//rs485_send takes up to 255 bytes, BT_DATA with 128 dongle bytes is 133
 
 #define BAUD1			38400
 #define BAUD_REG1		((F_CPU/(16*BAUD1)) - 1)
@@ -23,6 +23,7 @@
 
 fifo_t uart0_fifo;
 fifo_t uart1_fifo;
+volatile uint8_t uart0_rx_count = 0; //Number of bytes received on uart0, wraps around
 
 uart_status uart0_init(uint16_t buffer_size) {
 	UBRR0L = (uint8_t) BAUD_REG0;
@@ -120,6 +121,10 @@ uart_receive_result uart0_receive_token(uint8_t *data, uint8_t token) {
 	return result;
 }
 
+uint8_t uart0_receive_count(void) {
+	return uart0_rx_count;
+}
+
 uart_receive_result uart1_receive_token(uint8_t *data, uint8_t token) {
 	uart_receive_result result;
 	
@@ -136,6 +141,7 @@ uart_receive_result uart1_receive_token(uint8_t *data, uint8_t token) {
 
 ISR(USART0_RX_vect) {
 	fifo_write(&uart0_fifo, UDR0);
+	uart0_rx_count++;
 }
 
 ISR(USART1_RX_vect) {
@@ -32,6 +32,7 @@ uart_receive_result uart1_receive(uint8_t *data, uint16_t len);
 
 uart_receive_result uart0_receive_token(uint8_t *data, uint8_t token);
 uart_receive_result uart1_receive_token(uint8_t *data, uint8_t token);
+uint8_t uart0_receive_count(void);
 
 
 #endif /* UART_H_ */
\ No newline at end of file
@@ -95,7 +95,7 @@
 #define configTICK_RATE_HZ		       ( ( TickType_t ) 1000 )
 #define configMAX_PRIORITIES		   ( 5 )
 #define configMINIMAL_STACK_SIZE	   ( ( unsigned short ) 100 )
-#define configTOTAL_HEAP_SIZE		   ( ( size_t ) 48000 ) // AT91SAM7S256 has 64KB SRAM
+#define configTOTAL_HEAP_SIZE		   ( ( size_t ) 24000 ) // AT91SAM7S256 has 64KB SRAM. A MAPPING build has 29.6KB static data and needs 11.7KB heap, check with HEAP_STATS
 #define configMAX_TASK_NAME_LEN		   ( 16 )
 #define configUSE_TRACE_FACILITY	   0
 #define configUSE_16_BIT_TICKS		   0
@@ -110,6 +110,12 @@
 #define configUSE_CO_ROUTINES 		        0
 #define configMAX_CO_ROUTINE_PRIORITIES     ( 2 )
 
+/* Software timer definitions. The IO requests run from timers. */
+#define configUSE_TIMERS                    1
+#define configTIMER_TASK_PRIORITY           ( configMAX_PRIORITIES - 1 )
+#define configTIMER_QUEUE_LENGTH            5
+#define configTIMER_TASK_STACK_DEPTH        configMINIMAL_STACK_SIZE
+
 /* Define to trap errors during development. */
 extern void vAssertCalled( void );
 #define configASSERT(  x  ) if( ( x ) == 0 ) vAssertCalled()
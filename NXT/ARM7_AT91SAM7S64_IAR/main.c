@@ -49,17 +49,20 @@
 #include "pose_controller.h"
 #include "mapping.h"
 #include "motor.h"
+#include "channel.h"
 
 /* Semaphore handles */
 SemaphoreHandle_t xCommandReadyBSem;
 
 /* Queue handles */
 QueueHandle_t poseControllerQ = 0;
-QueueHandle_t movementQ = 0;
-QueueHandle_t wheelTicksQ = 0;
-QueueHandle_t globalPoseQ = 0;
 QueueHandle_t measurementQ = 0;
 
+/* Latest-value channels, see channel.h */
+channel_t movementChannel;
+channel_t globalPoseChannel;
+channel_t poseCovarianceChannel;
+
 /* Task handles */
 TaskHandle_t xPoseCtrlTask = NULL;
 TaskHandle_t xMappingTask = NULL;
@@ -131,21 +134,17 @@ int main(void)
 	led_set(LED_RED);
 	
 	/* Initialize queues and semaphores */
-	movementQ = xQueueCreate(2, sizeof(uint8_t));
-	poseControllerQ = xQueueCreate(1, sizeof(point_t));
-	movementQ = xQueueCreate(1, sizeof(uint8_t));
-	wheelTicksQ = xQueueCreate(1, sizeof(wheel_ticks_t));
-	globalPoseQ = xQueueCreate(1, sizeof(pose_t));
+	poseControllerQ = xQueueCreate(WAYPOINT_QUEUE_SIZE, sizeof(point_t));
 	measurementQ = xQueueCreate(3, sizeof(measurement_t));
 
 	xCommandReadyBSem = xSemaphoreCreateBinary();
 
+	channel_init(&movementChannel, sizeof(uint8_t));
+	channel_init(&globalPoseChannel, sizeof(pose_t));
+	channel_init(&poseCovarianceChannel, sizeof(matrix3_t));
+
 	/* For debugging using the FreeRTOS-aware plugin in IAR embedded studio. */
-	vQueueAddToRegistry(movementQ, "Movement queue");
 	vQueueAddToRegistry(poseControllerQ, "Pose controller queue");
-	vQueueAddToRegistry(movementQ, "Scan status queue");
-	vQueueAddToRegistry(wheelTicksQ, "Global wheel ticks queue");
-	vQueueAddToRegistry(globalPoseQ, "Global pose queue");
 	vQueueAddToRegistry(measurementQ, "Measurement queue");
 	vQueueAddToRegistry(xCommandReadyBSem, "Command ready semaphore");
 
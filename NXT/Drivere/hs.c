@@ -9,39 +9,56 @@
 #include  <string.h>
 #include "display.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "sensors1.h"
 
 // Buffer sizes etc,
-// NOTE: The input code for this device assumes that 2 buffers are in use.
 // Max data size
 #define BUFSZ 64 // 10/04/16 takashic
 
 // smaller than leJOS 10/04/16 takashic
-#define IN_BUF_SZ  (BUFSZ)
 #define OUT_BUF_SZ (BUFSZ)
-
-#define IN_BUF_CNT 2
 #define OUT_BUF_CNT 2
 #define BAUD_RATE 460000
 
+// Idle time after a byte before the receiver times out, in bit periods.
+// The IO controller sends each frame in one burst, so this marks the end
+// of a frame without waking the reader on every byte.
+#define RX_TIMEOUT_BITS 20
+
+// Input is a ring of IN_BLK_CNT blocks, chained to the PDC one block ahead
+// of the block it is filling. Positions in the ring are counted as free
+// running byte numbers, and a block is only handed to the PDC when all
+// bytes it will overwrite have been released. The ring is followed by
+// room for the start of a frame that wraps around the end, so every frame
+// can be handed out as one slice. The PDC pointer is only unambiguous
+// with at least 3 blocks.
+#define IN_BLK_SZ  (BUFSZ)
+#define IN_BLK_CNT 4
+#define IN_RING_SZ (IN_BLK_SZ*IN_BLK_CNT)
+
 // statically allocated 10/04/15 takashic
 //static unsigned char *in_buf[IN_BUF_CNT];
 //static unsigned char *out_buf[OUT_BUF_CNT];
-static unsigned char in_buf[IN_BUF_CNT][IN_BUF_SZ];
+static unsigned char in_ring[IN_RING_SZ + HS_FRAME_MAX];
 static unsigned char out_buf[OUT_BUF_CNT][OUT_BUF_SZ];
 
-static unsigned char in_buf_in_ptr, out_buf_ptr;
+static unsigned char out_buf_ptr;
+
+static unsigned long in_blk_queued;   // Last block handed to the PDC
+static unsigned long in_head;         // Bytes written by the PDC
+static unsigned long in_scan;         // Bytes searched for a delimiter
+static unsigned long in_frame;        // Start of the next frame
+static unsigned long in_tail;         // Bytes released by the reader
 
-static unsigned char* buf_ptr;
+static TaskHandle_t rx_notify;        // Task woken when bytes have arrived
+static unsigned long rx_notify_bits;  // Bits set in its notification value
 
-//static int in_buf_idx = 0;
-static int in_buf_idx; // 10/04/16 takashic
+__irq __arm void hs_isr_C(void);
 
-	
 //int hs_enable() // 10/04/15 takashic
 int hs_enable(unsigned long baud_rate)
 {
-  unsigned char trash;
   // added divided by zero protection 10/04/15 takashic
   if (baud_rate == 0)
   {
@@ -49,12 +66,13 @@ int hs_enable(unsigned long baud_rate)
   }
 
   // Flush buffers 10/04/17 takashic
-   memset(in_buf, 0, sizeof(in_buf));
+   memset(in_ring, 0, sizeof(in_ring));
    memset(out_buf, 0, sizeof(out_buf));
 
   // Initialize the device
-  in_buf_in_ptr = out_buf_ptr = 0; 
-  in_buf_idx = 0;
+  out_buf_ptr = 0; 
+  in_blk_queued = 1;
+  in_head = in_scan = in_frame = in_tail = 0;
   
   // Enable power to the device
   *AT91C_PMC_PCER = (1 << AT91C_ID_US0); 
@@ -68,9 +86,9 @@ int hs_enable(unsigned long baud_rate)
   // Now program up the device
   *AT91C_US0_CR   = AT91C_US_RSTSTA;
   *AT91C_US0_CR   = AT91C_US_STTTO;
-  *AT91C_US0_RTOR = 0;
+  *AT91C_US0_RTOR = RX_TIMEOUT_BITS;
   *AT91C_US0_TTGR = 0;
-  *AT91C_US0_IDR  = AT91C_US_TIMEOUT;
+  *AT91C_US0_IDR  = 0xFFFFFFFF;
   *AT91C_US0_MR = AT91C_US_USMODE_RS485;
   *AT91C_US0_MR &= ~AT91C_US_SYNC;
   *AT91C_US0_MR |= AT91C_US_CLKS_CLOCK | AT91C_US_CHRL_8_BITS | AT91C_US_PAR_NONE | AT91C_US_NBSTOP_1_BIT | AT91C_US_OVER;
@@ -81,26 +99,28 @@ int hs_enable(unsigned long baud_rate)
   *AT91C_US0_RNPR = 0;
   *AT91C_US0_TNPR = 0;
   
-  trash = *AT91C_US0_RHR;
-  trash = *AT91C_US0_CSR;
+  (void) *AT91C_US0_RHR;
+  (void) *AT91C_US0_CSR;
   
-  *AT91C_US0_RPR  = (unsigned int)&(in_buf[0][0]); 
-  *AT91C_US0_RCR  = IN_BUF_SZ;
-  *AT91C_US0_RNPR = (unsigned int)&(in_buf[1][0]);
-  *AT91C_US0_RNCR = IN_BUF_SZ;
+  *AT91C_US0_RPR  = (unsigned int)&(in_ring[0]); 
+  *AT91C_US0_RCR  = IN_BLK_SZ;
+  *AT91C_US0_RNPR = (unsigned int)&(in_ring[IN_BLK_SZ]);
+  *AT91C_US0_RNCR = IN_BLK_SZ;
 
-  *AT91C_US0_IER = 1;
+  // Interrupt at the end of a burst, and when the PDC finishes a block
+  AT91F_AIC_ConfigureIt( AT91C_BASE_AIC, AT91C_ID_US0, AT91C_AIC_PRIOR_HIGHEST-2, AT91C_AIC_SRCTYPE_INT_LEVEL_SENSITIVE, ( void (*)(void) ) hs_isr_C );
+  AT91F_AIC_EnableIt( AT91C_BASE_AIC, AT91C_ID_US0 );
+  *AT91C_US0_IER = AT91C_US_TIMEOUT | AT91C_US_ENDRX;
   *AT91C_US0_CR   = AT91C_US_RXEN | AT91C_US_TXEN; 
   *AT91C_US0_PTCR = (AT91C_PDC_RXTEN | AT91C_PDC_TXTEN); 
   
-  buf_ptr = &(in_buf[0][0]);
-  
   return 1;
 }
 
 void hs_disable(void)
 {
   // Turn off the device and make the pins available for other uses
+  AT91F_AIC_DisableIt( AT91C_BASE_AIC, AT91C_ID_US0 );
   *AT91C_PMC_PCDR = (1 << AT91C_ID_US0);
   
   sp_reset(RS485_PORT);
@@ -112,7 +132,7 @@ void hs_init(void)
   // Initial state is off
 
   // flush buffers 10/04/16 takashic
-  memset(in_buf, 0, sizeof(in_buf));
+  memset(in_ring, 0, sizeof(in_ring));
   memset(out_buf, 0, sizeof(out_buf));
 
   hs_disable();
@@ -137,140 +157,139 @@ unsigned long hs_write(unsigned char *buf, unsigned long off, unsigned long len)
     return 0;
 }
 
+static unsigned long hs_rx_update(void)
+{
+  // Find how far the PDC has come. It is either in the block before the
+  // last queued one, or in the last queued one if the next pointer has been
+  // used. A position on the border between the two gives the same count.
+  unsigned long offset = (unsigned long) *AT91C_US0_RPR - (unsigned long) in_ring;
+  unsigned long start = ((in_blk_queued - 1) % IN_BLK_CNT) * IN_BLK_SZ;
+  unsigned long head;
+
+  if (offset >= start && offset <= start + IN_BLK_SZ)
+    head = (in_blk_queued - 1) * IN_BLK_SZ + offset - start;
+  else
+    head = in_blk_queued * IN_BLK_SZ + offset - (in_blk_queued % IN_BLK_CNT) * IN_BLK_SZ;
+  // Never step back if the PDC moved on while the pointer was read
+  if ((long) (head - in_head) > 0) in_head = head;
+
+  // Chain the next block once the PDC is filling the last queued one and
+  // the reader has released everything in the block after it. A PDC that
+  // has stopped at the end of its block gets it as the current block.
+  if (*AT91C_US0_RNCR == 0 && (long) (in_tail - ((in_blk_queued + 2) * IN_BLK_SZ - IN_RING_SZ)) >= 0)
+  {
+    in_blk_queued++;
+    if (*AT91C_US0_RCR == 0)
+    {
+      *AT91C_US0_RPR = (unsigned int) &(in_ring[(in_blk_queued % IN_BLK_CNT) * IN_BLK_SZ]);
+      *AT91C_US0_RCR = IN_BLK_SZ;
+    }
+    else
+    {
+      *AT91C_US0_RNPR = (unsigned int) &(in_ring[(in_blk_queued % IN_BLK_CNT) * IN_BLK_SZ]);
+      *AT91C_US0_RNCR = IN_BLK_SZ;
+    }
+  }
+  return in_head;
+}
+
 unsigned long hs_pending()
 {
   // return the state of any pending i/o requests one bit for input one bit
   // for output.
   // First check for any input
   int ret = 0;
-  int bytes_ready;
-  if (*AT91C_US0_RNCR == 0) 
-    bytes_ready = IN_BUF_SZ*2 - *AT91C_US0_RCR;
-  else 
-    bytes_ready = IN_BUF_SZ - *AT91C_US0_RCR;
-  if (bytes_ready  > in_buf_idx) ret |= 1;
+  taskENTER_CRITICAL();
+  if (hs_rx_update() != in_scan) ret |= 1;
+  taskEXIT_CRITICAL();
   if ((*AT91C_US0_TCR != 0) || (*AT91C_US0_TNCR != 0)) ret |= 2;
   return ret;
 }
 
+unsigned long hs_read(unsigned char * buf, unsigned long off, unsigned long len)
+{
+  // Raw bytes, taken from where the frame scanner has come to
+  unsigned long head;
+  unsigned long i;
 
+  taskENTER_CRITICAL();
+  head = hs_rx_update();
+  taskEXIT_CRITICAL();
 
-unsigned long hs_read(unsigned char * buf, unsigned long off, unsigned long len)
+  for(i=0;i<len && in_scan != head;i++) buf[off+i] = in_ring[in_scan++ % IN_RING_SZ];
+  in_frame = in_tail = in_scan;
+  return i;
+}
+
+unsigned long hs_read_frame(hs_frame_t *frame, unsigned char delimiter)
 {
-  int bytes_ready;
-  int total_bytes_ready;
-  int cmd_len;
-  int i;
-  unsigned char* tmp_ptr;
-  
-  cmd_len = 0;
-  if (*AT91C_US0_RNCR == 0) {
-    bytes_ready = IN_BUF_SZ;
-    total_bytes_ready = IN_BUF_SZ*2 - *AT91C_US0_RCR;
-  }
-  else
-    total_bytes_ready = bytes_ready = IN_BUF_SZ - *AT91C_US0_RCR;
-  
-  if (total_bytes_ready > in_buf_idx)
+  unsigned long head;
+
+  taskENTER_CRITICAL();
+  head = hs_rx_update();
+  taskEXIT_CRITICAL();
+
+  while (in_scan != head)
   {
-    cmd_len = (int) (total_bytes_ready - in_buf_idx);
-    if (cmd_len > len) cmd_len = len;
-  	
-    if (bytes_ready >= in_buf_idx + cmd_len)
-    { 	
-      for(i=0;i<cmd_len;i++) buf[off+i] = buf_ptr[in_buf_idx++];
+    if (in_ring[in_scan++ % IN_RING_SZ] == delimiter)
+    {
+      unsigned long start = in_frame % IN_RING_SZ;
+      unsigned long len = in_scan - in_frame;
+
+      // Copy the part of a frame that wrapped to the front of the ring to
+      // the room after it
+      if (start + len > IN_RING_SZ)
+        memcpy(&(in_ring[IN_RING_SZ]), &(in_ring[0]), start + len - IN_RING_SZ);
+
+      frame->data = &(in_ring[start]);
+      frame->len = len;
+      in_frame = in_scan;
+      return len;
     }
-    else
+    if (in_scan - in_frame >= HS_FRAME_MAX)
     {
-      for(i=0;i<cmd_len && in_buf_idx < IN_BUF_SZ;i++) buf[off+i] = buf_ptr[in_buf_idx++];
-      in_buf_idx = 0;
-      tmp_ptr = &(in_buf[(in_buf_in_ptr+1)%2][0]);
-      for(;i<cmd_len;i++) buf[off+i] = tmp_ptr[in_buf_idx++];
-      in_buf_idx += IN_BUF_SZ;
-    } 
-  }
-  
-  // Current buffer full and fully processed
-  
-  if (in_buf_idx >= IN_BUF_SZ && *AT91C_US0_RNCR == 0)
-  { 	
-    // Switch current buffer, and set up next 
-    in_buf_idx -= IN_BUF_SZ;
-    *AT91C_US0_RNPR = (unsigned int) buf_ptr;
-    *AT91C_US0_RNCR = IN_BUF_SZ;
-    in_buf_in_ptr = (in_buf_in_ptr+1) % IN_BUF_CNT;
-    buf_ptr = &(in_buf[in_buf_in_ptr][0]);
+      // No delimiter in a frame's worth of bytes, drop them
+      if (in_tail == in_frame) in_tail = in_scan;
+      in_frame = in_scan;
+    }
   }
-  return cmd_len;   
+  return 0;
 }
 
+void hs_release_frames(void)
+{
+  in_tail = in_frame;
+  // The ISR can chain the freed blocks again
+  *AT91C_US0_IER = AT91C_US_ENDRX;
+}
 
-unsigned long hs_read_delimiter(unsigned char * buf, unsigned long off, unsigned long len, unsigned char delimiter)
+void hs_set_rx_notify(TaskHandle_t task, unsigned long bits)
 {
-  int bytes_ready;
-  int total_bytes_ready;
-  int cmd_len;
-  int i;
-  int delimiter_pos = -1;
-  unsigned char* tmp_ptr;
-  int in_buf_idx_old = in_buf_idx;
-  cmd_len = 0;
-  if (*AT91C_US0_RNCR == 0) {
-    bytes_ready = IN_BUF_SZ;
-    total_bytes_ready = IN_BUF_SZ*2 - *AT91C_US0_RCR;
-  }
-  else
-    total_bytes_ready = bytes_ready = IN_BUF_SZ - *AT91C_US0_RCR;
-  
-  if (total_bytes_ready > in_buf_idx)
+  rx_notify_bits = bits;
+  rx_notify = task;
+}
+
+__irq __arm void hs_isr_C(void)
+{
+  unsigned long status = *AT91C_US0_CSR & *AT91C_US0_IMR;
+
+  // Wait for the next byte before timing out again
+  if (status & AT91C_US_TIMEOUT)
+    *AT91C_US0_CR = AT91C_US_STTTO;
+
+  // The PDC has filled a block, and ENDRX stays set until RCR or RNCR is
+  // written. Chain the next block if the reader has released it. If no block
+  // is left to chain, stay quiet until hs_release_frames frees one, or the
+  // level sensitive interrupt would keep the task from ever releasing it.
+  if (status & AT91C_US_ENDRX)
   {
-    cmd_len = (int) (total_bytes_ready - in_buf_idx);
-    if (cmd_len > len) cmd_len = len;
-  	
-    if (bytes_ready >= in_buf_idx + cmd_len)
-    { 	
-      for(i=0;i<cmd_len;i++) {
-        buf[off+i] = buf_ptr[in_buf_idx++];
-        if(buf[off+i] == delimiter) {
-          delimiter_pos = i;
-          break;
-        }
-      }
-    }
-    else
-    {
-      for(i=0;i<cmd_len && in_buf_idx < IN_BUF_SZ;i++) {
-        buf[off+i] = buf_ptr[in_buf_idx++];
-        if(buf[off+i] == delimiter) {
-          delimiter_pos = i;
-          break;
-        }
-      }
-      if(delimiter_pos == -1) { 
-        in_buf_idx = 0;
-        tmp_ptr = &(in_buf[(in_buf_in_ptr+1)%2][0]);
-        for(;i<cmd_len;i++) {
-          buf[off+i] = tmp_ptr[in_buf_idx++];
-          if(buf[off+i] == delimiter) {
-            delimiter_pos = i;
-            break;
-          }
-        }
-        in_buf_idx += IN_BUF_SZ;
-      }
-    } 
-  }
-  
-  if(delimiter_pos == -1) in_buf_idx = in_buf_idx_old;
-  else if (in_buf_idx >= IN_BUF_SZ && *AT91C_US0_RNCR == 0)
-  { 	
-    // Switch current buffer, and set up next 
-    in_buf_idx -= IN_BUF_SZ;
-    *AT91C_US0_RNPR = (unsigned int) buf_ptr;
-    *AT91C_US0_RNCR = IN_BUF_SZ;
-    in_buf_in_ptr = (in_buf_in_ptr+1) % IN_BUF_CNT;
-    buf_ptr = &(in_buf[in_buf_in_ptr][0]);
+    hs_rx_update();
+    if (*AT91C_US0_RNCR == 0) *AT91C_US0_IDR = AT91C_US_ENDRX;
   }
 
-  return delimiter_pos+1;   
+  // The ISR can not switch context, so the task runs at the next tick
+  if (rx_notify)
+    xTaskNotifyFromISR(rx_notify, rx_notify_bits, eSetBits, NULL);
+
+  AT91C_BASE_AIC->AIC_EOICR = 0; //Inform the AIC the interrupt is done
 }
@@ -1,17 +1,36 @@
 #ifndef HS_H_
 #define HS_H_
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #define   HS_RX_PIN  AT91C_PIO_PA5
 #define   HS_TX_PIN  AT91C_PIO_PA6
 #define   HS_RTS_PIN AT91C_PIO_PA7
 
+// Longest frame, with delimiter, that hs_read_frame hands out
+#define   HS_FRAME_MAX 136
+
+// A received frame, pointing into the input ring
+typedef struct {
+  unsigned char *data;
+  unsigned long len;
+} hs_frame_t;
+
 void hs_init(void);
 //int hs_enable(void); // 10/04/16 takashic
 int hs_enable(unsigned long baud_rate);
 void hs_disable(void);
 unsigned long hs_write(unsigned char *buf, unsigned long off, unsigned long len);
 unsigned long hs_read(unsigned char * buf, unsigned long off, unsigned long len);
-unsigned long hs_read_delimiter(unsigned char * buf, unsigned long off, unsigned long len, unsigned char delimiter);
+// Hands out the next frame ending with the delimiter, and returns its length,
+// or 0 if no complete frame has been received. Bytes are only searched once.
+// The frames stay valid until hs_release_frames is called.
+unsigned long hs_read_frame(hs_frame_t *frame, unsigned char delimiter);
+void hs_release_frames(void);
+// Task to notify when a burst of bytes has been received, the bits are set
+// in its notification value
+void hs_set_rx_notify(TaskHandle_t task, unsigned long bits);
 unsigned long hs_pending(void);
 
 #endif /*HS_H_*/
@@ -3,6 +3,7 @@
 
 #include "nxt_avr.h"
 #include "FreeRTOS.h"
+#include "task.h"
 
 #define MA0 15
 #define MA1 1
@@ -12,26 +13,74 @@
 #define MC1 8
 
 #define MOTOR_PIN_MASK 		((1 << MA0) | (1<<MA1) | (1<<MB0) | (1<<MB1) | (1<<MC0) | (1<<MC1))
-#define MOTOR_INTERRUPT_PINS 	((1 << MA0) | (1<<MB0) | (1<<MC0))
+#define MOTOR_INTERRUPT_PINS 	MOTOR_PIN_MASK
 
 #define portINT_LEVEL_SENSITIVE  0
 
-#define TOLERANCE 2
+#define TOLERANCE 4
+
+/* Pin interrupts per ms above which the pins are polled from TC0 instead.
+ * Three motors at full speed give about 6 edges per ms */
+#define MAX_INTERRUPTS_PER_MS 12
+
+/* Edges per ms below which polling hands back to the pin interrupts */
+#define POLL_EXIT_EDGES_PER_MS (MAX_INTERRUPTS_PER_MS / 2)
+
+/* Polling rate, at least four samples per edge at full motor speed. TC0
+ * runs at MCK/8 */
+#define POLL_HZ 8000
+#define POLL_RC (configCPU_CLOCK_HZ / 8 / POLL_HZ)
+
+/* The PIT counts at MCK/16, edge timestamps are in these counts */
+#define EDGE_CLOCK_HZ (configCPU_CLOCK_HZ / 16)
+
+/* Edges per velocity estimate. Four edges are a full quadrature cycle, so
+ * uneven spacing between the edges of the two channels cancels out */
+#define EDGE_HISTORY 4
+
+/* A motor without edges for this long is standing still, 100 ms */
+#define EDGE_TIMEOUT (EDGE_CLOCK_HZ / 10)
 
 static struct motor_struct {
   int current_count;
   int target_count;
   int speed_percent;
   uint8_t has_target;
+  TaskHandle_t notify;                            // Task waiting for the target, notified from the ISR
   unsigned long last;
+  signed char direction;                          // Sign of the last count change
+  uint8_t edge;                                   // Newest entry in the edge history
+  uint8_t edges;                                  // Valid entries in the edge history
+  int edge_count[EDGE_HISTORY + 1];               // Count after each edge
+  unsigned long edge_time[EDGE_HISTORY + 1];      // Timestamp of each edge
 } motor[NXT_N_MOTORS];
 
+/* Count change for each transition, indexed by (previous pins << 2) | pins.
+ * Forward is 00 -> 01 -> 11 -> 10. Both pins changing at once (QUAD_SKIP)
+ * means one edge was missed, and the motor moved two counts on in the
+ * direction it was going */
+#define QUAD_SKIP 2
+static const signed char quad_table[16] = {
+   0,  1, -1,  QUAD_SKIP,
+  -1,  0,  QUAD_SKIP,  1,
+   1,  QUAD_SKIP,  0, -1,
+   QUAD_SKIP, -1,  1,  0
+};
+
 __irq __arm void nxt_motor_isr_C(void);
-void nxt_motor_quad_decode(struct motor_struct *m, unsigned long value);
+__irq __arm void nxt_motor_poll_isr_C(void);
+uint8_t nxt_motor_quad_decode(struct motor_struct *m, unsigned long value, unsigned long time);
 uint8_t motor_reached_target(uint8_t n, uint8_t tolerance);
+static unsigned long nxt_motor_timestamp(void);
+static void nxt_motor_check_target(unsigned long n);
+static void nxt_motor_decode_pins(unsigned long currentPins);
+static void nxt_motor_start_polling(void);
+static void nxt_motor_stop_polling(void);
 
 static unsigned long nxt_motor_initialised;
 static unsigned long interrupts_this_period;
+static unsigned long edges_this_period;
+static unsigned long polling;
 
 int nxt_motor_get_count(unsigned long n)
 {
@@ -41,6 +90,15 @@ int nxt_motor_get_count(unsigned long n)
     return 0;
 }
 
+// Whether the motor is still on its way to the count of nxt_motor_command
+int nxt_motor_has_target(unsigned long n)
+{
+  if (n < NXT_N_MOTORS)
+    return motor[n].has_target;
+  else
+    return 0;
+}
+
 int nxt_motor_get_speed(unsigned long n)
 {
   if (n < NXT_N_MOTORS)
@@ -48,10 +106,42 @@ int nxt_motor_get_speed(unsigned long n)
   else
     return 0;
 }
+// Counts per second, from the time between the last edges of the motor.
+// Until a full quadrature cycle has passed since the motor started or
+// turned, the estimate uses the edges there are
+int nxt_motor_get_velocity(unsigned long n)
+{
+  if (n >= NXT_N_MOTORS)
+    return 0;
+
+  struct motor_struct *m = &motor[n];
+
+  taskENTER_CRITICAL();
+  uint8_t edges = m->edges;
+  uint8_t oldest = (m->edge + EDGE_HISTORY + 2 - edges) % (EDGE_HISTORY + 1);
+  int counts = m->edge_count[m->edge] - m->edge_count[oldest];
+  unsigned long span = m->edge_time[m->edge] - m->edge_time[oldest];
+  unsigned long idle = nxt_motor_timestamp() - m->edge_time[m->edge];
+  taskEXIT_CRITICAL();
+
+  if (edges < 2 || idle > EDGE_TIMEOUT || counts == 0 || span == 0)
+    return 0;
+
+  // Without a new edge the motor has done less than one count since the last
+  // one, so the speed is at most one count over the idle time
+  int magnitude = (counts < 0) ? -counts : counts;
+  if (idle * magnitude > span)
+    return (counts < 0) ? -(int) (EDGE_CLOCK_HZ / idle) : (int) (EDGE_CLOCK_HZ / idle);
+
+  return (int) ((long long) counts * (long long) EDGE_CLOCK_HZ / (long long) span);
+}
+
 void nxt_motor_set_count(unsigned long n, int count)
 {
-  if (n < NXT_N_MOTORS)
+  if (n < NXT_N_MOTORS) {
     motor[n].current_count = count;
+    motor[n].edges = 0;
+  }
 }
 
 void nxt_motor_set_speed(unsigned long n, int speed_percent, int brake)
@@ -76,6 +166,7 @@ void nxt_motor_command(unsigned long n, int target_count, int speed_percent)
     if(motor[n].current_count < target_count + TOLERANCE && motor[n].current_count > target_count - TOLERANCE) return;
     if(target_count - motor[n].current_count < 0) speed_percent *= -1;
     motor[n].target_count = target_count;
+    motor[n].notify = xTaskGetCurrentTaskHandle();
     motor[n].has_target = 1;
     nxt_avr_set_motor(n, speed_percent, 1);
   }
@@ -85,75 +176,129 @@ void nxt_motor_command(unsigned long n, int target_count, int speed_percent)
 void nxt_motor_1kHz_process(void)
 {
   if (nxt_motor_initialised) {
+    taskENTER_CRITICAL();
+    if (polling && edges_this_period < POLL_EXIT_EDGES_PER_MS)
+      nxt_motor_stop_polling();
     interrupts_this_period = 0;
-    *AT91C_PIOA_IER = MOTOR_INTERRUPT_PINS;
+    edges_this_period = 0;
+    taskEXIT_CRITICAL();
   }
 
 }
 
-void nxt_motor_quad_decode(struct motor_struct *m, unsigned long value)
+// Samples the pins from TC0 instead of taking an interrupt per edge
+static void nxt_motor_start_polling(void)
 {
-#if 0
-  if (m->last != value) {
-    if ((m->last + 1) & 3 == value)
-      m->current_count--;
-    else if ((value + 1) & 3 == m->last)
-      m->current_count++;
-    m->last = value;
-  }
-#endif
-
-  unsigned long dir = value & 2;
-  unsigned long edge = value & 1;
-
-  if (edge != m->last) {
-    if (edge && !dir)
-      m->current_count++;
-    else if (edge && dir)
-      m->current_count--;
-    else if (!edge && dir)
-      m->current_count++;
-    else if (!edge && !dir)
-      m->current_count--;
-    m->last = edge;
-  }
+  *AT91C_PIOA_IDR = MOTOR_INTERRUPT_PINS;
+  AT91C_BASE_TC0->TC_IER = AT91C_TC_CPCS;
+  AT91C_BASE_TC0->TC_CCR = AT91C_TC_CLKEN | AT91C_TC_SWTRG;
+  polling = 1;
 }
 
-__irq __arm void nxt_motor_isr_C(void)
+// Back to pin interrupts. Changes since the last poll are still latched in
+// PIOA_ISR, so the first interrupt comes at once and nothing is missed
+static void nxt_motor_stop_polling(void)
 {
-  unsigned long pinChanges = *AT91C_PIOA_ISR;	// Acknowledge change
-  unsigned long currentPins = *AT91C_PIOA_PDSR;	// Read pins
+  AT91C_BASE_TC0->TC_CCR = AT91C_TC_CLKDIS;
+  AT91C_BASE_TC0->TC_IDR = AT91C_TC_CPCS;
+  *AT91C_PIOA_IER = MOTOR_INTERRUPT_PINS;
+  polling = 0;
+}
 
-  unsigned long pins;
+// PIT counts since the scheduler started. A tick that is due but not yet
+// handled is in PICNT, so the time does not jump back at the tick
+static unsigned long nxt_motor_timestamp(void)
+{
+  unsigned long image = AT91C_BASE_PITC->PITC_PIIR;
+  unsigned long period = (AT91C_BASE_PITC->PITC_PIMR & AT91C_SYSC_PIV) + 1;
 
-  interrupts_this_period++;
-  if (interrupts_this_period > 4) {
-    *AT91C_PIOA_IDR = MOTOR_INTERRUPT_PINS;
-    // Todo : tacho speed fault
+  return (xTaskGetTickCountFromISR() + (image >> 20)) * period + (image & AT91C_SYSC_CPIV);
+}
+
+// Decodes every edge on both channels, four counts per encoder cycle.
+// Returns 1 if the count changed
+uint8_t nxt_motor_quad_decode(struct motor_struct *m, unsigned long value, unsigned long time)
+{
+  int step = quad_table[(m->last << 2) | value];
+  m->last = value;
+
+  if (step == QUAD_SKIP)
+    step = 2 * m->direction;
+
+  if (step == 0)
+    return 0;
+
+  // Edges from before the motor turned or stopped say nothing of its speed
+  signed char direction = (step > 0) ? 1 : -1;
+  if (direction != m->direction || time - m->edge_time[m->edge] > EDGE_TIMEOUT)
+    m->edges = 0;
+
+  m->current_count += step;
+  m->direction = direction;
+
+  m->edge = (m->edge + 1) % (EDGE_HISTORY + 1);
+  m->edge_count[m->edge] = m->current_count;
+  m->edge_time[m->edge] = time;
+  if (m->edges <= EDGE_HISTORY)
+    m->edges++;
+
+  return 1;
+}
+
+/* Stops a motor at its target and wakes the task that commanded it. The
+ * ISRs can not switch context, so the task runs at the next tick. */
+static void nxt_motor_check_target(unsigned long n)
+{
+  if(motor_reached_target(n, TOLERANCE)) {
+    nxt_motor_set_speed(n, 0, 1);
+    motor[n].has_target = 0;
+    if(motor[n].notify) {
+      vTaskNotifyGiveFromISR(motor[n].notify, NULL);
+      motor[n].notify = NULL;
+    }
   }
+}
 
+static void nxt_motor_decode_pins(unsigned long currentPins)
+{
+  unsigned long pins;
+  unsigned long time = nxt_motor_timestamp();
 
   /* Motor A */
   pins = ((currentPins >> MA0) & 1) | ((currentPins >> (MA1 - 1)) & 2);
-  nxt_motor_quad_decode(&motor[0], pins);
-  if(motor_reached_target(0, TOLERANCE)) {
-    nxt_motor_set_speed(0, 0, 1);
-    motor[0].has_target = 0;
-  }
+  edges_this_period += nxt_motor_quad_decode(&motor[0], pins, time);
+  nxt_motor_check_target(0);
   /* Motor B */
   pins = ((currentPins >> MB0) & 1) | ((currentPins >> (MB1 - 1)) & 2);
-  nxt_motor_quad_decode(&motor[1], pins);
-  if(motor_reached_target(1, TOLERANCE)) {
-    nxt_motor_set_speed(1, 0, 1);
-    motor[1].has_target = 0;
-  }     
+  edges_this_period += nxt_motor_quad_decode(&motor[1], pins, time);
+  nxt_motor_check_target(1);
   /* Motor C */
   pins = ((currentPins >> MC0) & 1) | ((currentPins >> (MC1 - 1)) & 2);
-  nxt_motor_quad_decode(&motor[2], pins);
-  if(motor_reached_target(2, TOLERANCE)) {
-    nxt_motor_set_speed(2, 0, 1);
-    motor[2].has_target = 0;
-  }
+  edges_this_period += nxt_motor_quad_decode(&motor[2], pins, time);
+  nxt_motor_check_target(2);
+}
+
+__irq __arm void nxt_motor_isr_C(void)
+{
+  unsigned long pinChanges = *AT91C_PIOA_ISR;	// Acknowledge change
+  unsigned long currentPins = *AT91C_PIOA_PDSR;	// Read pins
+
+  nxt_motor_decode_pins(currentPins);
+
+  // Too many edges for an interrupt each, poll the pins until the rate drops
+  interrupts_this_period++;
+  if (interrupts_this_period > MAX_INTERRUPTS_PER_MS && !polling)
+    nxt_motor_start_polling();
+
+  AT91C_BASE_AIC->AIC_EOICR = 0; //Inform the AIC the interrupt is done
+}
+
+__irq __arm void nxt_motor_poll_isr_C(void)
+{
+  (void) AT91C_BASE_TC0->TC_SR;	// Acknowledge compare
+
+  nxt_motor_decode_pins(*AT91C_PIOA_PDSR);
+
   AT91C_BASE_AIC->AIC_EOICR = 0; //Inform the AIC the interrupt is done
 }
 
@@ -177,14 +322,31 @@ void nxt_motor_init(void)
   AT91F_AIC_ConfigureIt( AT91C_BASE_AIC, AT91C_ID_PIOA, AT91C_AIC_PRIOR_HIGHEST-2, portINT_LEVEL_SENSITIVE, ( void (*)(void) ) nxt_motor_isr_C );
   AT91F_AIC_EnableIt( AT91C_BASE_AIC, AT91C_ID_PIOA );       
 
+  /* TC0 polls the pins during edge storms, it stays stopped until then */
+  *AT91C_PMC_PCER = (1 << AT91C_ID_TC0);
+  AT91C_BASE_TC0->TC_CCR = AT91C_TC_CLKDIS;
+  AT91C_BASE_TC0->TC_IDR = ~0;
+  AT91C_BASE_TC0->TC_CMR = AT91C_TC_CLKS_TIMER_DIV2_CLOCK | AT91C_TC_WAVE | AT91C_TC_WAVESEL_UP_AUTO;
+  AT91C_BASE_TC0->TC_RC = POLL_RC;
+  AT91F_AIC_ConfigureIt( AT91C_BASE_AIC, AT91C_ID_TC0, AT91C_AIC_PRIOR_HIGHEST-2, portINT_LEVEL_SENSITIVE, ( void (*)(void) ) nxt_motor_poll_isr_C );
+  AT91F_AIC_EnableIt( AT91C_BASE_AIC, AT91C_ID_TC0 );
+
   *AT91C_PIOA_IER = MOTOR_INTERRUPT_PINS;
 
+  unsigned long currentPins = *AT91C_PIOA_PDSR;
+  motor[0].last = ((currentPins >> MA0) & 1) | ((currentPins >> (MA1 - 1)) & 2);
+  motor[1].last = ((currentPins >> MB0) & 1) | ((currentPins >> (MB1 - 1)) & 2);
+  motor[2].last = ((currentPins >> MC0) & 1) | ((currentPins >> (MC1 - 1)) & 2);
+
   uint8_t i;
   for(i=0;i<NXT_N_MOTORS;i++) {
     motor[i].has_target = 0;
+    motor[i].notify = NULL;
     motor[i].target_count = 0;
     motor[i].current_count = 0;
     motor[i].speed_percent = 0;
+    motor[i].direction = 0;
+    motor[i].edges = 0;
   }
   nxt_motor_initialised = 1;
 
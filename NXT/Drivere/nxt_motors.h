@@ -5,6 +5,8 @@
 
 int nxt_motor_get_count(unsigned long n);
 int nxt_motor_get_speed(unsigned long n);
+int nxt_motor_get_velocity(unsigned long n);
+int nxt_motor_has_target(unsigned long n);
 void nxt_motor_set_count(unsigned long n, int count);
 void nxt_motor_set_speed(unsigned long n, int speed_percent, int brake);
 void nxt_motor_command(unsigned long n, int target_count, int speed_percent);
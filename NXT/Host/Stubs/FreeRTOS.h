@@ -0,0 +1,37 @@
+/************************************************************************/
+// File:			FreeRTOS.h
+//
+// Host stand-in for the FreeRTOS headers, used when the portable modules
+// are built and tested on a PC. It only has the types and macros those
+// modules use. The tick is 1 ms as on the robot, and is a plain counter
+// that the tests move, see host_rtos.h.
+//
+/************************************************************************/
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE					((BaseType_t) 0)
+#define pdTRUE					((BaseType_t) 1)
+#define pdPASS					pdTRUE
+#define pdFAIL					pdFALSE
+#define errQUEUE_FULL			((BaseType_t) 0)
+
+#define portTICK_PERIOD_MS		((TickType_t) 1)
+#define portMAX_DELAY			((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(xTimeInMs)	((TickType_t) (xTimeInMs))
+
+#define configASSERT(x)			assert(x)
+
+#define pvPortMalloc(xSize)		malloc(xSize)
+#define vPortFree(pv)			free(pv)
+
+#endif /* INC_FREERTOS_H */
@@ -0,0 +1,14 @@
+/************************************************************************/
+// File:			cpufunc.h
+//
+// Host stand-in for <avr/cpufunc.h> of avr-libc, for the
+// IO-microcontroller sources in the host tests.
+//
+/************************************************************************/
+
+#ifndef _AVR_CPUFUNC_H_
+#define _AVR_CPUFUNC_H_
+
+#define _NOP()
+
+#endif /* _AVR_CPUFUNC_H_ */
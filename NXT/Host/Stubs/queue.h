@@ -0,0 +1,28 @@
+/************************************************************************/
+// File:			queue.h
+//
+// Host stand-in for the FreeRTOS queue API. Queues hold copies of their
+// items as on the robot. Only one task runs on the host, so a receive from
+// an empty queue waits tick by tick, and only gHostTickHook can send to it
+// in the meantime, see host_rtos.h. A NULL queue is always empty.
+//
+/************************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef void * QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait);
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+BaseType_t xQueueReset(QueueHandle_t xQueue);
+
+#define xQueueSend(xQueue, pvItemToQueue, xTicksToWait) \
+	xQueueSendToBack((xQueue), (pvItemToQueue), (xTicksToWait))
+
+#endif /* QUEUE_H */
@@ -0,0 +1,23 @@
+/************************************************************************/
+// File:			semphr.h
+//
+// Host stand-in for the FreeRTOS semaphore API. A semaphore is a queue
+// of empty items, as in FreeRTOS. Only one task runs on the host, so a
+// mutex is always free when it is taken.
+//
+/************************************************************************/
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreTake(xSemaphore, xBlockTime)	xQueueReceive((xSemaphore), NULL, (xBlockTime))
+#define xSemaphoreGive(xSemaphore)				xQueueSendToBack((xSemaphore), NULL, 0)
+
+#endif /* SEMAPHORE_H */
@@ -0,0 +1,49 @@
+/************************************************************************/
+// File:			task.h
+//
+// Host stand-in for the FreeRTOS task API. Only one task runs on the host,
+// so suspending the scheduler and critical sections do nothing, and every
+// notification goes to that task. vTaskDelay moves the tick instead of
+// sleeping, see host_rtos.h. xTaskCreate only hands out the handle of
+// that task, the test calls the task function itself.
+//
+/************************************************************************/
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum {
+	eNoAction = 0,
+	eSetBits,
+	eIncrement,
+	eSetValueWithOverwrite,
+	eSetValueWithoutOverwrite
+} eNotifyAction;
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName, const uint16_t usStackDepth,
+		void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pxCreatedTask);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+void vTaskDelay(const TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement);
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction,
+		BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue,
+		TickType_t xTicksToWait);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskResumeAll(void);
+
+#define vTaskSuspendAll()
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#endif /* INC_TASK_H */
@@ -0,0 +1,23 @@
+/************************************************************************/
+// File:			timers.h
+//
+// Host stand-in for the FreeRTOS software timers. The callbacks run from
+// vTaskDelay at the tick the timer expires, after gHostTickHook, as the
+// timer task at the top priority would, see host_rtos.h.
+//
+/************************************************************************/
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include "FreeRTOS.h"
+
+typedef void * TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t xTimer);
+
+TimerHandle_t xTimerCreate(const char * const pcTimerName, const TickType_t xTimerPeriodInTicks,
+		const UBaseType_t uxAutoReload, void * const pvTimerID, TimerCallbackFunction_t pxCallbackFunction);
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait);
+
+#endif /* TIMERS_H */
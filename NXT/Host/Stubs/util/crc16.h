@@ -0,0 +1,26 @@
+/************************************************************************/
+// File:			crc16.h
+//
+// Host stand-in for <util/crc16.h> of avr-libc, for the IO-microcontroller
+// sources in the host tests. The update function is the C equivalent
+// given in the avr-libc documentation.
+//
+/************************************************************************/
+
+#ifndef _UTIL_CRC16_H_
+#define _UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data) {
+	crc = crc ^ data;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x01)
+			crc = (crc >> 1) ^ 0x8C;
+		else
+			crc >>= 1;
+	}
+	return crc;
+}
+
+#endif /* _UTIL_CRC16_H_ */
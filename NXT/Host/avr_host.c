@@ -0,0 +1,184 @@
+/************************************************************************/
+// File:			avr_host.c
+//
+// The IO-microcontroller side of the host loopback, see avr_host.h.
+//
+/************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "avr_host.h"
+
+#include "../../IO mikrokontroller/io-mikro/fifo.c"
+#include "../../IO mikrokontroller/io-mikro/io_nxt.c"
+#include "../../IO mikrokontroller/io-mikro/bt.h"
+
+/* From main.c and uart.c */
+#define IO_NXT_BUFFER_SIZE		128
+#define IO_DONGLE_BUFFER_SIZE	128
+#define SEND_LIMIT0				255		// uart0_send fails on longer messages
+
+#define DELAY_SLOTS				12		// _delay_us(500) at the end of a pass
+#define SLOTS_PER_BT_BYTE		6		// The dongle UART runs at 38400 baud
+
+avr_host_stats_t gAvrHost;
+const uint8_t gAvrPushSlackMs = PUSH_SLACK_MS;
+
+/* The uart0 fifo and receive count of uart.c, and the bytes rs485_send
+ * has not finished sending */
+static char rxBuf[IO_NXT_BUFFER_SIZE];
+static fifo_t rxFifo;
+static uint8_t rxCount;
+static uint8_t txBuf[1024];
+static int txHead, txTail;
+static uint8_t sending;
+
+/* The loop and the slots it waits before it runs on */
+static ucontext_t avrContext, lineContext;
+static char avrStack[64 * 1024];
+static long waitSlots;
+
+static void avr_wait(long slots) {
+	waitSlots = slots;
+	swapcontext(&avrContext, &lineContext);
+}
+
+rs485_status rs485_init(uint8_t buffer_size) {
+	fifo_init(&rxFifo, rxBuf, buffer_size < sizeof(rxBuf) ? buffer_size : sizeof(rxBuf));
+	rxCount = 0;
+	txHead = txTail = 0;
+	sending = FALSE;
+	return RS485_OK;
+}
+
+rs485_receive_result rs485_receive_token(uint8_t *data, uint8_t token) {
+	rs485_receive_result result = { fifo_read_token(&rxFifo, data, token), RS485_OK };
+	return result;
+}
+
+uint8_t rs485_receive_count(void) {
+	return rxCount;
+}
+
+rs485_status rs485_send(uint8_t *data, uint8_t len) {
+	if (len > SEND_LIMIT0 || data == NULL)
+		return RS485_FAIL;
+
+	sending = TRUE;
+	for (uint8_t i = 0; i < len; i++) {
+		txBuf[txHead] = data[i];
+		txHead = (txHead + 1) % sizeof(txBuf);
+	}
+	while (txTail != txHead)
+		avr_wait(1);
+	sending = FALSE;
+	return RS485_OK;
+}
+
+bt_status bt_send(uint8_t *data, uint16_t len) {
+	(void) data;
+	gAvrHost.btBytes += len;
+	avr_wait(len * SLOTS_PER_BT_BYTE);
+	return BT_OK;
+}
+
+bt_receive_result bt_receive(uint8_t *data, uint16_t len) {
+	bt_receive_result result = { avr_host_bt_receive(data, len), BT_OK };
+	return result;
+}
+
+static void sample_sensors(struct to_nxt *values) {
+	values->sample_tick = tick_ms();
+	avr_wait(avr_host_sample(&values->gyro_z));
+	values->sample_count++;
+}
+
+/* The loop in main.c, without the LEDs */
+static void avr_main(void) {
+	struct to_nxt values;
+	uint8_t message[IO_NXT_BUFFER_SIZE];
+	uint8_t num_bytes = 0;
+	memset(&values, 0, sizeof(values));
+	uint8_t count = 0;
+	uint8_t push_period = 0;
+	uint16_t push_tick = 0;
+
+	while (1) {
+		if (!push_period && ++count > 50) {
+			count = 0;
+			sample_sensors(&values);
+		}
+
+		uint8_t idle = io_nxt_line_idle();
+		while (idle && (num_bytes = io_nxt_get_message(message)) > 0) {
+			uint8_t tag = message[1];
+			if (message[0] == ALIVE_TEST) {
+				io_nxt_send(ALIVE_RESPONSE, tag, NULL, 0);
+			} else if (message[0] == RECEIVE_SENSORS) {
+				push_tick = tick_ms();
+				io_nxt_send(SENSOR_DATA, tag, (uint8_t *) &values, sizeof(values));
+			} else if (message[0] == SEND_BT) {
+				bt_send(&message[2], num_bytes - 2);
+			} else if (message[0] == RECEIVE_BT) {
+				uint8_t bt_msg[IO_DONGLE_BUFFER_SIZE];
+				bt_receive_result bt_result = bt_receive(bt_msg, IO_DONGLE_BUFFER_SIZE);
+				io_nxt_send(BT_DATA, tag, bt_msg, bt_result.num_received_bytes);
+			} else if (message[0] == SUBSCRIBE_SENSORS && num_bytes > 2) {
+				push_period = message[2];
+				push_tick = tick_ms();
+				sample_sensors(&values);
+				io_nxt_send(SENSOR_DATA, tag, (uint8_t *) &values, sizeof(values));
+				gAvrHost.subscribes++;
+			}
+		}
+
+		uint16_t since_push = tick_ms() - push_tick;
+		if (push_period && idle && since_push >= push_period) {
+			if (since_push - push_period <= PUSH_SLACK_MS) {
+				push_tick += push_period;
+			} else {
+				push_tick += since_push;
+				gAvrHost.latePushes++;
+			}
+			sample_sensors(&values);
+			io_nxt_send(SENSOR_DATA, 0, (uint8_t *) &values, sizeof(values));
+			gAvrHost.pushes++;
+		}
+		avr_wait(DELAY_SLOTS);
+	}
+}
+
+void avr_host_reset(void) {
+	io_nxt_init(IO_NXT_BUFFER_SIZE);
+
+	getcontext(&avrContext);
+	avrContext.uc_stack.ss_sp = avrStack;
+	avrContext.uc_stack.ss_size = sizeof(avrStack);
+	avrContext.uc_link = NULL;
+	makecontext(&avrContext, avr_main, 0);
+	waitSlots = 0;
+}
+
+void avr_host_slot(void) {
+	if (waitSlots > 0 && --waitSlots > 0)
+		return;
+	swapcontext(&lineContext, &avrContext);
+}
+
+void avr_host_receive(uint8_t byte) {
+	// The transceiver does not listen while it drives the line
+	if (sending || !fifo_write(&rxFifo, byte))
+		gAvrHost.dropped++;
+	rxCount++;
+}
+
+int avr_host_transmit(void) {
+	if (txTail == txHead)
+		return -1;
+
+	uint8_t byte = txBuf[txTail];
+	txTail = (txTail + 1) % sizeof(txBuf);
+	return byte;
+}
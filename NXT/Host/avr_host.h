@@ -0,0 +1,53 @@
+/************************************************************************/
+// File:			avr_host.h
+//
+// The IO-microcontroller for the host loopback of the NXT <-> IO link.
+// io_nxt.c and fifo.c run as they are, with a copy of the loop in main.c.
+// rs485.c is replaced by the fifo the test fills with avr_host_receive,
+// and a queue of sent bytes the test takes off the line with
+// avr_host_transmit.
+//
+// The loop runs in a context of its own, one byte slot at a time. It
+// waits where the AVR is busy: in rs485_send until the bytes are out, in
+// bt_send for the dongle UART at 38400 baud, and in the 500 us delay at
+// the end of each pass. avr_host_slot lets it run until it waits again.
+//
+// The message types of io_nxt.h clash with those in io.c, so this is a
+// translation unit of its own. The test defines tick_ms, the timer 0
+// tick of tick.c, and the functions below that stand in for the sensors
+// and the dongle.
+//
+/************************************************************************/
+
+#ifndef AVR_HOST_H_
+#define AVR_HOST_H_
+
+#include <stdint.h>
+
+typedef struct {
+	long pushes;				// Untagged SENSOR_DATA
+	long latePushes;			// Pushes that started a new period
+	long subscribes;
+	long dropped;				// Bytes lost to a full fifo or while sending
+	long btBytes;				// Bytes of SEND_BT passed to the dongle
+} avr_host_stats_t;
+
+extern avr_host_stats_t gAvrHost;
+extern const uint8_t gAvrPushSlackMs;	// PUSH_SLACK_MS of io_nxt.h
+
+/* Starts the loop over as after a reset: not subscribed, and counting
+ * samples from 0 */
+void avr_host_reset(void);
+void avr_host_slot(void);
+void avr_host_receive(uint8_t byte);
+int avr_host_transmit(void);
+
+/* From io_nxt.c, for the round trip of single messages */
+uint8_t io_nxt_get_message(uint8_t *data);
+
+/* Defined by the test */
+uint16_t tick_ms(void);
+int avr_host_sample(int16_t *gyroZ);	// Reads the gyro, returns the byte slots the rest of sample_sensors takes
+uint8_t avr_host_bt_receive(uint8_t *data, uint16_t len);	// Bytes stored in the dongle
+
+#endif /* AVR_HOST_H_ */
@@ -0,0 +1,259 @@
+#include "host_rtos.h"
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+#include "timers.h"
+
+#include <string.h>
+
+typedef struct {
+	uint8_t *items;
+	UBaseType_t length;
+	UBaseType_t size;
+	UBaseType_t count;
+	UBaseType_t head;		// Oldest item
+} host_queue_t;
+
+typedef struct host_timer {
+	TickType_t period;
+	UBaseType_t autoReload;
+	TimerCallbackFunction_t callback;
+	uint8_t active;
+	TickType_t expiry;
+	struct host_timer *next;
+} host_timer_t;
+
+static host_timer_t *Timers = NULL;
+
+volatile TickType_t gHostTick = 0;
+void (*gHostTickHook)(TickType_t tick) = NULL;
+
+/* Notification value of the one task, and whether a notification is
+ * pending, which is what a blocked task waits for */
+static uint32_t notifyValue = 0;
+static uint8_t notifyPending = 0;
+
+TickType_t xTaskGetTickCount(void) {
+	return gHostTick;
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+	return gHostTick;
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay) {
+	for (TickType_t i = 0; i < xTicksToDelay; i++) {
+		gHostTick++;
+		if (gHostTickHook)
+			gHostTickHook(gHostTick);
+
+		for (host_timer_t *Timer = Timers; Timer; Timer = Timer->next) {
+			if (!Timer->active || (int32_t) (gHostTick - Timer->expiry) < 0)
+				continue;
+			if (Timer->autoReload)
+				Timer->expiry += Timer->period;
+			else
+				Timer->active = 0;
+			Timer->callback(Timer);
+		}
+	}
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName, const uint16_t usStackDepth,
+		void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pxCreatedTask) {
+	(void) pxTaskCode, (void) pcName, (void) usStackDepth, (void) pvParameters, (void) uxPriority;
+	if (pxCreatedTask)
+		*pxCreatedTask = xTaskGetCurrentTaskHandle();
+	return pdPASS;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction) {
+	(void) xTaskToNotify;
+	switch (eAction) {
+	case eSetBits:
+		notifyValue |= ulValue;
+		break;
+	case eIncrement:
+		notifyValue++;
+		break;
+	case eSetValueWithoutOverwrite:
+		if (notifyPending)
+			return pdFAIL;
+		/* no break */
+	case eSetValueWithOverwrite:
+		notifyValue = ulValue;
+		break;
+	case eNoAction:
+		break;
+	}
+	notifyPending = 1;
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction,
+		BaseType_t *pxHigherPriorityTaskWoken) {
+	if (pxHigherPriorityTaskWoken)
+		*pxHigherPriorityTaskWoken = pdFALSE;
+	return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify) {
+	return xTaskNotify(xTaskToNotify, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken) {
+	xTaskNotifyFromISR(xTaskToNotify, 0, eIncrement, pxHigherPriorityTaskWoken);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return (TaskHandle_t) &notifyValue;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait) {
+	for (TickType_t i = 0; notifyValue == 0 && i < xTicksToWait; i++)
+		vTaskDelay(1);
+
+	uint32_t count = notifyValue;
+	if (xClearCountOnExit)
+		notifyValue = 0;
+	else if (notifyValue > 0)
+		notifyValue--;
+	notifyPending = 0;
+	return count;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue,
+		TickType_t xTicksToWait) {
+	if (!notifyPending)
+		notifyValue &= ~ulBitsToClearOnEntry;
+	for (TickType_t i = 0; !notifyPending && i < xTicksToWait; i++)
+		vTaskDelay(1);
+
+	if (pulNotificationValue)
+		*pulNotificationValue = notifyValue;
+	if (!notifyPending)
+		return pdFALSE;
+
+	notifyValue &= ~ulBitsToClearOnExit;
+	notifyPending = 0;
+	return pdTRUE;
+}
+
+BaseType_t xTaskResumeAll(void) {
+	return pdFALSE;
+}
+
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement) {
+	*pxPreviousWakeTime += xTimeIncrement;
+	int32_t remaining = (int32_t) (*pxPreviousWakeTime - gHostTick);
+	if (remaining > 0)
+		vTaskDelay((TickType_t) remaining);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+	host_queue_t *Queue = malloc(sizeof(host_queue_t));
+	configASSERT(Queue);
+	Queue->items = malloc(uxQueueLength * uxItemSize);
+	configASSERT(Queue->items);
+	Queue->length = uxQueueLength;
+	Queue->size = uxItemSize;
+	Queue->count = 0;
+	Queue->head = 0;
+	return Queue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait) {
+	host_queue_t *Queue = xQueue;
+	if (!Queue)
+		return errQUEUE_FULL;
+
+	for (TickType_t i = 0; Queue->count == Queue->length && i < xTicksToWait; i++)
+		vTaskDelay(1);
+	if (Queue->count == Queue->length)
+		return errQUEUE_FULL;
+
+	UBaseType_t tail = (Queue->head + Queue->count) % Queue->length;
+	if (pvItemToQueue)		// Semaphores have no items
+		memcpy(Queue->items + tail * Queue->size, pvItemToQueue, Queue->size);
+	Queue->count++;
+	return pdPASS;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait) {
+	host_queue_t *Queue = xQueue;
+	for (TickType_t i = 0; (!Queue || Queue->count == 0) && i < xTicksToWait; i++)
+		vTaskDelay(1);
+	if (!Queue || Queue->count == 0)
+		return pdFALSE;
+
+	if (pvBuffer)
+		memcpy(pvBuffer, Queue->items + Queue->head * Queue->size, Queue->size);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait) {
+	if (!xQueuePeek(xQueue, pvBuffer, xTicksToWait))
+		return pdFALSE;
+
+	host_queue_t *Queue = xQueue;
+	Queue->head = (Queue->head + 1) % Queue->length;
+	Queue->count--;
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+	host_queue_t *Queue = xQueue;
+	return Queue ? Queue->count : 0;
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue) {
+	host_queue_t *Queue = xQueue;
+	if (Queue)
+		Queue->count = 0;
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+	return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	SemaphoreHandle_t xMutex = xSemaphoreCreateBinary();
+	xSemaphoreGive(xMutex);
+	return xMutex;
+}
+
+TimerHandle_t xTimerCreate(const char * const pcTimerName, const TickType_t xTimerPeriodInTicks,
+		const UBaseType_t uxAutoReload, void * const pvTimerID, TimerCallbackFunction_t pxCallbackFunction) {
+	(void) pcTimerName, (void) pvTimerID;
+	host_timer_t *Timer = malloc(sizeof(host_timer_t));
+	configASSERT(Timer);
+	Timer->period = xTimerPeriodInTicks;
+	Timer->autoReload = uxAutoReload;
+	Timer->callback = pxCallbackFunction;
+	Timer->active = 0;
+	Timer->next = Timers;
+	Timers = Timer;
+	return Timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+	(void) xTicksToWait;
+	host_timer_t *Timer = xTimer;
+	Timer->active = 1;
+	Timer->expiry = gHostTick + Timer->period;
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+	(void) xTicksToWait;
+	((host_timer_t *) xTimer)->active = 0;
+	return pdPASS;
+}
+
+void vHostStopTimers(void) {
+	for (host_timer_t *Timer = Timers; Timer; Timer = Timer->next)
+		Timer->active = 0;
+}
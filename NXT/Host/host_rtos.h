@@ -0,0 +1,27 @@
+/************************************************************************/
+// File:			host_rtos.h
+//
+// Simulated tick for the host tests. xTaskGetTickCount returns gHostTick,
+// and vTaskDelay advances it one tick at a time, calling gHostTickHook
+// after each tick if it is set. A test can use the hook to run what
+// another task would do while the code under test sleeps, and can end a
+// task that never returns with longjmp. Notifications go to the one task,
+// and a blocking notify take or queue receive returns at the first tick
+// after the hook has notified or sent. Software timers run after the
+// hook, at the tick they expire.
+//
+/************************************************************************/
+
+#ifndef HOST_RTOS_H_
+#define HOST_RTOS_H_
+
+#include "FreeRTOS.h"
+
+extern volatile TickType_t gHostTick;
+extern void (*gHostTickHook)(TickType_t tick);
+
+/* Stops every software timer, for a test that starts the code under test
+ * again */
+void vHostStopTimers(void);
+
+#endif /* HOST_RTOS_H_ */
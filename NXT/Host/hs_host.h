@@ -0,0 +1,184 @@
+/************************************************************************/
+// File:			hs_host.h
+//
+// Includes the RS485 driver for the host tests, with USART0 and its PDC
+// moved to a plain struct from the register layout of the AT91SAM7S. The
+// test plays the line: hs_host_receive stores a byte as the PDC would,
+// hs_host_timeout marks the end of a burst, and hs_host_transmit takes
+// the next byte the PDC sends. hs_host_interrupt then runs the ISR for as
+// long as the level sensitive interrupt is asserted.
+//
+// The PDC registers hold 32 bit addresses, so the test has to be linked
+// without PIE to keep the buffers of the driver below 4 GB.
+//
+// Include this in one source file only, after FreeRTOS.h. The test
+// defines sp_reset.
+//
+/************************************************************************/
+
+#ifndef HS_HOST_H_
+#define HS_HOST_H_
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+
+/* Peripherals */
+#include "AT91SAM7S64.h"
+
+static AT91S_USART fakeUs0;
+static AT91S_AIC fakeAic;
+static AT91_REG fakePcer, fakePcdr, fakePpudr, fakePdr, fakeAsr;
+
+#undef AT91C_BASE_AIC
+#undef AT91C_US0_CR
+#undef AT91C_US0_MR
+#undef AT91C_US0_IER
+#undef AT91C_US0_IDR
+#undef AT91C_US0_IMR
+#undef AT91C_US0_CSR
+#undef AT91C_US0_RHR
+#undef AT91C_US0_BRGR
+#undef AT91C_US0_RTOR
+#undef AT91C_US0_TTGR
+#undef AT91C_US0_RPR
+#undef AT91C_US0_RCR
+#undef AT91C_US0_TCR
+#undef AT91C_US0_RNPR
+#undef AT91C_US0_RNCR
+#undef AT91C_US0_TNPR
+#undef AT91C_US0_TNCR
+#undef AT91C_US0_PTCR
+#undef AT91C_PMC_PCER
+#undef AT91C_PMC_PCDR
+#undef AT91C_PIOA_PPUDR
+#undef AT91C_PIOA_PDR
+#undef AT91C_PIOA_ASR
+#define AT91C_BASE_AIC		(&fakeAic)
+#define AT91C_US0_CR		(&fakeUs0.US_CR)
+#define AT91C_US0_MR		(&fakeUs0.US_MR)
+#define AT91C_US0_IER		(&fakeUs0.US_IER)
+#define AT91C_US0_IDR		(&fakeUs0.US_IDR)
+#define AT91C_US0_IMR		(&fakeUs0.US_IMR)
+#define AT91C_US0_CSR		(&fakeUs0.US_CSR)
+#define AT91C_US0_RHR		(&fakeUs0.US_RHR)
+#define AT91C_US0_BRGR		(&fakeUs0.US_BRGR)
+#define AT91C_US0_RTOR		(&fakeUs0.US_RTOR)
+#define AT91C_US0_TTGR		(&fakeUs0.US_TTGR)
+#define AT91C_US0_RPR		(&fakeUs0.US_RPR)
+#define AT91C_US0_RCR		(&fakeUs0.US_RCR)
+#define AT91C_US0_TCR		(&fakeUs0.US_TCR)
+#define AT91C_US0_RNPR		(&fakeUs0.US_RNPR)
+#define AT91C_US0_RNCR		(&fakeUs0.US_RNCR)
+#define AT91C_US0_TNPR		(&fakeUs0.US_TNPR)
+#define AT91C_US0_TNCR		(&fakeUs0.US_TNCR)
+#define AT91C_US0_PTCR		(&fakeUs0.US_PTCR)
+#define AT91C_PMC_PCER		(&fakePcer)
+#define AT91C_PMC_PCDR		(&fakePcdr)
+#define AT91C_PIOA_PPUDR	(&fakePpudr)
+#define AT91C_PIOA_PDR		(&fakePdr)
+#define AT91C_PIOA_ASR		(&fakeAsr)
+
+#define AT91F_AIC_ConfigureIt(...)
+#define AT91F_AIC_EnableIt(...)
+#define AT91F_AIC_DisableIt(...)
+#define __irq
+#define __arm
+#define configCPU_CLOCK_HZ	((unsigned long) 47923200)
+
+#include "hs.c"
+
+/* The receive counters as the PDC last left them. ENDRX is set when RCR
+ * reaches 0 and stays set until the driver writes RCR or RNCR */
+static AT91_REG pdcRcr, pdcRncr;
+static uint8_t endRx;
+
+/* Takes what the driver wrote to the control and interrupt registers */
+static inline void hs_host_sync(void) {
+	if (fakeUs0.US_RCR != pdcRcr || fakeUs0.US_RNCR != pdcRncr)
+		endRx = 0;
+	pdcRcr = fakeUs0.US_RCR;
+	pdcRncr = fakeUs0.US_RNCR;
+
+	if (fakeUs0.US_CR & AT91C_US_STTTO)
+		fakeUs0.US_CSR &= ~AT91C_US_TIMEOUT;
+	fakeUs0.US_CR = 0;
+
+	// hs_enable disables all interrupts before it enables its own
+	fakeUs0.US_IMR &= ~fakeUs0.US_IDR;
+	fakeUs0.US_IMR |= fakeUs0.US_IER;
+	fakeUs0.US_IER = fakeUs0.US_IDR = 0;
+
+	if (endRx)
+		fakeUs0.US_CSR |= AT91C_US_ENDRX;
+	else
+		fakeUs0.US_CSR &= ~AT91C_US_ENDRX;
+}
+
+/* Enables the driver at 230400 baud with an empty line */
+static inline void hs_host_enable(void) {
+	memset(&fakeUs0, 0, sizeof(fakeUs0));
+	pdcRcr = pdcRncr = 0;
+	endRx = 0;
+	hs_enable(230400);
+	hs_host_sync();
+}
+
+/* The PDC stores a received byte. Returns FALSE if it had no buffer left
+ * and the byte was lost */
+static inline uint8_t hs_host_receive(unsigned char byte) {
+	hs_host_sync();
+	if (fakeUs0.US_RCR == 0)
+		return FALSE;
+
+	*(unsigned char *) (uintptr_t) fakeUs0.US_RPR = byte;
+	fakeUs0.US_RPR++;
+	if (--fakeUs0.US_RCR == 0) {
+		endRx = 1;
+		if (fakeUs0.US_RNCR) {
+			fakeUs0.US_RPR = fakeUs0.US_RNPR;
+			fakeUs0.US_RCR = fakeUs0.US_RNCR;
+			fakeUs0.US_RNCR = 0;
+		}
+	}
+	pdcRcr = fakeUs0.US_RCR;
+	pdcRncr = fakeUs0.US_RNCR;
+	hs_host_sync();
+	return TRUE;
+}
+
+/* The line has been quiet for the receiver time-out after a burst */
+static inline void hs_host_timeout(void) {
+	hs_host_sync();
+	fakeUs0.US_CSR |= AT91C_US_TIMEOUT;
+}
+
+/* Runs the ISR while the interrupt is asserted, up to limit times. Returns
+ * the number of calls */
+static inline long hs_host_interrupt(long limit) {
+	long calls = 0;
+	hs_host_sync();
+	while (calls < limit && (fakeUs0.US_CSR & fakeUs0.US_IMR & (AT91C_US_ENDRX | AT91C_US_TIMEOUT))) {
+		hs_isr_C();
+		hs_host_sync();
+		calls++;
+	}
+	return calls;
+}
+
+/* The next byte the PDC sends, or -1 if it has nothing to send */
+static inline int hs_host_transmit(void) {
+	if (fakeUs0.US_TCR == 0 && fakeUs0.US_TNCR) {
+		fakeUs0.US_TPR = fakeUs0.US_TNPR;
+		fakeUs0.US_TCR = fakeUs0.US_TNCR;
+		fakeUs0.US_TNCR = 0;
+	}
+	if (fakeUs0.US_TCR == 0)
+		return -1;
+
+	fakeUs0.US_TCR--;
+	return *(unsigned char *) (uintptr_t) fakeUs0.US_TPR++;
+}
+
+#endif /* HS_HOST_H_ */
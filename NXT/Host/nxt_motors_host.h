@@ -0,0 +1,92 @@
+/************************************************************************/
+// File:			nxt_motors_host.h
+//
+// Includes the motor driver for the host tests, with the PIT, TC0, PIOA
+// and AIC moved to plain structs from the register layouts of the
+// AT91SAM7S. A test sets the encoder pins and the PIT with set_phase and
+// set_time, and calls the ISRs itself. The tick of the PIT is gHostTick.
+// The test defines nxt_avr_set_motor, which gets the motor power.
+//
+// Include this in one source file only, after FreeRTOS.h.
+//
+/************************************************************************/
+
+#ifndef NXT_MOTORS_HOST_H_
+#define NXT_MOTORS_HOST_H_
+
+#include "FreeRTOS.h"
+#include "host_rtos.h"
+
+/* Peripherals */
+#include "AT91SAM7S64.h"
+
+static AT91S_PITC fakePit;
+static AT91S_TC fakeTc;
+static AT91S_PIO fakePio;
+static AT91S_AIC fakeAic;
+static AT91_REG fakePcer;
+
+#undef AT91C_BASE_PITC
+#undef AT91C_BASE_TC0
+#undef AT91C_BASE_AIC
+#undef AT91C_PIOA_ISR
+#undef AT91C_PIOA_PDSR
+#undef AT91C_PIOA_IER
+#undef AT91C_PIOA_IDR
+#undef AT91C_PIOA_IFER
+#undef AT91C_PIOA_PPUDR
+#undef AT91C_PIOA_PER
+#undef AT91C_PIOA_ODR
+#undef AT91C_PMC_PCER
+#define AT91C_BASE_PITC		(&fakePit)
+#define AT91C_BASE_TC0		(&fakeTc)
+#define AT91C_BASE_AIC		(&fakeAic)
+#define AT91C_PIOA_ISR		(&fakePio.PIO_ISR)
+#define AT91C_PIOA_PDSR		(&fakePio.PIO_PDSR)
+#define AT91C_PIOA_IER		(&fakePio.PIO_IER)
+#define AT91C_PIOA_IDR		(&fakePio.PIO_IDR)
+#define AT91C_PIOA_IFER		(&fakePio.PIO_IFER)
+#define AT91C_PIOA_PPUDR	(&fakePio.PIO_PPUDR)
+#define AT91C_PIOA_PER		(&fakePio.PIO_PER)
+#define AT91C_PIOA_ODR		(&fakePio.PIO_ODR)
+#define AT91C_PMC_PCER		(&fakePcer)
+
+#define AT91F_AIC_ConfigureIt(...)
+#define AT91F_AIC_EnableIt(...)
+#define __irq
+#define __arm
+#define configCPU_CLOCK_HZ	((unsigned long) 47923200)
+
+#include "nxt_motors.c"
+
+/* PIT counts per tick, the PIT runs at MCK/16 with a 1 ms tick */
+#define PIT_PERIOD		2995
+
+/* Forward is 00 -> 01 -> 11 -> 10 in (B A) */
+static const unsigned long gray[4] = { 0, 1, 3, 2 };
+static const unsigned long pinA[NXT_N_MOTORS] = { MA0, MB0, MC0 };
+static const unsigned long pinB[NXT_N_MOTORS] = { MA1, MB1, MC1 };
+
+/* Sets the PIT to us microseconds after the start, in whole PIT counts */
+static inline void set_time(double us) {
+	unsigned long counts = (unsigned long) (us * PIT_PERIOD / 1000);
+	gHostTick = counts / PIT_PERIOD;
+	fakePit.PITC_PIIR = counts % PIT_PERIOD;
+}
+
+/* Sets the encoder pins of motor n to the quadrature phase, forward is up */
+static inline void set_phase(uint8_t n, int phase) {
+	unsigned long pins = gray[phase & 3];
+	fakePio.PIO_PDSR &= ~((1ul << pinA[n]) | (1ul << pinB[n]));
+	fakePio.PIO_PDSR |= ((pins & 1) << pinA[n]) | ((pins >> 1) << pinB[n]);
+}
+
+/* Starts the driver at time 0 with all encoder pins low */
+static inline void motors_init(void) {
+	fakePit.PITC_PIMR = PIT_PERIOD - 1;
+	fakePio.PIO_PDSR = 0;
+	set_time(0);
+	nxt_motor_init();
+}
+
+#endif /* NXT_MOTORS_HOST_H_ */
@@ -0,0 +1,26 @@
+/************************************************************************/
+// File:			test.h
+//
+// Minimal checks for the host tests. CHECK prints the failed expression
+// and counts it, and TEST_RESULT makes the test exit non-zero if any
+// check failed, so that make check stops.
+//
+/************************************************************************/
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(x) do { \
+		if (!(x)) { \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); \
+			testFailures++; \
+		} \
+	} while (0)
+
+#define TEST_RESULT() (printf("%s: %s\n", __FILE__, testFailures ? "FAILED" : "ok"), testFailures != 0)
+
+#endif /* TEST_H_ */
@@ -0,0 +1,131 @@
+/************************************************************************/
+// File:			test_cobs.c
+//
+// Host test of the framing on the NXT <-> IO-microcontroller link:
+// | Type | Tag | Data | CRC | is COBS encoded and ends with a zero byte.
+// Frames are passed through a buffer_t ring, split on the zero byte and
+// decoded again, across the wrap-around of the ring.
+//
+/************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "buffer.h"
+#include "cobs.h"
+#include "crc.h"
+
+#define MAX_DATA	300
+
+static void test_round_trip(void) {
+	uint8_t data[MAX_DATA], encoded[COBS_ENCODE_DST_BUF_LEN_MAX(MAX_DATA)], decoded[MAX_DATA];
+
+	for (int run = 0; run < 5000; run++) {
+		size_t len = rand() % MAX_DATA;
+		for (size_t i = 0; i < len; i++)
+			data[i] = (run & 1) ? rand() : (rand() % 4 ? 0 : rand());	// Many zero bytes every other run
+
+		cobs_encode_result enc = cobs_encode(encoded, sizeof encoded, data, len);
+		CHECK(enc.status == COBS_ENCODE_OK);
+		CHECK(enc.out_len <= COBS_ENCODE_DST_BUF_LEN_MAX(len));
+		CHECK(memchr(encoded, 0, enc.out_len) == NULL);
+
+		cobs_decode_result dec = cobs_decode(decoded, sizeof decoded, encoded, enc.out_len);
+		CHECK(dec.status == COBS_DECODE_OK);
+		CHECK(dec.out_len == len);
+		CHECK(memcmp(data, decoded, len) == 0);
+	}
+
+	// Runs of 254 and more non-zero bytes are split with a code byte of 0xFF
+	memset(data, 0x55, sizeof data);
+	for (size_t len = 250; len <= MAX_DATA; len++) {
+		cobs_encode_result enc = cobs_encode(encoded, sizeof encoded, data, len);
+		cobs_decode_result dec = cobs_decode(decoded, sizeof decoded, encoded, enc.out_len);
+		CHECK(enc.status == COBS_ENCODE_OK && memchr(encoded, 0, enc.out_len) == NULL);
+		CHECK(dec.status == COBS_DECODE_OK && dec.out_len == len && memcmp(data, decoded, len) == 0);
+	}
+
+	// Too small an output buffer is reported, not overrun
+	cobs_encode_result enc = cobs_encode(encoded, 10, data, 20);
+	CHECK(enc.status & COBS_ENCODE_OUT_BUFFER_OVERFLOW);
+	CHECK(enc.out_len <= 10);
+}
+
+static void test_crc(void) {
+	// Dallas/Maxim 8-bit CRC check value
+	CHECK((uint8_t) calculate_crc("123456789", 9) == 0xA1);
+
+	// Appending the CRC gives a CRC of zero, for any byte values
+	char message[64];
+	for (int run = 0; run < 1000; run++) {
+		char len = 1 + rand() % 62;
+		for (int i = 0; i < len; i++)
+			message[i] = rand();
+		message[(int) len] = calculate_crc(message, len);
+		CHECK(calculate_crc(message, len + 1) == 0);
+
+		message[rand() % len] ^= 1 << (rand() % 8);
+		CHECK(calculate_crc(message, len + 1) != 0);
+	}
+}
+
+static void test_frames_through_ring(void) {
+	uint8_t ring[97];	// Not a multiple of the frame sizes, so frames wrap
+	buffer_t Ring;
+	CHECK(buffer_init(&Ring, ring, sizeof ring));
+
+	uint8_t sent[8][40], sentLen[8];
+	uint8_t frame[COBS_ENCODE_DST_BUF_LEN_MAX(40) + 1], received[sizeof frame], decoded[40];
+	uint16_t receivedLen = 0;
+	int writes = 0, reads = 0;
+
+	while (reads < 20000) {
+		// Writer: | Type | Tag | Data | CRC | and the zero delimiter
+		while (writes - reads < 8) {
+			uint8_t *msg = sent[writes % 8];
+			uint8_t len = 3 + rand() % 30;
+			for (uint8_t i = 0; i < len - 1; i++)
+				msg[i] = rand() % 3 ? rand() : 0;
+			msg[len - 1] = calculate_crc((char *) msg, len - 1);
+
+			cobs_encode_result enc = cobs_encode(frame, sizeof frame - 1, msg, len);
+			frame[enc.out_len] = 0;
+			if (!buffer_append(&Ring, frame, enc.out_len + 1))
+				break;
+			sentLen[writes % 8] = len;
+			writes++;
+		}
+
+		// Reader: takes a few bytes at a time, as when a frame is still arriving
+		uint8_t chunk[16];
+		uint16_t n = buffer_remove(&Ring, chunk, 1 + rand() % sizeof chunk);
+		for (uint16_t i = 0; i < n; i++) {
+			CHECK(receivedLen < sizeof received);
+			received[receivedLen++] = chunk[i];
+			if (chunk[i] != 0)
+				continue;
+
+			cobs_decode_result dec = cobs_decode(decoded, sizeof decoded, received, receivedLen - 1);
+			CHECK(dec.status == COBS_DECODE_OK);
+			CHECK(dec.out_len == sentLen[reads % 8]);
+			CHECK(memcmp(decoded, sent[reads % 8], dec.out_len) == 0);
+			CHECK(calculate_crc((char *) decoded, dec.out_len) == 0);
+			reads++;
+			receivedLen = 0;
+		}
+	}
+	CHECK(Ring.len == (Ring.head + sizeof ring - Ring.tail) % sizeof ring || Ring.len == sizeof ring);
+}
+
+int main(void) {
+	srand(1);
+
+	test_round_trip();
+	test_crc();
+	test_frames_through_ring();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+/************************************************************************/
+// File:			test_ekf.c
+//
+// Host test of the pose EKF. A robot drives a curving path with noisy
+// odometry and a noisy heading fix every 100 steps, and the filter's
+// covariance is checked against its actual error (NEES).
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "ekf.h"
+
+static double gaussian(void) {
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/* e^T P^-1 e, from the inverse of the symmetric P by cofactors */
+static double nees(const matrix3_t *P, const double e[3]) {
+	double a = P->m[0][0], b = P->m[0][1], c = P->m[0][2];
+	double d = P->m[1][1], f = P->m[1][2], g = P->m[2][2];
+	double det = a * (d * g - f * f) - b * (b * g - c * f) + c * (b * f - d * c);
+	double inv[3][3] = {
+		{ (d * g - f * f) / det, (c * f - b * g) / det, (b * f - c * d) / det },
+		{ 0, (a * g - c * c) / det, (b * c - a * f) / det },
+		{ 0, 0, (a * d - b * b) / det }
+	};
+	inv[1][0] = inv[0][1];
+	inv[2][0] = inv[0][2];
+	inv[2][1] = inv[1][2];
+
+	double q = 0;
+	for (uint8_t i = 0; i < 3; i++)
+		for (uint8_t j = 0; j < 3; j++)
+			q += e[i] * inv[i][j] * e[j];
+	return q;
+}
+
+static uint8_t is_positive_definite(const matrix3_t *P) {
+	double a = P->m[0][0], b = P->m[0][1], c = P->m[0][2];
+	double d = P->m[1][1], f = P->m[1][2], g = P->m[2][2];
+	return a > 0 && a * d - b * b > 0 && a * (d * g - f * f) - b * (b * g - c * f) + c * (b * f - d * c) > 0 &&
+		   P->m[0][1] == P->m[1][0] && P->m[0][2] == P->m[2][0] && P->m[1][2] == P->m[2][1];
+}
+
+static void test_consistency(void) {
+	const int runs = 300, steps = 1500;
+	const double step = 5.0;							// [mm] per estimator period
+	const double varTheta = 0.0029;						// [rad^2] per step
+	const double varHeading = 0.0025;					// [rad^2] of the heading fix
+	double sumNees = 0, sumError = 0;
+	uint8_t definite = TRUE;
+
+	for (int run = 0; run < runs; run++) {
+		ekf_t Filter;
+		ekf_init(&Filter);
+		// The start pose is known
+		Filter.P = (matrix3_t) { { { 1e-6f, 0, 0 }, { 0, 1e-6f, 0 }, { 0, 0, 1e-6f } } };
+		double x = 0, y = 0, theta = 0;
+
+		for (int k = 0; k < steps; k++) {
+			double dTheta = 0.02 * sin(k * 0.01);
+			double phi = theta + dTheta / 2;
+			x += step * cos(phi);
+			y += step * sin(phi);
+			theta += dTheta;
+
+			double varDistance = EKF_DISTANCE_VARIANCE * step;
+			ekf_predict(&Filter, step + gaussian() * sqrt(varDistance), dTheta + gaussian() * sqrt(varTheta), varDistance, varTheta);
+			if (k % 100 == 99)
+				ekf_update_heading(&Filter, remainder(theta + gaussian() * sqrt(varHeading), 2 * M_PI), varHeading);
+			definite &= is_positive_definite(&Filter.P);
+		}
+
+		double e[3] = { Filter.Pose.x - x, Filter.Pose.y - y, remainder(Filter.Pose.theta - theta, 2 * M_PI) };
+		sumNees += nees(&Filter.P, e);
+		sumError += hypot(e[0], e[1]);
+	}
+
+	// A consistent filter has a mean NEES of 3 over the three states. With
+	// 300 runs the mean has a standard deviation of 0.14, and the
+	// linearisation makes the filter somewhat optimistic.
+	double meanNees = sumNees / runs;
+	CHECK(definite);
+	CHECK(meanNees > 2.5 && meanNees < 4.0);
+
+	printf("test_consistency: mean NEES %.2f, mean position error %.0f mm after %.1f m\n",
+			meanNees, sumError / runs, steps * step / 1000);
+}
+
+static void test_heading_update(void) {
+	ekf_t Filter;
+	ekf_init(&Filter);
+	Filter.Pose.theta = 3.1f;
+
+	// A fix just across the wrap at pi pulls the heading the short way
+	float innovation = ekf_update_heading(&Filter, -3.1f, 1.0f);
+	CHECK(fabsf(innovation - (2 * M_PI_F - 6.2f)) < 1e-5f);
+	CHECK(fabsf(fabsf(Filter.Pose.theta) - M_PI_F) < 0.05f);
+	CHECK(fabsf(Filter.P.m[2][2] - 0.5f) < 1e-6f);
+
+	// Driving makes x and y depend on the heading, so a heading fix moves
+	// them too
+	ekf_init(&Filter);
+	for (int k = 0; k < 100; k++)
+		ekf_predict(&Filter, 10, 0, 0, 0);
+	CHECK(Filter.P.m[1][2] > 0);
+	ekf_update_heading(&Filter, 0.1f, 0.0001f);
+	CHECK(Filter.Pose.y > 50);
+	CHECK(is_positive_definite(&Filter.P));
+}
+
+int main(void) {
+	srand(3);
+
+	test_consistency();
+	test_heading_update();
+
+	ekf_t Filter;
+	ekf_init(&Filter);
+	const int N = 1000000;
+	clock_t t0 = clock();
+	for (int i = 0; i < N; i++)
+		ekf_predict(&Filter, 1, 0.001f, 0.5f, 0.003f);
+	clock_t t1 = clock();
+	printf("ekf_predict: %.0f ns per call\n", (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N);
+
+	return TEST_RESULT();
+}
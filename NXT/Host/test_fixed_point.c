@@ -0,0 +1,143 @@
+/************************************************************************/
+// File:			test_fixed_point.c
+//
+// Host test of the Q16.16 routines in fixed_point.c against libm, and of
+// the float wrappers in functions.c with FIXED_POINT_MATH defined. Built
+// with -fsanitize=undefined, so an undefined shift or overflow stops the
+// test.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+#include "defines.h"
+#include "fixed_point.h"
+#include "functions.h"
+
+#define F(x)	FIX16_FROM_FLOAT(x)
+#define T(x)	((x) / 65536.0)		/* In double, a float only has 24 bits */
+
+/* Difference between two angles, the short way around */
+static double angle_error(double a, double b) {
+	return fabs(remainder(a - b, 2 * M_PI));
+}
+
+static double random_uniform(double low, double high) {
+	return low + (high - low) * rand() / (double) RAND_MAX;
+}
+
+static void test_trig(void) {
+	double sinError = 0, cosError = 0;
+	for (double a = -20; a < 20; a += 0.0007) {
+		double wrapped = T(fmod(F(a), FIX16_TWO_PI));
+		sinError = fmax(sinError, fabs(T(fix16_sin(F(a))) - sin(wrapped)));
+		cosError = fmax(cosError, fabs(T(fix16_cos(F(a))) - cos(wrapped)));
+	}
+	CHECK(sinError < 5e-5);
+	CHECK(cosError < 5e-5);
+
+	// The whole range, where cos used to overflow when adding pi/2. Angles
+	// are wrapped with FIX16_TWO_PI, which is off by 4e-6, so far out the
+	// result is compared with the angle wrapped the same way.
+	const fix16_t Edges[] = { INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX - FIX16_HALF_PI, INT32_MAX };
+	for (uint8_t i = 0; i < sizeof Edges / sizeof Edges[0]; i++) {
+		double wrapped = T(fmod(Edges[i], FIX16_TWO_PI));
+		CHECK(fabs(T(fix16_sin(Edges[i])) - sin(wrapped)) < 5e-5);
+		CHECK(fabs(T(fix16_cos(Edges[i])) - cos(wrapped)) < 5e-5);
+	}
+
+	double atan2Error = 0;
+	for (int i = 0; i < 1000000; i++) {
+		// Magnitudes from 1e-4 to 3e4, where the scaling has most to do
+		double scale = pow(10, random_uniform(-4, 4.4));
+		fix16_t x = F(random_uniform(-1, 1) * scale), y = F(random_uniform(-1, 1) * scale);
+		if (x == 0 && y == 0)
+			continue;
+		atan2Error = fmax(atan2Error, angle_error(T(fix16_atan2(y, x)), atan2(T(y), T(x))));
+	}
+	CHECK(atan2Error < 7e-5);
+
+	// abs(INT32_MIN) is undefined, the magnitudes are taken as unsigned
+	CHECK(angle_error(T(fix16_atan2(0, INT32_MIN)), M_PI) < 7e-5);
+	CHECK(angle_error(T(fix16_atan2(INT32_MIN, 0)), -M_PI / 2) < 7e-5);
+	CHECK(angle_error(T(fix16_atan2(INT32_MIN, INT32_MIN)), -3 * M_PI / 4) < 7e-5);
+	CHECK(angle_error(T(fix16_atan2(INT32_MAX, INT32_MIN)), 3 * M_PI / 4) < 7e-5);
+	CHECK(fix16_atan2(0, 0) == 0);
+
+	printf("test_trig: max error sin %.1e cos %.1e atan2 %.1e rad\n", sinError, cosError, atan2Error);
+}
+
+static void test_arithmetic(void) {
+	double sqrtError = 0;
+	for (int i = 0; i < 1000000; i++) {
+		fix16_t a = rand() & INT32_MAX;
+		double expected = sqrt(T(a));
+		sqrtError = fmax(sqrtError, fabs(T(fix16_sqrt(a)) - expected) / fmax(1, expected));
+	}
+	CHECK(sqrtError < 2e-5);
+	CHECK(fix16_sqrt(-FIX16_ONE) == 0);
+	CHECK(fix16_sqrt(FIX16_FROM_INT(4)) == FIX16_FROM_INT(2));
+
+	CHECK(fix16_mul(F(-1.5f), F(2.5f)) == F(-3.75f));
+	CHECK(fix16_div(F(-3.75f), F(2.5f)) == F(-1.5f));
+	CHECK(fix16_div(F(-3.75f), F(-1.5f)) == F(2.5f));
+	CHECK(fix16_div(FIX16_ONE, 0) == INT32_MAX && fix16_div(-FIX16_ONE, 0) == INT32_MIN);
+
+	// Wrapping, also from the ends of the range
+	fix16_t angle = F(-7.0f);
+	fix16_inf2pi(&angle);
+	CHECK(fabs(T(angle) - (-7 + 2 * M_PI)) < 1e-4);
+	angle = F(13.0f);
+	fix16_wrap_to_2pi(&angle);
+	CHECK(fabs(T(angle) - (13 - 4 * M_PI)) < 1e-3);
+	angle = INT32_MIN;
+	fix16_inf2pi(&angle);
+	CHECK(angle >= -FIX16_PI && angle <= FIX16_PI);
+	angle = INT32_MIN;
+	fix16_wrap_to_2pi(&angle);
+	CHECK(angle >= 0 && angle < FIX16_TWO_PI);
+
+	// Distances to just below the largest fix16_t, further ones saturate
+	double distanceError = 0;
+	for (int i = 0; i < 1000000; i++) {
+		fix_point_t P = { F(random_uniform(-16000, 16000)), F(random_uniform(-16000, 16000)) };
+		fix_point_t Q = { F(random_uniform(-16000, 16000)), F(random_uniform(-16000, 16000)) };
+		double expected = hypot(T(P.x) - T(Q.x), T(P.y) - T(Q.y));
+		if (expected < 32767)
+			distanceError = fmax(distanceError, fabs(T(fix16_distance_between(&P, &Q)) - expected));
+	}
+	CHECK(distanceError < 1e-3);
+	fix_point_t Far1 = { INT32_MIN, INT32_MIN }, Far2 = { INT32_MAX, INT32_MAX };
+	CHECK(fix16_distance_between(&Far1, &Far2) == INT32_MAX);
+
+	printf("test_arithmetic: max error sqrt %.1e relative, distance %.1e\n", sqrtError, distanceError);
+}
+
+static void test_float_wrappers(void) {
+	CHECK(fabsf(func_sin(1.0f) - sinf(1.0f)) < 5e-5f);
+	CHECK(fabsf(func_cos(-4.0f) - cosf(-4.0f)) < 5e-5f);
+	CHECK(fabsf(func_atan2(-2.0f, -3.0f) - atan2f(-2.0f, -3.0f)) < 7e-5f);
+
+	// Large input is scaled into range, infinite and NaN input gives 0
+	CHECK(fabsf(func_atan2(1e30f, 1e30f) - 0.25f * M_PI_F) < 7e-5f);
+	CHECK(func_atan2(INFINITY, 1.0f) == 0.0f);
+	CHECK(func_atan2(1.0f, -INFINITY) == 0.0f);
+	CHECK(func_atan2(NAN, 1.0f) == 0.0f);
+
+	point_t P = { 3, 4 }, Q = { -3, -4 };
+	CHECK(fabsf(func_distance_between(&P, &Q) - 10) < 1e-3f);
+}
+
+int main(void) {
+	srand(1);
+
+	test_trig();
+	test_arithmetic();
+	test_float_wrappers();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/************************************************************************/
+// File:			test_functions.c
+//
+// Host test of the angle wrapping in functions.c. vFunc_Inf2pi and
+// func_wrap_to_2pi are run on a sweep over the float bit patterns and
+// compared with remainder and fmod in double.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+
+#include "defines.h"
+#include "functions.h"
+
+/* The wrapping loop the functions replaced */
+static void loop_inf2pi(float *angle) {
+	do {
+		if (*angle > M_PI_F)
+			*angle -= 2 * M_PI_F;
+		else if (*angle < -M_PI_F)
+			*angle += 2 * M_PI_F;
+	} while (fabsf(*angle) > M_PI_F);
+}
+
+static void test_wrap_sweep(void) {
+	long outOfRange = 0, notNan = 0, finite = 0;
+	double inf2piError = 0, wrapError = 0;
+
+	// Every 1021st bit pattern, all exponents and signs
+	for (uint64_t bits = 0; bits < (1ull << 32); bits += 1021) {
+		uint32_t u = (uint32_t) bits;
+		float x;
+		memcpy(&x, &u, sizeof x);
+
+		float a = x, w = x;
+		vFunc_Inf2pi(&a);
+		func_wrap_to_2pi(&w);
+
+		if (!isfinite(x)) {
+			notNan += !isnan(a) || !isnan(w);
+			continue;
+		}
+		finite++;
+
+		outOfRange += !(a >= -M_PI_F && a <= M_PI_F);
+		outOfRange += !(w >= 0 && w < 2 * M_PI_F);
+
+		// Both sides of the wrap are the same angle
+		double e = fabs(a - remainder(x, 2 * M_PI));
+		inf2piError = fmax(inf2piError, fmin(e, fabs(e - 2 * M_PI)));
+		double reference = fmod(x, 2 * M_PI);
+		if (reference < 0)
+			reference += 2 * M_PI;
+		e = fabs(w - reference);
+		wrapError = fmax(wrapError, fmin(e, fabs(e - 2 * M_PI)));
+	}
+
+	CHECK(outOfRange == 0);
+	CHECK(notNan == 0);
+	// Below WRAP_LIMIT k * TWO_PI_LO is rounded to float, which is up to
+	// 2e-6 near the limit. The angle itself is only known to 0.016 there.
+	CHECK(inf2piError < 3e-6);
+	CHECK(wrapError < 3e-6);
+
+	printf("test_wrap_sweep: %ld finite angles, max error inf2pi %.1e wrap %.1e rad\n", finite, inf2piError, wrapError);
+}
+
+static void test_wrap_as_loop(void) {
+	// Angles within a few turns give what the loop gave, to rounding
+	for (float x = -30; x < 30; x += 0.001f) {
+		float a = x, b = x;
+		vFunc_Inf2pi(&a);
+		loop_inf2pi(&b);
+		CHECK(fabsf(a - b) < 1e-5f || fabsf(fabsf(a - b) - 2 * M_PI_F) < 1e-5f);
+	}
+
+	// In range angles are returned unchanged
+	float a = -M_PI_F, w = 0;
+	vFunc_Inf2pi(&a);
+	func_wrap_to_2pi(&w);
+	CHECK(a == -M_PI_F && w == 0);
+	// 2 * M_PI_F is just above 2pi
+	w = 2 * M_PI_F;
+	func_wrap_to_2pi(&w);
+	CHECK(w >= 0 && w < 1e-6f);
+
+	// Cost per call for typical angles, and for the loop with a large angle
+	const int N = 20000000;
+	volatile float sink = 0;
+	clock_t t0 = clock();
+	for (int i = 0; i < N; i++) {
+		float angle = (i % 1000) * 0.01f - 5;
+		loop_inf2pi(&angle);
+		sink += angle;
+	}
+	clock_t t1 = clock();
+	for (int i = 0; i < N; i++) {
+		float angle = (i % 1000) * 0.01f - 5;
+		vFunc_Inf2pi(&angle);
+		sink += angle;
+	}
+	clock_t t2 = clock();
+	float large = 1000;
+	loop_inf2pi(&large);
+	clock_t t3 = clock();
+
+	printf("test_wrap_as_loop: %.1f ns per call in [-5, 5] against %.1f ns for the loop, %.0f ns for the loop at 1000 rad\n",
+			(t2 - t1) * 1e9 / CLOCKS_PER_SEC / N, (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N, (t3 - t2) * 1e9 / CLOCKS_PER_SEC);
+}
+
+int main(void) {
+	test_wrap_sweep();
+	test_wrap_as_loop();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/************************************************************************/
+// File:			test_hs.c
+//
+// Host test of the RS485 receive ring in hs.c, included through
+// hs_host.h so the test plays the PDC. A stream of IO-microcontroller
+// frames is replayed at 230400 baud, 23 bytes per ms: sensor data every
+// 30 ms and bluetooth responses with zero-containing payloads. A reader
+// takes the frames with hs_read_frame every few ms, as the io task does.
+//
+/************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "host_rtos.h"
+
+#include "hs_host.h"
+
+#include "cobs.h"
+#include "crc.h"
+
+void sp_reset(int port) {
+	(void) port;
+}
+
+#define BYTES_PER_MS		23
+#define TIMEOUT_SLOTS		2		// The receiver time-out of 20 bit periods
+#define SENSOR_PERIOD_MS	30
+#define SENSOR_DATA_LEN		21		// struct from_io
+#define MAX_FRAMES			16384
+#define LINE_SIZE			4096
+#define DRAIN_MS			20		// Without new frames at the end of a replay
+
+/* Frames in the order they are sent, with the delimiter */
+typedef struct {
+	uint8_t data[HS_FRAME_MAX];
+	uint8_t len;
+} line_frame_t;
+
+static line_frame_t Frames[MAX_FRAMES];
+static int nFrames;
+
+/* Bytes waiting to be sent on the line */
+static uint8_t Line[LINE_SIZE];
+static int lineHead, lineTail;
+
+static void line_put(const uint8_t *data, int len) {
+	for (int i = 0; i < len; i++) {
+		Line[lineHead] = data[i];
+		lineHead = (lineHead + 1) % LINE_SIZE;
+	}
+}
+
+/* Queues | Type | Tag | Data | CRC | with COBS and the delimiter, the way
+ * io_nxt_send on the IO-microcontroller frames it */
+static void send_frame(uint8_t type, const uint8_t *data, uint8_t len) {
+	uint8_t message[HS_FRAME_MAX];
+	message[0] = type;
+	message[1] = 0;
+	memcpy(message + 2, data, len);
+	message[len + 2] = calculate_crc((char *) message, len + 2);
+
+	line_frame_t *Frame = &Frames[nFrames++ % MAX_FRAMES];
+	cobs_encode_result result = cobs_encode(Frame->data, sizeof(Frame->data) - 1, message, len + 3);
+	CHECK(result.status == COBS_ENCODE_OK);
+	Frame->data[result.out_len] = 0;
+	Frame->len = result.out_len + 1;
+	line_put(Frame->data, Frame->len);
+}
+
+typedef struct {
+	long sent, delivered, intact;
+	long received, overruns;
+	double scannedPerFrame;
+	long isrCalls, maxCalls;	// In all, and back to back in one interrupt
+} replay_t;
+
+/**
+ * Replays ms of traffic with a bluetooth response of up to btMax bytes
+ * every btPeriod ms, and reads the frames every readerPeriod ms.
+ */
+static replay_t replay(int btMax, int btPeriod, int readerPeriod, uint32_t ms) {
+	replay_t Result = { 0 };
+	int next = 0, quiet = 0;
+
+	nFrames = 0;
+	lineHead = lineTail = 0;
+	hs_host_enable();
+
+	for (uint32_t t = 0; t < ms + DRAIN_MS; t++) {
+		uint8_t data[HS_FRAME_MAX];
+		if (t < ms && t % SENSOR_PERIOD_MS == 0) {
+			for (int i = 0; i < SENSOR_DATA_LEN; i++)
+				data[i] = rand();
+			send_frame(1, data, SENSOR_DATA_LEN);
+		}
+		if (t < ms && t % btPeriod == (uint32_t) btPeriod / 2) {
+			int len = rand() % (btMax + 1);
+			for (int i = 0; i < len; i++)
+				data[i] = (rand() % 8 == 0) ? 0 : rand();
+			send_frame(2, data, len);
+		}
+
+		for (int slot = 0; slot < BYTES_PER_MS; slot++) {
+			if (lineTail != lineHead) {
+				if (!hs_host_receive(Line[lineTail]))
+					Result.overruns++;
+				lineTail = (lineTail + 1) % LINE_SIZE;
+				Result.received++;
+				quiet = 0;
+			} else if (++quiet == TIMEOUT_SLOTS) {
+				hs_host_timeout();
+			}
+			long calls = hs_host_interrupt(100000);
+			Result.isrCalls += calls;
+			if (calls > Result.maxCalls)
+				Result.maxCalls = calls;
+		}
+
+		if (t % readerPeriod != 0 && t != ms + DRAIN_MS - 1)
+			continue;
+
+		// As the io task, release each frame once it has been decoded
+		hs_frame_t frame;
+		while (hs_read_frame(&frame, 0) > 0) {
+			Result.delivered++;
+			for (int k = next; k < nFrames && k < next + 8; k++) {
+				line_frame_t *Frame = &Frames[k % MAX_FRAMES];
+				if (frame.len == Frame->len && memcmp(frame.data, Frame->data, frame.len) == 0) {
+					Result.intact++;
+					next = k + 1;
+					break;
+				}
+			}
+			hs_release_frames();
+		}
+	}
+
+	Result.sent = nFrames;
+	Result.scannedPerFrame = Result.delivered ? (double) in_scan / Result.delivered : 0;
+	return Result;
+}
+
+static void test_replay(void) {
+	static const struct {
+		const char *name;
+		int btMax, btPeriod, readerPeriod;
+	} Runs[] = {
+		{ "BT <= 40 B every 50 ms", 40, 50, 1 },
+		{ "BT <= 64 B every 50 ms", 64, 50, 1 },
+		{ "BT <= 128 B every 10 ms", 128, 10, 1 },
+		{ "BT <= 128 B, reader 3 ms", 128, 10, 3 },
+		{ "BT <= 128 B, reader 5 ms", 128, 10, 5 },
+		{ "BT <= 128 B, reader 10 ms", 128, 10, 10 },
+	};
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(Runs) / sizeof(Runs[0]); i++) {
+		replay_t Result = replay(Runs[i].btMax, Runs[i].btPeriod, Runs[i].readerPeriod, 60000);
+		printf("%-26s %ld/%ld frames, %.1f bytes scanned per frame, %ld overruns\n", Runs[i].name,
+				Result.intact, Result.sent, Result.scannedPerFrame, Result.overruns);
+
+		// Every frame arrives intact, and every byte is searched once
+		CHECK(Result.intact == Result.sent && Result.delivered == Result.sent);
+		CHECK(Result.overruns == 0);
+		CHECK(in_scan == (unsigned long) Result.received);
+	}
+}
+
+static void test_interrupts(void) {
+	// ENDRX is level sensitive and stays set until the next block is chained.
+	// The ISR has to mask it when no block is free, even while the reader
+	// holds on to the ring for longer than it takes to fill
+	static const int Readers[] = { 1, 5, 20 };
+	for (size_t i = 0; i < sizeof(Readers) / sizeof(Readers[0]); i++) {
+		replay_t Result = replay(128, 10, Readers[i], 10000);
+		printf("reader every %2d ms: %.2f ISR calls per ms, at most %ld back to back, %ld overruns\n", Readers[i],
+				Result.isrCalls / 10000.0, Result.maxCalls, Result.overruns);
+		CHECK(Result.maxCalls == 1);
+		CHECK(Result.isrCalls < 10000);
+	}
+}
+
+static void test_no_delimiter(void) {
+	hs_host_enable();
+
+	// A run of noise longer than a frame is dropped a frame's worth at a
+	// time. The rest of it comes with the next frame, which the io task
+	// rejects, and the frame after that is intact
+	nFrames = 0;
+	lineHead = lineTail = 0;
+	uint8_t noise[300];
+	for (size_t i = 0; i < sizeof(noise); i++)
+		noise[i] = 1 + rand() % 255;
+	line_put(noise, sizeof(noise));
+	uint8_t data[SENSOR_DATA_LEN] = { 1, 2, 3 };
+	send_frame(1, data, sizeof(data));
+	send_frame(1, data, sizeof(data));
+
+	hs_frame_t frame;
+	int delivered = 0;
+	while (lineTail != lineHead) {
+		hs_host_receive(Line[lineTail]);
+		lineTail = (lineTail + 1) % LINE_SIZE;
+		hs_host_interrupt(100000);
+		while (hs_read_frame(&frame, 0) > 0) {
+			if (delivered++ == 0)
+				CHECK(frame.len == sizeof(noise) % HS_FRAME_MAX + Frames[0].len);
+			else
+				CHECK(frame.len == Frames[1].len && memcmp(frame.data, Frames[1].data, frame.len) == 0);
+			hs_release_frames();
+		}
+	}
+	CHECK(delivered == 2);
+}
+
+int main(void) {
+	test_replay();
+	test_interrupts();
+	test_no_delimiter();
+
+	return TEST_RESULT();
+}
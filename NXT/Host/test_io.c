@@ -0,0 +1,647 @@
+/************************************************************************/
+// File:			test_io.c
+//
+// Host loopback of the NXT <-> IO-microcontroller link. The io task of
+// io.c runs as it is on hs.c, included through hs_host.h, and talks to
+// io_nxt.c and a copy of the loop in main.c, see avr_host.h. The tick
+// hook plays the half duplex RS485 line at 230400 baud, 23 byte slots
+// per ms. A byte from both ends in the same slot is a collision. The
+// IO-microcontroller runs a pass of its loop 0.5 ms after the last one,
+// once it has finished sending. Some runs skew its clock, read the gyro
+// late and hold off the io task, to check the clock mapping, the push
+// guard and the gyro integration of the estimator.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "host_rtos.h"
+
+#include "hs_host.h"
+
+/* Counts the times the io task wakes up. It runs ioDelayMs and up to
+ * ioJitterMs more after that, as if tasks of higher priority held it off */
+static long ioWakeups;
+static int ioDelayMs, ioJitterMs;
+
+static BaseType_t io_woken(BaseType_t result) {
+	ioWakeups++;
+	int delay = ioDelayMs + (ioJitterMs ? rand() % (ioJitterMs + 1) : 0);
+	if (delay > 0)
+		vTaskDelay(delay);
+	return result;
+}
+#define xTaskNotifyWait(...)	io_woken(xTaskNotifyWait(__VA_ARGS__))
+
+#undef BAUD_RATE	// hs.c has its own
+#include "io.c"
+
+#include "avr_host.h"
+
+#define BYTES_PER_MS		23
+#define TIMEOUT_SLOTS		2		// The receiver time-out of 20 bit periods
+#define AVR_TICKS_PER_MS	(576.0 / 575.0)
+#define BT_DATA_LEN			40		// SEND_BT messages from the other tasks
+#define DONGLE_BYTES_PER_MS	3.84	// The dongle UART at 38400 baud
+#define PUSH_LINE_MS		2		// A SENSOR_DATA push on the line, and the tick it is read in
+#define GYRO_DPS_PER_LSB	0.004375
+#define RATE_AMPLITUDE_DPS	90.0	// The robot turns back and forth
+#define RATE_PERIOD_MS		3000.0
+#define DRAIN_MS			300		// At the end of a run, without new traffic
+#define MAX_RX_FRAMES		4096
+
+/* The display shows the number of reply time-outs at (0, 0) and of CRC
+ * errors at (5, 0) */
+static int displayX, displayY;
+static long ioTimeouts, ioCrcErrors;
+
+void display_goto_xy(int x, int y) {
+	displayX = x;
+	displayY = y;
+}
+
+void display_int(int val, unsigned long places) {
+	(void) places;
+	if (displayY == 0 && displayX == 0)
+		ioTimeouts = val;
+	else if (displayY == 0 && displayX == 5)
+		ioCrcErrors = val;
+}
+
+void display_string(const char *str) {
+	(void) str;
+}
+
+void display_update(void) {
+}
+
+void sp_reset(int port) {
+	(void) port;
+}
+
+typedef struct {
+	int btPeriod;				// ms between SEND_BT messages, 0 for none
+	int donglePeriod;			// ms between frames from the server, 0 for none
+	uint32_t ms;
+	uint32_t resetMs;			// When the IO-microcontroller is reset, 0 for never
+	double skewPpm;				// Of the IO-microcontroller tick
+	int sampleJitterMs;			// The gyro is read up to this long after the tick is taken
+	int taskDelayMs, taskJitterMs;	// The io task runs this long after it is woken, and up to the jitter more
+} run_t;
+
+typedef struct {
+	long nxtFrames, avrFrames, collisions;
+	long requests, responses, mismatched;	// Tagged requests, and responses to them
+	long btSent, btRefused, btDelivered;
+	double wakeups;				// Of the io task, per second
+	long dongleFrames, dongleIntact;
+	double pushGapMax;			// Longest time between SENSOR_DATA messages on the line, ms
+	double busy;				// Share of the byte slots in use
+	double ageMean, ageMax;		// Age of io_values at the estimator, ms
+	double dtMean, dtMax;		// Error of the mapped time between samples, ms
+	double headingMapped, headingTrue, headingLatest;	// Mean heading error at the estimator, degrees
+} loop_t;
+
+static const run_t *Run;
+static loop_t Result;
+static jmp_buf stop;
+static uint32_t endTick;
+
+/* Time in ms, and the byte slot the line is in */
+static double now;
+static long slot;
+static int quiet;
+
+/* The IO-microcontroller is reset at avrStart. Its samples are numbered
+ * from 1, and SampleTime is when each one was taken */
+static double avrStart;
+static uint16_t sampleCount;
+static double SampleTime[1024];
+
+uint16_t tick_ms(void) {
+	return (uint16_t) floor((now - avrStart) * AVR_TICKS_PER_MS * (1 + Run->skewPpm * 1e-6));
+}
+
+/* The rate the robot turns at, and the heading it has turned to since 0 */
+static double rate_dps(double t) {
+	return RATE_AMPLITUDE_DPS * sin(2 * M_PI * t / RATE_PERIOD_MS);
+}
+
+static double heading_deg(double t) {
+	return RATE_AMPLITUDE_DPS * RATE_PERIOD_MS / (2 * M_PI * 1000) * (1 - cos(2 * M_PI * t / RATE_PERIOD_MS));
+}
+
+int avr_host_sample(int16_t *gyroZ) {
+	int slots = Run->sampleJitterMs ? rand() % (Run->sampleJitterMs * BYTES_PER_MS + 1) : 0;
+	double t = now + (double) slots / BYTES_PER_MS;
+	*gyroZ = (int16_t) lround(rate_dps(t) / GYRO_DPS_PER_LSB);
+	SampleTime[++sampleCount % 1024] = t;
+	return slots;
+}
+
+/* Frames from the server in the uart1 fifo of the IO-microcontroller,
+ * and the frames in the order they were stored. The fifo holds one byte
+ * less than its 128, and drops what does not fit */
+#define DONGLE_FIFO_SIZE	127
+
+static uint8_t Dongle[DONGLE_FIFO_SIZE + 1];
+static int dongleHead, dongleTail;
+
+typedef struct {
+	uint8_t data[MAX_FRAME_SIZE];
+	uint8_t len;
+} bt_frame_t;
+
+static bt_frame_t RxFrames[MAX_RX_FRAMES];
+static int rxStored, rxChecked;
+
+uint8_t avr_host_bt_receive(uint8_t *data, uint16_t len) {
+	uint16_t i;
+	for (i = 0; i < len && dongleTail != dongleHead; i++) {
+		data[i] = Dongle[dongleTail];
+		dongleTail = (dongleTail + 1) % sizeof(Dongle);
+	}
+	return i;
+}
+
+static void dongle_store(void) {
+	bt_frame_t *Frame = &RxFrames[rxStored++ % MAX_RX_FRAMES];
+	Frame->len = 8 + rand() % (MAX_FRAME_SIZE - 7);
+	for (int i = 0; i < Frame->len; i++) {
+		Frame->data[i] = (i == Frame->len - 1) ? 0 : 1 + rand() % 255;
+		if ((dongleHead + 1) % sizeof(Dongle) == dongleTail)
+			continue;
+		Dongle[dongleHead] = Frame->data[i];
+		dongleHead = (dongleHead + 1) % sizeof(Dongle);
+	}
+}
+
+static void bluetooth_frame(uint8_t *data, uint16_t len) {
+	// Frames lost on the way are skipped
+	for (int k = rxChecked; k < rxStored; k++) {
+		bt_frame_t *Frame = &RxFrames[k % MAX_RX_FRAMES];
+		if (len == Frame->len && memcmp(data, Frame->data, len) == 0) {
+			Result.dongleIntact++;
+			rxChecked = k + 1;
+			break;
+		}
+	}
+}
+
+/* Frames seen on the line from each end, decoded to check the tags. A
+ * tagged request is open until the response with its tag */
+typedef struct {
+	uint8_t data[256];
+	int len;
+} wire_t;
+
+static wire_t NxtWire, AvrWire;
+static uint8_t OpenRequest[256];	// Type of the request with each tag, 0 if none
+static double lastSensorData;
+
+static uint8_t wire_decode(wire_t *Wire, uint8_t byte, uint8_t *type, uint8_t *tag) {
+	if (byte != 0) {
+		if (Wire->len < (int) sizeof(Wire->data))
+			Wire->data[Wire->len++] = byte;
+		return FALSE;
+	}
+
+	uint8_t message[256];
+	cobs_decode_result decoded = cobs_decode(message, sizeof(message), Wire->data, Wire->len);
+	Wire->len = 0;
+	if (decoded.status != COBS_DECODE_OK || decoded.out_len < 3)
+		return FALSE;
+	if ((uint8_t) calculate_crc((char *) message, decoded.out_len - 1) != message[decoded.out_len - 1])
+		return FALSE;
+	*type = message[0];
+	*tag = message[1];
+	return TRUE;
+}
+
+static void wire_nxt(uint8_t byte) {
+	uint8_t type, tag;
+	if (!wire_decode(&NxtWire, byte, &type, &tag))
+		return;
+	Result.nxtFrames++;
+	if (tag != 0) {
+		Result.requests++;
+		OpenRequest[tag] = type;
+	}
+}
+
+static void wire_avr(uint8_t byte) {
+	uint8_t type, tag;
+	if (!wire_decode(&AvrWire, byte, &type, &tag))
+		return;
+	Result.avrFrames++;
+	if (type == SENSOR_DATA) {
+		if (lastSensorData > 0 && now - lastSensorData > Result.pushGapMax)
+			Result.pushGapMax = now - lastSensorData;
+		lastSensorData = now;
+	}
+	if (tag == 0)
+		return;
+
+	Result.responses++;
+	uint8_t request = OpenRequest[tag];
+	uint8_t expected = (request == RECEIVE_BT) ? BT_DATA : (request == ALIVE_TEST) ? ALIVE_RESPONSE : SENSOR_DATA;
+	if (request == 0 || type != expected)
+		Result.mismatched++;
+	OpenRequest[tag] = 0;
+}
+
+/* The ms that ends at tick, one byte slot at a time */
+static void line_ms(TickType_t tick) {
+	for (int s = 0; s < BYTES_PER_MS; s++, slot++) {
+		now = tick - 1 + (double) s / BYTES_PER_MS;
+
+		avr_host_slot();
+		int nxt = hs_host_transmit();
+		int avr = avr_host_transmit();
+		if (nxt >= 0 || avr >= 0)
+			Result.busy++;
+
+		if (nxt >= 0 && avr >= 0) {
+			// Neither end reads the other, the AVR receiver is off while sending
+			Result.collisions++;
+				hs_host_receive(nxt ^ avr);
+			quiet = 0;
+		} else if (nxt >= 0) {
+			avr_host_receive(nxt);
+			wire_nxt(nxt);
+		} else if (avr >= 0) {
+			hs_host_receive(avr);
+			wire_avr(avr);
+			quiet = 0;
+		} else if (++quiet == TIMEOUT_SLOTS) {
+			hs_host_timeout();
+		}
+		hs_host_interrupt(100);
+	}
+}
+
+/* The estimator as pose_estimator.c has it, integrating between the
+ * gyro samples over the mapped time and carrying the turn since the last
+ * sample to the estimate. The same over the true time, and the way it
+ * was done before, the latest rate times the period, for comparison.
+ * Headings count from the first estimate */
+static struct {
+	uint16_t sequence;
+	double mapped, taken, dps;
+	double heading[3];			// Mapped, true and latest
+	double ahead[2];
+	double start[3], startTime;
+	long dtCount, estimates;
+} Track;
+
+static void track_sample(void) {
+	float dps, fraction;
+	uint32_t tick;
+	uint16_t sequence = io_sequence;
+	if (sequence == Track.sequence || !gyro_get_sample_z(sequence, &dps, &tick, &fraction))
+		return;
+
+	double mapped = tick + fraction;
+	double taken = SampleTime[io_values.sample_count % 1024];
+	if (Track.sequence != 0 && (uint16_t) (sequence - Track.sequence) == 1) {
+		double error = fabs((mapped - Track.mapped) - (taken - Track.taken));
+		Result.dtMean += error;
+		if (error > Result.dtMax)
+			Result.dtMax = error;
+		Track.dtCount++;
+		Track.heading[0] += (Track.dps + dps) / 2 * (mapped - Track.mapped) / 1000;
+		Track.heading[1] += (Track.dps + dps) / 2 * (taken - Track.taken) / 1000;
+	}
+	Track.sequence = sequence;
+	Track.mapped = mapped;
+	Track.taken = taken;
+	Track.dps = dps;
+}
+
+static void track_estimate(TickType_t tick) {
+	if (Track.sequence == 0)
+		return;
+
+	double ahead[2] = { Track.dps * (tick - Track.mapped) / 1000, Track.dps * (now - Track.taken) / 1000 };
+	for (int i = 0; i < 2; i++) {
+		Track.heading[i] += ahead[i] - Track.ahead[i];
+		Track.ahead[i] = ahead[i];
+	}
+
+	Track.heading[2] += io_values.gyro_z * GYRO_DPS_PER_LSB * PERIOD_ESTIMATOR_MS / 1000;
+	if (Track.estimates++ == 0) {
+		memcpy(Track.start, Track.heading, sizeof(Track.start));
+		Track.startTime = now;
+		return;
+	}
+	double turned = heading_deg(now) - heading_deg(Track.startTime);
+	Result.headingMapped += fabs(Track.heading[0] - Track.start[0] - turned);
+	Result.headingTrue += fabs(Track.heading[1] - Track.start[1] - turned);
+	Result.headingLatest += fabs(Track.heading[2] - Track.start[2] - turned);
+}
+
+static void hook(TickType_t tick) {
+	uint8_t data[BT_DATA_LEN];
+
+	line_ms(tick);
+	track_sample();
+
+	if (Run->resetMs && tick == Run->resetMs) {
+		avrStart = now;
+		sampleCount = 0;
+		avr_host_reset();
+	}
+
+	if (tick + DRAIN_MS < endTick) {
+		if (Run->btPeriod && tick % Run->btPeriod == 0 && io_alive) {
+			for (int i = 0; i < BT_DATA_LEN; i++)
+				data[i] = rand();
+			if (io_send_bluetooth(data, BT_DATA_LEN))
+				Result.btSent += BT_DATA_LEN;
+			else
+				Result.btRefused++;
+		}
+		if (Run->donglePeriod && tick % Run->donglePeriod == 0 && io_alive)
+			dongle_store();
+	}
+
+	// The estimator task reads the latest sensor values every period
+	if (tick % PERIOD_ESTIMATOR_MS == 0 && io_values.sample_count != 0) {
+		double age = now - SampleTime[io_values.sample_count % 1024];
+		Result.ageMean += age;
+		if (age > Result.ageMax)
+			Result.ageMax = age;
+		track_estimate(tick);
+	}
+
+	if (tick == endTick)
+		longjmp(stop, 1);
+}
+
+/**
+ * Runs the io task against the IO-microcontroller for run->ms after the
+ * link is up, and DRAIN_MS more without new messages.
+ */
+static loop_t loopback(const run_t *run) {
+	memset(&Result, 0, sizeof(Result));
+	Run = run;
+
+	// Start the link from scratch, as after power up
+	vHostStopTimers();
+	io_alive = 0;
+	io_tag = 0;
+	push_tick = 0;
+	io_sequence = 0;
+	memset(&io_clock, 0, sizeof(io_clock));
+	memset(io_samples, 0, sizeof(io_samples));
+	memset(&io_values, 0, sizeof(io_values));
+	memset(OpenRequest, 0, sizeof(OpenRequest));
+	NxtWire.len = AvrWire.len = 0;
+	lastSensorData = 0;
+	dongleHead = dongleTail = rxStored = rxChecked = 0;
+	memset(&gAvrHost, 0, sizeof(gAvrHost));
+	ioTimeouts = ioCrcErrors = ioWakeups = 0;
+	ioDelayMs = run->taskDelayMs;
+	ioJitterMs = run->taskJitterMs;
+	memset(&Track, 0, sizeof(Track));
+
+	gHostTick = 0;
+	slot = 0;
+	quiet = 0;
+	now = avrStart = 0;
+	sampleCount = 0;
+	avr_host_reset();
+
+	// io_init enables the driver again, take its interrupt enables before the
+	// io task writes the next ones
+	hs_host_enable();
+	CHECK(io_init());
+	hs_host_sync();
+	io_set_bluetooth_receive_callback(bluetooth_frame);
+
+	endTick = run->ms + DRAIN_MS;
+	gHostTickHook = hook;
+	if (!setjmp(stop))
+		io_task(NULL);
+	gHostTickHook = NULL;
+
+	Result.wakeups = ioWakeups * 1000.0 / endTick;
+	Result.btDelivered = gAvrHost.btBytes;
+	Result.dongleFrames = rxStored;
+	Result.busy /= (double) endTick * BYTES_PER_MS;
+	Result.ageMean /= endTick / PERIOD_ESTIMATOR_MS;
+	if (Track.dtCount)
+		Result.dtMean /= Track.dtCount;
+	if (Track.estimates > 1) {
+		Result.headingMapped /= Track.estimates - 1;
+		Result.headingTrue /= Track.estimates - 1;
+		Result.headingLatest /= Track.estimates - 1;
+	}
+	return Result;
+}
+
+static void test_encode(void) {
+	// Every tag and a payload with zeros come out of io_nxt.c as they went in
+	uint8_t data[BURST_SIZE - 4], encoded[BURST_SIZE], message[128];
+	avr_host_reset();
+	for (int tag = 0; tag < 256; tag++) {
+		uint8_t len = 1 + tag % (sizeof(data) - 1);
+		data[0] = SEND_BT;
+		for (int i = 1; i < len; i++)
+			data[i] = (i % 5 == 0) ? 0 : rand();
+
+		uint8_t n = io_encode(encoded, data, len, tag);
+		CHECK(n > 0 && encoded[n - 1] == 0);
+		for (int i = 0; i < n; i++)
+			avr_host_receive(encoded[i]);
+		CHECK(io_nxt_get_message(message) == len + 1);
+		CHECK(message[0] == SEND_BT && message[1] == tag);
+		CHECK(memcmp(message + 2, data + 1, len - 1) == 0);
+	}
+}
+
+static void test_loopback(void) {
+	static const run_t Runs[] = {
+		{ 0, 0, 10000 },
+		{ 20, 50, 10000 },
+		{ 15, 50, 10000 },
+		{ 12, 50, 10000 },
+		{ 5, 50, 10000 },
+	};
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(Runs) / sizeof(Runs[0]); i++) {
+		loop_t Loop = loopback(&Runs[i]);
+		printf("BT tx every %2d ms: %3.0f%% busy, %3.0f wake-ups/s, %ld/%ld tagged responses, %ld mismatched, %ld collisions, "
+				"%ld/%ld BT bytes (%ld refused), %ld/%ld dongle frames, sample age %.1f (%.1f) ms\n",
+				Runs[i].btPeriod, 100 * Loop.busy, Loop.wakeups, Loop.responses, Loop.requests, Loop.mismatched,
+				Loop.collisions, Loop.btDelivered, Loop.btSent, Loop.btRefused, Loop.dongleIntact,
+				Loop.dongleFrames, Loop.ageMean, Loop.ageMax);
+		printf("%18s %ld pushes, %ld late, at most %.1f ms apart\n", "", gAvrHost.pushes, gAvrHost.latePushes,
+				Loop.pushGapMax);
+
+		// Every message gets through, and what does not fit is refused by io_send
+		CHECK(Loop.collisions == 0 && gAvrHost.dropped == 0);
+		CHECK(Loop.mismatched == 0);
+		CHECK(Loop.responses == Loop.requests);
+		CHECK(Loop.btDelivered == Loop.btSent);
+		CHECK(Loop.dongleIntact == Loop.dongleFrames);
+		CHECK(ioCrcErrors == 0 && ioTimeouts == 0);
+
+		// Idle, the task wakes for the pushes, the timers and the responses to
+		// its polls, not every ms as the polling loop did
+		if (Runs[i].btPeriod == 0)
+			CHECK(Loop.wakeups < 100);
+
+		// Idle, every push keeps the rate. A push that comes due while the
+		// IO-microcontroller passes a SEND_BT to the dongle waits for it, and
+		// starts a new period
+		CHECK(gAvrHost.subscribes == 1);
+		CHECK(gAvrHost.pushes >= (endTick - SENSOR_PERIOD_MS) / (SENSOR_PERIOD_MS + BT_DATA_LEN / DONGLE_BYTES_PER_MS));
+		if (Runs[i].btPeriod == 0)
+			CHECK(gAvrHost.latePushes == 0 && Loop.pushGapMax <= SENSOR_PERIOD_MS + gAvrPushSlackMs);
+		CHECK(Loop.pushGapMax <= SENSOR_PERIOD_MS + BT_DATA_LEN / DONGLE_BYTES_PER_MS + gAvrPushSlackMs);
+	}
+}
+
+static void test_reset(void) {
+	// The io task subscribes again once the pushes have stopped for
+	// SUBSCRIBE_TIMEOUT_MS, on the sensor timer of the same period
+	const run_t Run = { 20, 50, 10000, 5000 };
+	loop_t Loop = loopback(&Run);
+	printf("AVR reset at %u ms: %ld subscribes, %ld pushes, at most %.1f ms apart, %ld reply time-outs\n",
+			Run.resetMs, gAvrHost.subscribes, gAvrHost.pushes, Loop.pushGapMax, ioTimeouts);
+
+	CHECK(gAvrHost.subscribes == 2);	// Once more after the reset
+	CHECK(Loop.pushGapMax <= 2 * SUBSCRIBE_TIMEOUT_MS + SENSOR_PERIOD_MS);
+	CHECK(Loop.collisions == 0);
+	CHECK(io_clock.start > Run.resetMs);	// The mapping started over
+	// and takes the samples counted from 1 again
+	CHECK(io_values.sample_count > 0 && now - SampleTime[io_values.sample_count % 1024] < SENSOR_PERIOD_MS + 5);
+}
+
+static void test_jitter(void) {
+	// The AVR tick runs fast and slow, the gyro is read up to 3 ms after
+	// the tick is taken, and the io task runs up to 3 ms late
+	static const run_t Runs[] = {
+		{ 20, 50, 60000, 0, 50, 3, 0, 3 },
+		{ 20, 50, 60000, 0, -200, 3, 0, 3 },
+	};
+
+	for (size_t i = 0; i < sizeof(Runs) / sizeof(Runs[0]); i++) {
+		loop_t Loop = loopback(&Runs[i]);
+		printf("%+4.0f ppm: %ld collisions, dt between samples off by %.2f ms (%.2f), heading off by %.2f degrees, "
+				"%.2f on the true times, %.2f with the latest rate\n", Runs[i].skewPpm, Loop.collisions, Loop.dtMean,
+				Loop.dtMax, Loop.headingMapped, Loop.headingTrue, Loop.headingLatest);
+
+		CHECK(Loop.collisions == 0 && ioTimeouts == 0);
+		CHECK(Loop.dtMean < 1.5 && Loop.dtMax < 2 * Runs[i].sampleJitterMs);
+		CHECK(Loop.headingMapped < 1 && Loop.headingMapped < Loop.headingLatest);
+	}
+}
+
+static void test_task_delay(void) {
+	// The line is kept free from PUSH_GUARD_MS before the next push is
+	// sampled, on the clock mapping. The io task running late only adds to
+	// the delay of some pushes, which the mapping takes out
+	for (int jitter = 0; jitter <= 20; jitter += 4) {
+		const run_t Run = { 20, 50, 10000, 0, 0, 0, 0, jitter };
+		loop_t Loop = loopback(&Run);
+		printf("io task up to %2d ms late: %ld collisions, %ld late pushes\n", jitter, Loop.collisions,
+				gAvrHost.latePushes);
+		CHECK(Loop.collisions == 0 && ioTimeouts == 0);
+	}
+
+	// A delay every push has is part of the offset of the mapping. With the
+	// push on the line and the tick it is read in, it has to fit in the
+	// guard and the slack the AVR gives a push before it starts a new period
+	for (int delay = 0; delay <= PUSH_GUARD_MS + gAvrPushSlackMs - PUSH_LINE_MS; delay++) {
+		const run_t Run = { 20, 50, 10000, 0, 0, 0, delay, 0 };
+		loop_t Loop = loopback(&Run);
+		printf("io task always %2d ms late: %ld collisions, %ld late pushes\n", delay, Loop.collisions,
+				gAvrHost.latePushes);
+		CHECK(Loop.collisions == 0 && ioTimeouts == 0);
+	}
+}
+
+static void test_may_send(void) {
+	// Bursts until PUSH_GUARD_MS before the next push is due, then not until
+	// it has arrived or the pushes have stopped
+	const TickType_t Pushes[] = { 1000, 0xFFFFFFF0 };
+	for (size_t i = 0; i < sizeof(Pushes) / sizeof(Pushes[0]); i++) {
+		push_tick = Pushes[i];
+		CHECK(io_may_send(push_tick));
+		CHECK(io_may_send(push_tick + SENSOR_PERIOD_MS - PUSH_GUARD_MS - 1));
+		CHECK(!io_may_send(push_tick + SENSOR_PERIOD_MS - PUSH_GUARD_MS));
+		CHECK(!io_may_send(push_tick + SUBSCRIBE_TIMEOUT_MS - 1));
+		CHECK(io_may_send(push_tick + SUBSCRIBE_TIMEOUT_MS));
+	}
+}
+
+static void test_clock_map(void) {
+	// Pushes every 30 ms for 10 hours, with the AVR tick 100 ppm fast and
+	// 1-4 ms from the sample to the io task. The 16 bit tick wraps every 65 s
+	struct io_clock_t Clock;
+	memset(&Clock, 0, sizeof(Clock));
+	double offsetMin = 1e9, offsetMax = -1e9, dtSum = 0, dtMax = 0, last = 0;
+	long n = 0;
+	float fraction;
+
+	srand(1);
+	for (uint32_t i = 1; i <= 10UL * 3600 * 1000 / 30; i++) {
+		double taken = 30.0 * i;
+		uint16_t tick = (uint16_t) (uint32_t) floor(taken * AVR_TICKS_PER_MS * (1 + 100e-6));
+		TickType_t arrival = (TickType_t) ceil(taken + 1 + 3.0 * rand() / RAND_MAX);
+		double mapped = io_clock_map(&Clock, (uint16_t) i, tick, arrival, &fraction) + (double) fraction;
+
+		if (i > CLOCK_WINDOW) {
+			double dt = fabs(mapped - last - 30);
+			dtSum += dt;
+			if (dt > dtMax)
+				dtMax = dt;
+			n++;
+		}
+		if (i > CLOCK_WINDOW * CLOCK_WINDOWS) {
+			if (mapped - taken < offsetMin)
+				offsetMin = mapped - taken;
+			if (mapped - taken > offsetMax)
+				offsetMax = mapped - taken;
+		}
+		last = mapped;
+	}
+	printf("clock mapping over 10 h: dt off by %.2f ms (%.2f), sample times within %.2f ms, skew %.1f ppm\n",
+			dtSum / n, dtMax, offsetMax - offsetMin, Clock.skew * 1e6);
+
+	// The times stay within the spread of the delay, however long it runs
+	CHECK(dtSum / n < 0.5 && offsetMax - offsetMin < 3);
+	CHECK(fabs(Clock.skew * 1e6 + 100) < 50);
+
+	// A reset of the IO-microcontroller numbers the samples from 1 again, and
+	// the mapping starts over at the arrival of the first one
+	TickType_t arrival = (TickType_t) last + 100;
+	CHECK(io_clock_map(&Clock, 1, 7, arrival, &fraction) == arrival && fraction == 0);
+	CHECK(Clock.start == arrival && Clock.samples == 1);
+
+	// So does a sample that lands more than CLOCK_RESET_MS off the mapping
+	arrival += 30 + CLOCK_RESET_MS + 1;
+	CHECK(io_clock_map(&Clock, 2, 7 + 30, arrival, &fraction) == arrival && Clock.samples == 1);
+}
+
+int main(void) {
+	test_may_send();
+	test_clock_map();
+	test_encode();
+	test_loopback();
+	test_reset();
+	test_jitter();
+	test_task_delay();
+
+	return TEST_RESULT();
+}
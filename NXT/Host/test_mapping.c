@@ -0,0 +1,437 @@
+/************************************************************************/
+// File:			test_mapping.c
+//
+// Host test of the line extraction and merging in mapping.c. The file is
+// included here so that the static functions can be called directly. The
+// mapping task itself is not run.
+//
+/************************************************************************/
+
+#include "../Includes/mapping.c"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+
+/* Used by the mapping task, which is not run */
+volatile uint8_t gHandshook = FALSE;
+volatile uint8_t gPaused = FALSE;
+QueueHandle_t measurementQ = NULL;
+channel_t globalPoseChannel;
+TaskHandle_t xMappingTask = NULL;
+
+void send_line(int16_t x, int16_t y, uint16_t heading, line_t line) {
+	(void) x; (void) y; (void) heading; (void) line;
+}
+
+static float random_coordinate(float range) {
+	return (rand() % 10000) * (2 * range / 10000.0f) - range;
+}
+
+/* A line of up to 14 cm in a random direction. One in ten is vertical. */
+static line_t random_line(float range) {
+	point_t P = { random_coordinate(range), random_coordinate(range) };
+	point_t Q = { P.x + random_coordinate(10), P.y + random_coordinate(10) };
+	if (rand() % 10 == 0)
+		Q.x = P.x;
+	return func_line_from_points(P, Q, 0);
+}
+
+/* The first mergeable line in the repo, by scanning all of it */
+static int16_t scan_first_mergeable(line_t *Line, line_repo_t *Repo) {
+	for (uint16_t k = 0; k < Repo->len; k++)
+		if (mapping_is_mergeable(Line, &Repo->buffer[k]))
+			return k;
+	return -1;
+}
+
+static void test_candidates(void) {
+	static line_repo_t Repo;
+	long mergeable = 0, candidates = 0;
+
+	for (int run = 0; run < 200; run++) {
+		line_index_clear(&RepoIndex);
+		Repo.len = L_SIZE;
+		for (uint16_t i = 0; i < L_SIZE; i++) {
+			Repo.buffer[i] = random_line(200);
+			line_index_insert(&RepoIndex, &Repo.buffer[i], i);
+		}
+
+		// Move some lines, as a merge does
+		for (int m = 0; m < 50; m++) {
+			uint16_t k = rand() % L_SIZE;
+			line_index_remove(&RepoIndex, k);
+			Repo.buffer[k] = random_line(200);
+			line_index_insert(&RepoIndex, &Repo.buffer[k], k);
+		}
+
+		for (int q = 0; q < 50; q++) {
+			line_t Line = random_line(200);
+			uint16_t n = line_index_query(&RepoIndex, &Line);
+			candidates += n;
+
+			// In repo order, each line once
+			for (uint16_t c = 1; c < n; c++)
+				CHECK(RepoIndex.candidates[c-1] < RepoIndex.candidates[c]);
+
+			// Every line the exact test accepts is a candidate
+			for (uint16_t k = 0; k < L_SIZE; k++) {
+				if (!mapping_is_mergeable(&Line, &Repo.buffer[k]))
+					continue;
+				mergeable++;
+				uint8_t found = FALSE;
+				for (uint16_t c = 0; c < n; c++)
+					found |= RepoIndex.candidates[c] == k;
+				CHECK(found);
+			}
+		}
+	}
+
+	CHECK(mergeable > 100);
+	printf("test_candidates: %ld mergeable pairs, %.2f candidates per query out of %d lines\n",
+			mergeable, candidates / 10000.0, L_SIZE);
+}
+
+static void test_line_merge_as_scan(void) {
+	static line_repo_t Repo, Scanned;
+	static line_buffer_t Buffer;
+	long merges = 0;
+
+	line_index_clear(&RepoIndex);
+	Repo.len = 0;
+	Scanned.len = 0;
+
+	// Lines in a small area, so that many merge
+	while (Repo.len < L_SIZE) {
+		Buffer.len = 1 + rand() % LB_SIZE;
+		for (uint8_t j = 0; j < Buffer.len; j++)
+			Buffer.buffer[j] = random_line(60);
+
+		for (uint8_t j = 0; j < Buffer.len; j++) {
+			int16_t k = scan_first_mergeable(&Buffer.buffer[j], &Scanned);
+			if (k >= 0) {
+				Scanned.buffer[k] = mapping_merge_segments(&Buffer.buffer[j], &Scanned.buffer[k]);
+				merges++;
+			} else if (Scanned.len < L_SIZE)
+				Scanned.buffer[Scanned.len++] = Buffer.buffer[j];
+		}
+		mapping_line_merge(&Buffer, &Repo);
+
+		CHECK(Buffer.len == 0);
+		CHECK(Repo.len == Scanned.len);
+		CHECK(memcmp(Repo.buffer, Scanned.buffer, Repo.len * sizeof(line_t)) == 0);
+	}
+
+	CHECK(merges > 100);
+	printf("test_line_merge_as_scan: %ld merges until the repo was full\n", merges);
+}
+
+/* mapping_repo_merge with every pair of lines checked, not only candidates */
+static void scan_repo_merge(line_repo_t *Repo, line_repo_t *MergedRepo) {
+	MergedRepo->len = 0;
+	for (uint16_t i = 0; i < Repo->len; i++) {
+		if (mapping_is_empty(Repo->buffer[i]))
+			continue;
+
+		uint8_t merged = FALSE;
+		for (uint16_t j = i + 1; j < Repo->len; j++) {
+			if (!mapping_is_empty(Repo->buffer[j]) && mapping_is_mergeable(&Repo->buffer[i], &Repo->buffer[j])) {
+				MergedRepo->buffer[MergedRepo->len++] = mapping_merge_segments(&Repo->buffer[i], &Repo->buffer[j]);
+				Repo->buffer[j] = (line_t) { 0 };
+				merged = TRUE;
+			}
+		}
+		if (!merged)
+			MergedRepo->buffer[MergedRepo->len++] = Repo->buffer[i];
+	}
+	Repo->len = 0;
+}
+
+/* Merges RepoArena[0] with itself until it cannot be reduced further, as the
+mapping task does, and returns the half that holds the result */
+static line_repo_t *merge_until_done(void) {
+	line_repo_t *LineRepo = &RepoArena[0];
+	uint16_t lastRepoLen;
+	do {
+		lastRepoLen = LineRepo->len;
+		line_repo_t *MergedRepo = (LineRepo == &RepoArena[0]) ? &RepoArena[1] : &RepoArena[0];
+		mapping_repo_merge(LineRepo, MergedRepo);
+		LineRepo = MergedRepo;
+	} while (LineRepo->len < lastRepoLen);
+	return LineRepo;
+}
+
+static void index_repo(line_repo_t *Repo) {
+	line_index_clear(&RepoIndex);
+	for (uint16_t i = 0; i < Repo->len; i++)
+		line_index_insert(&RepoIndex, &Repo->buffer[i], i);
+}
+
+static void test_repo_merge_as_scan(void) {
+	static line_repo_t Scanned, ScanMerged;
+
+	for (int run = 0; run < 100; run++) {
+		RepoArena[0].len = L_SIZE;
+		for (uint16_t i = 0; i < L_SIZE; i++)
+			RepoArena[0].buffer[i] = random_line(80);
+		Scanned = RepoArena[0];
+		index_repo(&RepoArena[0]);
+
+		mapping_repo_merge(&RepoArena[0], &RepoArena[1]);
+		scan_repo_merge(&Scanned, &ScanMerged);
+
+		CHECK(RepoArena[0].len == 0);
+		CHECK(RepoArena[1].len == ScanMerged.len && RepoArena[1].len < L_SIZE);
+		CHECK(memcmp(RepoArena[1].buffer, ScanMerged.buffer, ScanMerged.len * sizeof(line_t)) == 0);
+	}
+}
+
+static void test_room_merges_to_walls(void) {
+	// Pieces of 8 cm with gaps of 2 cm along the four walls of a 200 x 150 cm
+	// room, in the order a sweep along the walls finds them
+	const point_t Corners[5] = { { -100, -75 }, { 100, -75 }, { 100, 75 }, { -100, 75 }, { -100, -75 } };
+	static line_buffer_t Buffer;
+	line_repo_t *Repo = &RepoArena[0];
+	uint16_t pieces = 0;
+
+	Repo->len = 0;
+	line_index_clear(&RepoIndex);
+	Buffer.len = 0;
+
+	for (uint8_t w = 0; w < 4; w++) {
+		point_t A = Corners[w], B = Corners[w+1];
+		float length = func_distance_between(&A, &B);
+		point_t U = { (B.x - A.x) / length, (B.y - A.y) / length };
+		for (float t = 0; t + 8 <= length; t += 10) {
+			// Up to 0.5 cm off the wall, as a noisy fit would be
+			float e1 = random_coordinate(0.5f), e2 = random_coordinate(0.5f);
+			point_t P = { A.x + t * U.x - e1 * U.y, A.y + t * U.y + e1 * U.x };
+			point_t Q = { A.x + (t + 8) * U.x - e2 * U.y, A.y + (t + 8) * U.y + e2 * U.x };
+			Buffer.buffer[Buffer.len++] = func_line_from_points(P, Q, 0.3f);
+			pieces++;
+
+			// A few lines at a time, as the line buffers are filled
+			if (Buffer.len == 7)
+				mapping_line_merge(&Buffer, Repo);
+		}
+	}
+	mapping_line_merge(&Buffer, Repo);
+
+	Repo = merge_until_done();
+
+	// One line per wall, reaching to within a few cm of the corners
+	CHECK(Repo->len == 4);
+	for (uint16_t i = 0; i < Repo->len; i++) {
+		line_t *Line = &Repo->buffer[i];
+		float best = 1e9f;
+		for (uint8_t w = 0; w < 4; w++) {
+			float d1 = func_distance_between(&Line->P, (point_t *) &Corners[w]) + func_distance_between(&Line->Q, (point_t *) &Corners[w+1]);
+			float d2 = func_distance_between(&Line->Q, (point_t *) &Corners[w]) + func_distance_between(&Line->P, (point_t *) &Corners[w+1]);
+			best = fminf(best, fminf(d1, d2));
+		}
+		CHECK(best < 6);
+		CHECK(fabsf(Line->residual - 0.3f) < 1e-4f);
+	}
+
+	// After the last pass no two lines are mergeable
+	for (uint16_t i = 0; i < Repo->len; i++)
+		for (uint16_t j = i + 1; j < Repo->len; j++)
+			CHECK(!mapping_is_mergeable(&Repo->buffer[i], &Repo->buffer[j]));
+
+	printf("test_room_merges_to_walls: %u pieces merged into %u lines\n", pieces, Repo->len);
+}
+
+/* Up to noise cm off the line from A to B, at every step cm */
+static void add_wall_points(point_buffer_t *Points, point_t A, point_t B, float step, float noise) {
+	float length = func_distance_between(&A, &B);
+	point_t U = { (B.x - A.x) / length, (B.y - A.y) / length };
+	for (float t = 0; t <= length + 1e-3f && Points->len < PB_SIZE; t += step) {
+		float e = random_coordinate(noise);
+		Points->buffer[Points->len++] = (point_t) { A.x + t * U.x - e * U.y, A.y + t * U.y + e * U.x };
+	}
+}
+
+/* Distance of a point from the infinite line through A and B */
+static float distance_from_wall(point_t *Point, point_t A, point_t B) {
+	float length = func_distance_between(&A, &B);
+	return fabsf((Point->x - A.x) * (B.y - A.y) - (Point->y - A.y) * (B.x - A.x)) / length;
+}
+
+static void test_line_create(void) {
+	static point_buffer_t Points;
+	static line_buffer_t Lines;
+
+	for (int run = 0; run < 1000; run++) {
+		// A corner between a vertical and a sloping wall, seen with 0.5 cm
+		// of noise at a point every 2 cm
+		point_t A = { 30 + random_coordinate(5), -20 }, B = { A.x, 10 + random_coordinate(5) };
+		point_t C = { B.x - 30, B.y + random_coordinate(20) };
+		Points.len = 0;
+		add_wall_points(&Points, A, B, 2, 0.5f);
+		add_wall_points(&Points, B, C, 2, 0.5f);
+		mapping_line_create(&Points, &Lines);
+
+		CHECK(Points.len == 0);
+		CHECK(Lines.len == 2);
+		if (Lines.len != 2)
+			continue;
+
+		// Each line lies on its wall. A point or two next to the corner can
+		// be within LINE_FIT_TOLERANCE of the first wall and go to its line,
+		// so the lengths are only within four points.
+		CHECK(distance_from_wall(&Lines.buffer[0].P, A, B) < LINE_FIT_MAX_RESIDUAL && distance_from_wall(&Lines.buffer[0].Q, A, B) < LINE_FIT_MAX_RESIDUAL);
+		CHECK(distance_from_wall(&Lines.buffer[1].P, B, C) < LINE_FIT_MAX_RESIDUAL && distance_from_wall(&Lines.buffer[1].Q, B, C) < LINE_FIT_MAX_RESIDUAL);
+		CHECK(fabsf(Lines.buffer[0].length - func_distance_between(&A, &B)) < 4 * 2);
+		CHECK(fabsf(Lines.buffer[1].length - func_distance_between(&B, &C)) < 4 * 2 + 0.5f);
+		CHECK(Lines.buffer[0].residual <= LINE_FIT_MAX_RESIDUAL && Lines.buffer[1].residual <= LINE_FIT_MAX_RESIDUAL);
+	}
+
+	// A gap wider than LINE_FIT_MAX_GAP splits a straight wall
+	Points.len = 0;
+	add_wall_points(&Points, (point_t) { 0, 0 }, (point_t) { 20, 0 }, 2, 0);
+	add_wall_points(&Points, (point_t) { 20 + LINE_FIT_MAX_GAP + 1, 0 }, (point_t) { 50, 0 }, 2, 0);
+	mapping_line_create(&Points, &Lines);
+	CHECK(Lines.len == 2);
+	CHECK(Lines.buffer[0].residual == 0 && fabsf(Lines.buffer[0].length - 20) < 1e-3f);
+
+	// A point off the wall does not join the line, and too few points give none
+	Points.len = 0;
+	add_wall_points(&Points, (point_t) { 0, 0 }, (point_t) { 0, 20 }, 2, 0);
+	Points.buffer[Points.len++] = (point_t) { LINE_FIT_TOLERANCE + 1, 21 };
+	mapping_line_create(&Points, &Lines);
+	CHECK(Lines.len == 1);
+	CHECK(fabsf(Lines.buffer[0].theta) < 1e-6f && fabsf(Lines.buffer[0].length - 20) < 1e-3f);
+
+	Points.len = LINE_FIT_MIN_POINTS - 1;
+	mapping_line_create(&Points, &Lines);
+	CHECK(Lines.len == 0 && Points.len == 0);
+}
+
+/* Checks theta, rho and length against the endpoints of a line */
+static uint8_t line_is_consistent(line_t *Line) {
+	float c = cosf(Line->theta), s = sinf(Line->theta);
+	float scale = 1 + fabsf(Line->rho) + Line->length;
+	return Line->theta >= 0 && Line->theta < M_PI_F &&
+		   fabsf(Line->P.x * c + Line->P.y * s - Line->rho) < 1e-4f * scale &&
+		   fabsf(Line->Q.x * c + Line->Q.y * s - Line->rho) < 1e-4f * scale &&
+		   fabsf(func_distance_between(&Line->P, &Line->Q) - Line->length) < 1e-4f * scale;
+}
+
+static void test_normal_form(void) {
+	// Every bin is at least MU wide, so mergeable lines are in the same or
+	// neighbouring bins
+	CHECK(LINE_INDEX_ANGLE_BINS == 10);
+	CHECK(M_PI_F / LINE_INDEX_ANGLE_BINS >= MU);
+
+	long merges = 0;
+	for (int i = 0; i < 100000; i++) {
+		line_t Line = random_line(200);
+		CHECK(line_is_consistent(&Line));
+
+		line_t Other = random_line(200);
+		Other.P = (point_t) { Line.Q.x + random_coordinate(5), Line.Q.y + random_coordinate(5) };
+		Other = func_line_from_points(Other.P, Other.Q, 0);
+		if (mapping_is_mergeable(&Line, &Other)) {
+			line_t Merged = mapping_merge_segments(&Line, &Other);
+			CHECK(line_is_consistent(&Merged));
+			merges++;
+		}
+	}
+	CHECK(merges > 1000);
+
+	// Vertical walls, where the slope was infinite
+	line_t A = func_line_from_points((point_t) { 50, 0 }, (point_t) { 50, 30 }, 1);
+	line_t B = func_line_from_points((point_t) { 50, 35 }, (point_t) { 50, 60 }, 1);
+	CHECK(A.theta == 0 && A.rho == 50);
+	CHECK(mapping_is_mergeable(&A, &B));
+	line_t M = mapping_merge_segments(&A, &B);
+	CHECK(line_is_consistent(&M));
+	CHECK(M.theta == 0 && M.rho == 50 && fabsf(M.length - 60) < 1e-4f);
+
+	// Walls leaning either way from vertical, on either side of the wrap at
+	// theta = pi, where (theta, rho) is the same line as (theta - pi, -rho)
+	A = func_line_from_points((point_t) { 50, 0 }, (point_t) { 50.5f, 30 }, 0);
+	B = func_line_from_points((point_t) { 50.5f, 35 }, (point_t) { 50, 60 }, 0);
+	CHECK(A.theta > 0.5f * M_PI_F && A.rho < 0);
+	CHECK(B.theta < 0.5f * M_PI_F && B.rho > 0);
+	CHECK(mapping_is_mergeable(&A, &B));
+	M = mapping_merge_segments(&A, &B);
+	CHECK(line_is_consistent(&M));
+	CHECK(fabsf(M.length - 60) < 0.1f);
+	CHECK(fminf(M.P.y, M.Q.y) < 0.1f && fmaxf(M.P.y, M.Q.y) > 59.9f);
+	point_t Middle = { 50.5f, 32.5f };
+	CHECK(fabsf(Middle.x * cosf(M.theta) + Middle.y * sinf(M.theta) - M.rho) < 0.5f);
+
+	// Perpendicular walls meeting at a corner do not merge
+	A = func_line_from_points((point_t) { 0, 0 }, (point_t) { 30, 0 }, 0);
+	B = func_line_from_points((point_t) { 30, 0 }, (point_t) { 30, 30 }, 0);
+	CHECK(!mapping_is_mergeable(&A, &B));
+}
+
+static void test_beam_direction(void) {
+	// The table holds sin of every whole degree
+	for (uint8_t d = 0; d <= 90; d++)
+		CHECK(fabs(SinDeg[d] - sin(d * M_PI / 180)) < 1e-7);
+
+	double maxError = 0;
+	for (uint8_t servoStep = 0; servoStep <= 180; servoStep++) {
+		for (float heading = 0; heading < 2 * M_PI_F; heading += 0.01f) {
+			point_t Direction = mapping_beam_direction(servoStep, heading);
+
+			// The four sensors are 90 degrees apart
+			for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
+				if (i > 0)
+					Direction = (point_t) { -Direction.y, Direction.x };
+				double angle = servoStep * M_PI / 180 + heading + i * M_PI / 2;
+				maxError = fmax(maxError, fabs(Direction.x - cos(angle)) + fabs(Direction.y - sin(angle)));
+			}
+		}
+	}
+	CHECK(maxError < 1e-6);
+
+	// Cost per measurement of four beams, against a cos/sin pair per beam
+	const int N = 2000000;
+	volatile float sink = 0;
+	clock_t t0 = clock();
+	for (int k = 0; k < N; k++) {
+		uint8_t servoStep = (k % 20) * 5;
+		float angle = servoStep * DEG2RAD + (k % 628) * 0.01f;
+		for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
+			if (i > 0)
+				angle += 0.5f * M_PI_F;
+			func_wrap_to_2pi(&angle);
+			sink += cosf(angle) + sinf(angle);
+		}
+	}
+	clock_t t1 = clock();
+	for (int k = 0; k < N; k++) {
+		point_t Direction = mapping_beam_direction((k % 20) * 5, (k % 628) * 0.01f);
+		for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
+			if (i > 0)
+				Direction = (point_t) { -Direction.y, Direction.x };
+			sink += Direction.x + Direction.y;
+		}
+	}
+	clock_t t2 = clock();
+
+	printf("test_beam_direction: max error %.1e, %.1f ns per measurement against %.1f ns with cos/sin per beam\n",
+			maxError, (t2 - t1) * 1e9 / CLOCKS_PER_SEC / N, (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N);
+}
+
+int main(void) {
+	srand(1);
+
+	test_candidates();
+	test_line_merge_as_scan();
+	test_repo_merge_as_scan();
+	test_room_merges_to_walls();
+	test_line_create();
+	test_normal_form();
+	test_beam_direction();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/************************************************************************/
+// File:			test_motor.c
+//
+// Host test of the wheel velocity control in motor.c. The motor driver
+// runs on simulated encoders, see nxt_motors_host.h, and each wheel is a
+// first order DC motor model with 2 ms from the power setting to the
+// motor. The models span the spread of motor constants, friction and
+// battery voltage the control was tuned for. The ground under a wheel
+// can not change speed faster than the traction allows, the rest is slip.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "host_rtos.h"
+#include "motor.h"
+
+#include "nxt_motors_host.h"
+
+volatile uint8_t gHandshook = TRUE;
+
+typedef struct {
+	double mvPerMmps;	// Back-EMF
+	double staticMv;	// Voltage needed to turn at all
+	double tau;			// [s]
+	double batteryMv;
+} motor_model_t;
+
+static const motor_model_t Models[] = {
+	{ 18.8, 600, 0.06, 8000 },
+	{ 15.0, 300, 0.04, 9000 },
+	{ 23.5, 900, 0.09, 7200 },
+	{ 18.8, 600, 0.06, 7200 },
+	{ 23.5, 300, 0.06, 9000 },
+};
+
+#define N_MODELS	(sizeof(Models) / sizeof(Models[0]))
+#define STEP_US		100
+#define DELAY_MS	2
+
+static const motor_model_t *Model;
+
+static struct {
+	int power[DELAY_MS + 1];	// power[0] is the newest setting
+	double velocity;			// [mm/s]
+	double position;			// [mm]
+	int phase;
+	double ground;				// Speed of the wheel over the ground [mm/s]
+	double slip;				// Travel the ground did not follow [mm]
+} Wheel[NXT_N_MOTORS];
+
+static double timeUs;
+static double traction = INFINITY;		// [mm/s^2]
+
+void nxt_avr_set_motor(unsigned long n, int power_percent, int brake) {
+	(void) brake;
+	Wheel[n].power[0] = power_percent;
+}
+
+unsigned long battery_voltage(void) {
+	return (unsigned long) Model->batteryMv;
+}
+
+static void wheel_step(uint8_t n, double dt) {
+	double volts = Wheel[n].power[DELAY_MS] / 100.0 * Model->batteryMv;
+	double drive = 0;
+	if (fabs(volts) > Model->staticMv)
+		drive = (volts - copysign(Model->staticMv, volts)) / Model->mvPerMmps;
+
+	if (drive == 0 && fabs(Wheel[n].velocity) < 5)
+		Wheel[n].velocity *= 0.9;		// Friction holds a slow wheel
+	else
+		Wheel[n].velocity += (drive - Wheel[n].velocity) * dt / Model->tau;
+	Wheel[n].position += Wheel[n].velocity * dt;
+
+	double change = Wheel[n].velocity - Wheel[n].ground;
+	if (fabs(change) > traction * dt)
+		change = copysign(traction * dt, change);
+	Wheel[n].ground += change;
+	Wheel[n].slip += fabs(Wheel[n].velocity - Wheel[n].ground) * dt;
+
+	// An interrupt for each encoder edge
+	int count = (int) floor(Wheel[n].position / WHEEL_FACTOR_MM);
+	while (Wheel[n].phase != count) {
+		Wheel[n].phase += (count > Wheel[n].phase) ? 1 : -1;
+		set_phase(n, Wheel[n].phase);
+		nxt_motor_isr_C();
+	}
+}
+
+/* Runs the wheels for ms milliseconds, with the control in the 1 kHz task */
+static void run(uint32_t ms) {
+	for (uint32_t i = 0; i < ms; i++) {
+		for (int k = 0; k < 1000 / STEP_US; k++) {
+			timeUs += STEP_US;
+			set_time(timeUs);
+			wheel_step(servoLeft, STEP_US * 1e-6);
+			wheel_step(servoRight, STEP_US * 1e-6);
+		}
+
+		for (uint8_t n = 0; n < NXT_N_MOTORS; n++)
+			for (int d = DELAY_MS; d > 0; d--)
+				Wheel[n].power[d] = Wheel[n].power[d - 1];
+
+		nxt_motor_1kHz_process();
+		vMotorVelocityControl();
+	}
+}
+
+/* Mean speed of a wheel over ms milliseconds */
+static double mean_speed(uint8_t n, uint32_t ms) {
+	double start = Wheel[n].position;
+	run(ms);
+	return (Wheel[n].position - start) * 1000 / ms;
+}
+
+static void start(const motor_model_t *M) {
+	Model = M;
+	memset(Wheel, 0, sizeof(Wheel));
+	timeUs = 0;
+	motors_init();
+	vMotor_init();
+	vMotorMovementSwitch(0, 0, &(uint8_t) { 0 }, &(uint8_t) { 0 });
+	run(10);
+}
+
+static void test_speed(void) {
+	for (size_t i = 0; i < N_MODELS; i++) {
+		start(&Models[i]);
+
+		// Same speed at every battery voltage and motor constant
+		vMotorSetVelocity(150, 150);
+		run(2000);
+		double left = mean_speed(servoLeft, 500);
+		double right = Wheel[servoRight].velocity;
+		CHECK(fabs(left - 150) < 3 && fabs(right - 150) < 5);
+
+		vMotorSetVelocity(-100, 100);
+		run(2000);
+		CHECK(fabs(mean_speed(servoLeft, 500) + 100) < 3);
+		CHECK(fabs(Wheel[servoRight].velocity - 100) < 5);
+		CHECK(fabs(fMotorGetSpeed()) < 10);
+
+		// Slow, where friction takes most of the power
+		vMotorSetVelocity(30, 30);
+		run(2000);
+		CHECK(fabs(mean_speed(servoRight, 1000) - 30) < 3);
+
+		// Stops without power
+		vMotorSetVelocity(0, 0);
+		run(1000);
+		CHECK(Wheel[servoLeft].power[0] == 0 && Wheel[servoRight].power[0] == 0);
+		CHECK(fabs(mean_speed(servoLeft, 200)) < 1);
+
+		printf("test_speed: model %zu, %.0f mV battery: 150 mm/s in %.1f mm/s\n", i,
+				Models[i].batteryMv, left);
+	}
+}
+
+static void test_open_loop(void) {
+	start(&Models[0]);
+	vMotorSetVelocity(150, 150);
+	run(500);
+
+	// The open loop switch turns the velocity control off
+	uint8_t left, right;
+	vMotorMovementSwitch(40, -40, &left, &right);
+	run(100);
+	CHECK(Wheel[servoLeft].power[0] == 40 && Wheel[servoRight].power[0] == -40);
+	CHECK(left == motorForward && right == motorBackward);
+}
+
+/* Slip over a start, a turn in place, an arc and a stop */
+static double manoeuvre_slip(const motor_model_t *M, double groundTraction) {
+	traction = groundTraction;
+	start(M);
+
+	vMotorSetVelocity(150, 150);
+	run(1500);
+	vMotorSetVelocity(-130, 130);
+	run(2000);
+	vMotorSetVelocity(150, 50);
+	run(2000);
+	vMotorSetVelocity(0, 0);
+	run(1500);
+	CHECK(fabs(Wheel[servoLeft].ground) < 1 && fabs(Wheel[servoRight].ground) < 1);
+
+	traction = INFINITY;
+	return Wheel[servoLeft].slip + Wheel[servoRight].slip;
+}
+
+static void test_profile(void) {
+	// The forward speed ramps up at MOTION_ACCELERATION after the jerk
+	// limited start, so it takes about 0.7 s to get to 150 mm/s
+	start(&Models[0]);
+	vMotorSetVelocity(150, 150);
+	run(150);
+	CHECK(Wheel[servoLeft].velocity < 150 * 0.35);
+	run(650);
+	CHECK(fabs(Wheel[servoLeft].velocity - 150) < 5);
+
+	// The setpoint steps slipped 240-285 mm at 400 mm/s^2 of traction and
+	// 95-140 mm at 800 without the profile. The limits add up to 400, and
+	// what is left is the tracking error of the wheel loop, most of it
+	// where a wheel turns and friction lets go
+	for (size_t i = 0; i < N_MODELS; i++) {
+		double low = manoeuvre_slip(&Models[i], 400);
+		double high = manoeuvre_slip(&Models[i], 800);
+		CHECK(low < 20);
+		CHECK(high < 3);
+		printf("test_profile: model %zu, slip %.1f mm at 400 mm/s^2 of traction, %.1f mm at 800\n", i, low, high);
+	}
+}
+
+int main(void) {
+	test_speed();
+	test_open_loop();
+	test_profile();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,288 @@
+/************************************************************************/
+// File:			test_nxt_motors.c
+//
+// Host test of the quadrature decoder in nxt_motors.c, included through
+// nxt_motors_host.h so the test sets the encoder pins and the PIT and
+// calls the ISRs itself. The storm test replays encoder edges with
+// contact bounce against the pin interrupt and the TC0 polling.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "host_rtos.h"
+
+#include "nxt_motors_host.h"
+
+static int motorPower[NXT_N_MOTORS];
+
+void nxt_avr_set_motor(unsigned long n, int power_percent, int brake) {
+	(void) brake;
+	motorPower[n] = power_percent;
+}
+
+static void test_decode(void) {
+	motors_init();
+
+	// Forward at 1500 counts/s, the speed is known from the second edge
+	int phase = 0;
+	double t = 0;
+	for (int i = 0; i < 1000; i++) {
+		t += 1e6 / 1500;
+		set_time(t);
+		set_phase(0, ++phase);
+		nxt_motor_isr_C();
+		if (i == 0)
+			CHECK(nxt_motor_get_velocity(0) == 0);
+		if (i == 1)
+			CHECK(abs(nxt_motor_get_velocity(0) - 1500) <= 2);
+	}
+	CHECK(nxt_motor_get_count(0) == 1000);
+	CHECK(abs(nxt_motor_get_velocity(0) - 1500) <= 2);
+	CHECK(nxt_motor_get_count(1) == 0 && nxt_motor_get_count(2) == 0);
+
+	// Backwards with the edges of the two channels unevenly spaced, 0.3
+	// and 0.7 of a 2 ms period, which is 1000 counts/s
+	for (int i = 0; i < 400; i++) {
+		t += (i & 1) ? 1400 : 600;
+		set_time(t);
+		set_phase(0, --phase);
+		nxt_motor_isr_C();
+		if (i == 1) {	// Edges from before the turn are not used
+			int velocity = nxt_motor_get_velocity(0);
+			CHECK(velocity < -500 && velocity > -2000);
+		}
+	}
+	CHECK(nxt_motor_get_count(0) == 600);
+	CHECK(abs(nxt_motor_get_velocity(0) + 1000) <= 2);
+
+	// Standing still, the speed is bounded by one count over the idle time,
+	// then zero
+	set_time(t + 5000);
+	CHECK(abs(nxt_motor_get_velocity(0) + 200) <= 2);
+	set_time(t + 200000);
+	CHECK(nxt_motor_get_velocity(0) == 0);
+
+	// Dithering across one edge does not count or move
+	for (int i = 0; i < 10; i++) {
+		t += 300;
+		set_time(t);
+		set_phase(0, (i & 1) ? phase : phase + 1);
+		nxt_motor_isr_C();
+	}
+	CHECK(nxt_motor_get_count(0) == 600);
+	CHECK(nxt_motor_get_velocity(0) == 0);
+
+	// Both pins changing at once is a missed edge, two counts on in the
+	// direction the motor was going
+	set_phase(0, ++phase);
+	nxt_motor_isr_C();
+	phase += 2;
+	set_phase(0, phase);
+	nxt_motor_isr_C();
+	CHECK(nxt_motor_get_count(0) == 603);
+}
+
+static void test_timestamp(void) {
+	// A tick that is due but not handled yet is in PICNT
+	gHostTick = 10;
+	fakePit.PITC_PIIR = (1ul << 20) | 5;
+	unsigned long before = nxt_motor_timestamp();
+	gHostTick = 11;
+	fakePit.PITC_PIIR = 6;
+	CHECK(nxt_motor_timestamp() - before == 1);
+}
+
+static void test_target(void) {
+	motors_init();
+
+	nxt_motor_command(1, 100, 60);
+	CHECK(nxt_motor_has_target(1) && motorPower[1] == 60);
+
+	int phase = 0;
+	for (int i = 0; i < 100 - TOLERANCE - 1; i++) {
+		set_phase(1, ++phase);
+		nxt_motor_isr_C();
+	}
+	CHECK(nxt_motor_has_target(1) && motorPower[1] == 60);
+	CHECK(ulTaskNotifyTake(pdTRUE, 0) == 0);
+
+	// Within TOLERANCE the ISR stops the motor and wakes the task
+	set_phase(1, ++phase);
+	nxt_motor_isr_C();
+	CHECK(!nxt_motor_has_target(1) && motorPower[1] == 0);
+	CHECK(ulTaskNotifyTake(pdTRUE, 0) == 1);
+}
+
+/* Pin changes of the storm replay */
+typedef struct {
+	double t;
+	uint8_t n;
+	unsigned long pins;
+} edge_event_t;
+
+static edge_event_t *Events;
+static size_t nEvents, eventsSize;
+static double bounceSpacing = 0.7;	// us
+
+static void add_event(double t, uint8_t n, unsigned long pins) {
+	if (nEvents == eventsSize) {
+		eventsSize = eventsSize ? 2 * eventsSize : 1024;
+		Events = realloc(Events, eventsSize * sizeof(edge_event_t));
+	}
+	Events[nEvents++] = (edge_event_t) { t, n, pins };
+}
+
+static int compare_events(const void *a, const void *b) {
+	double d = ((const edge_event_t *) a)->t - ((const edge_event_t *) b)->t;
+	return (d > 0) - (d < 0);
+}
+
+static double random_uniform(void) {
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/* The interrupt sources as the AIC sees them, from what the driver wrote */
+static uint8_t pioEnabled, tcEnabled;
+static int pollingEntered;
+
+static void peripheral_writes(void) {
+	if (fakePio.PIO_IDR) {
+		pioEnabled = FALSE;
+		fakePio.PIO_IDR = 0;
+	}
+	if (fakePio.PIO_IER) {
+		pioEnabled = TRUE;
+		fakePio.PIO_IER = 0;
+	}
+	if (fakeTc.TC_CCR & AT91C_TC_CLKDIS)
+		tcEnabled = FALSE;
+	else if ((fakeTc.TC_CCR & AT91C_TC_CLKEN) && !tcEnabled) {
+		tcEnabled = TRUE;
+		pollingEntered++;
+	}
+	fakeTc.TC_CCR = 0;
+}
+
+/**
+ * Replays rate[n] counts per second on each motor for duration ms, where
+ * each edge bounces eight times with probability bounce. Runs in 0.25 us
+ * steps; a pin interrupt is taken latency us after a change and each ISR
+ * takes isr us. Returns TRUE if every count was kept.
+ */
+static uint8_t storm(const char *name, const double rate[NXT_N_MOTORS], double duration, double bounce,
+		double latency, double isr) {
+	int truth[NXT_N_MOTORS] = { 0 };
+
+	nEvents = 0;
+	for (uint8_t n = 0; n < NXT_N_MOTORS; n++) {
+		if (rate[n] == 0)
+			continue;
+
+		int phase = 0, step = (rate[n] > 0) ? 1 : -1;
+		double period = 1e6 / fabs(rate[n]);
+		for (double t = period * (0.8 + 0.4 * random_uniform()); t < duration * 1000;
+				t += period * (0.8 + 0.4 * random_uniform())) {
+			unsigned long previous = gray[phase & 3];
+			phase += step;
+			truth[n] += step;
+			add_event(t, n, gray[phase & 3]);
+
+			if (random_uniform() < bounce) {
+				for (int k = 0; k < 8; k++)
+					add_event(t + 0.5 + k * bounceSpacing, n, (k & 1) ? gray[phase & 3] : previous);
+				add_event(t + 0.5 + 8 * bounceSpacing, n, gray[phase & 3]);
+			}
+		}
+	}
+	qsort(Events, nEvents, sizeof(edge_event_t), compare_events);
+
+	motors_init();
+	tcEnabled = FALSE;
+	pollingEntered = 0;
+	fakeTc.TC_CCR = 0;
+	peripheral_writes();
+
+	unsigned long pins[NXT_N_MOTORS] = { 0 };
+	uint8_t pending = FALSE;
+	double pendingSince = 0, busyUntil = 0, nextPoll = 125, nextTick = 1000;
+	long interrupts = 0, polls = 0;
+	size_t e = 0;
+	for (double t = 0; t < duration * 1000 + 5000; t += 0.25) {
+		for (; e < nEvents && Events[e].t <= t; e++) {
+			pins[Events[e].n] = Events[e].pins;
+			fakePio.PIO_PDSR = 0;
+			for (uint8_t n = 0; n < NXT_N_MOTORS; n++)
+				fakePio.PIO_PDSR |= ((pins[n] & 1) << pinA[n]) | ((pins[n] >> 1) << pinB[n]);
+			if (!pending) {
+				pending = TRUE;
+				pendingSince = t;
+			}
+		}
+		if (t < busyUntil)
+			continue;
+
+		set_time(t);
+		if (t >= nextTick) {
+			nxt_motor_1kHz_process();
+			peripheral_writes();
+			nextTick += 1000;
+		}
+		if (t >= nextPoll) {
+			if (tcEnabled) {
+				nxt_motor_poll_isr_C();
+				peripheral_writes();
+				busyUntil = t + isr;
+				polls++;
+			}
+			nextPoll += 1e6 / POLL_HZ;
+		}
+		// A change while the pin interrupt is disabled stays latched
+		if (pioEnabled && pending && t >= pendingSince + latency) {
+			pending = FALSE;
+			nxt_motor_isr_C();
+			peripheral_writes();
+			busyUntil = t + isr;
+			interrupts++;
+		}
+	}
+
+	uint8_t kept = TRUE;
+	for (uint8_t n = 0; n < NXT_N_MOTORS; n++)
+		kept &= nxt_motor_get_count(n) == truth[n];
+
+	printf("%-26s counts %6d %6d %6d  got %6d %6d %6d  interrupts %ld polls %ld polling %d%s\n", name,
+			truth[0], truth[1], truth[2], nxt_motor_get_count(0), nxt_motor_get_count(1),
+			nxt_motor_get_count(2), interrupts, polls, pollingEntered, tcEnabled ? " (still)" : "");
+	return kept;
+}
+
+static void test_storms(void) {
+	srand(1);
+	CHECK(storm("full speed, clean", (double[]) { 2000, -2000, 1500 }, 500, 0, 3, 4));
+	CHECK(storm("full speed, bouncy", (double[]) { 2000, -2000, 1500 }, 500, 0.3, 3, 4));
+	CHECK(storm("4000/s, bouncy", (double[]) { 4000, 4000, -4000 }, 500, 0.5, 3, 4));
+	CHECK(storm("12000/s, edges overlap", (double[]) { 12000, -12000, 0 }, 300, 0, 3, 4));
+	CHECK(storm("slow, bouncy", (double[]) { 200, -150, 50 }, 500, 0.5, 3, 4));
+	CHECK(pollingEntered == 0);		// Slow edges stay on the pin interrupt
+	CHECK(!tcEnabled);
+
+	bounceSpacing = 15;
+	CHECK(storm("full speed, slow bounces", (double[]) { 2000, -2000, 1500 }, 500, 0.3, 3, 4));
+	CHECK(!tcEnabled);				// Back on the pin interrupt after the storm
+	bounceSpacing = 0.7;
+}
+
+int main(void) {
+	test_decode();
+	test_timestamp();
+	test_target();
+	test_storms();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+/************************************************************************/
+// File:			test_occupancy_grid.c
+//
+// Host test of the occupancy grid. A robot at a few positions in a square
+// room scans the walls all around. Cells on the walls must end up occupied,
+// cells between the robot and the walls free, and cells outside the room
+// unknown. Also checks saturation and beams that leave the grid.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "defines.h"
+#include "occupancy_grid.h"
+#include "types.h"
+
+#define ROOM_HALF_CM	30		// Walls at x and y = +-30 cm, inside MAX_IR_DISTANCE of every pose
+
+/* Distance from Origin along the direction to the first wall of the room */
+static float room_range(point_t Origin, float angle) {
+	float c = cosf(angle), s = sinf(angle), range = 1e9f;
+	if (c > 1e-6f)
+		range = fminf(range, (ROOM_HALF_CM - Origin.x) / c);
+	if (c < -1e-6f)
+		range = fminf(range, (-ROOM_HALF_CM - Origin.x) / c);
+	if (s > 1e-6f)
+		range = fminf(range, (ROOM_HALF_CM - Origin.y) / s);
+	if (s < -1e-6f)
+		range = fminf(range, (-ROOM_HALF_CM - Origin.y) / s);
+	return range;
+}
+
+static void test_room(void) {
+	grid_init();
+
+	const point_t Poses[] = { { 0, 0 }, { 10, 10 }, { -12, 8 }, { 5, -15 } };
+	for (uint8_t p = 0; p < sizeof Poses / sizeof Poses[0]; p++) {
+		for (uint16_t step = 0; step < 360; step++) {
+			float angle = step * DEG2RAD;
+			float range = room_range(Poses[p], angle);
+			// End just inside the wall, as the sensor sees its surface
+			point_t End = { Poses[p].x + (range - 0.1f) * cosf(angle), Poses[p].y + (range - 0.1f) * sinf(angle) };
+			grid_update_beam(Poses[p], End, TRUE);
+		}
+	}
+
+	// The robot positions, and the middle of the room, are free
+	for (uint8_t p = 0; p < sizeof Poses / sizeof Poses[0]; p++)
+		CHECK(grid_get_cell(Poses[p]) < 0);
+
+	int occupied = 0, free = 0, unknown = 0;
+	for (float x = -ROOM_HALF_CM + 2.5f; x < ROOM_HALF_CM; x += GRID_CELL_SIZE_CM) {
+		for (float y = -ROOM_HALF_CM + 2.5f; y < ROOM_HALF_CM; y += GRID_CELL_SIZE_CM) {
+			int8_t cell = grid_get_cell((point_t) { x, y });
+			uint8_t wall = fabsf(x) > ROOM_HALF_CM - GRID_CELL_SIZE_CM || fabsf(y) > ROOM_HALF_CM - GRID_CELL_SIZE_CM;
+			if (wall)
+				occupied += cell > 0;
+			else
+				free += cell < 0;
+			if (!wall)
+				CHECK(cell <= 0);
+		}
+	}
+	// All 10 x 10 inner cells are seen free, and all 44 cells along the walls occupied
+	CHECK(free == 100);
+	CHECK(occupied == 44);
+
+	// Nothing outside the room is seen
+	for (float x = -100; x <= 100; x += GRID_CELL_SIZE_CM) {
+		unknown += grid_get_cell((point_t) { x, ROOM_HALF_CM + 7.5f }) == 0;
+		unknown += grid_get_cell((point_t) { ROOM_HALF_CM + 7.5f, x }) == 0;
+	}
+	CHECK(unknown == 2 * 41);
+
+	// grid_read_row returns the same cells
+	int8_t row[GRID_CELLS_PER_MESSAGE];
+	grid_read_row(GRID_ORIGIN_Y, GRID_ORIGIN_X - GRID_CELLS_PER_MESSAGE / 2, row, GRID_CELLS_PER_MESSAGE);
+	for (uint8_t i = 0; i < GRID_CELLS_PER_MESSAGE; i++) {
+		point_t Centre = { ((int16_t) i - GRID_CELLS_PER_MESSAGE / 2 + 0.5f) * GRID_CELL_SIZE_CM, 0.5f * GRID_CELL_SIZE_CM };
+		CHECK(row[i] == grid_get_cell(Centre));
+	}
+}
+
+static void test_saturation_and_bounds(void) {
+	grid_init();
+
+	point_t Origin = { 0, 0 }, End = { 20, 0 };
+	for (int i = 0; i < 1000; i++)
+		grid_update_beam(Origin, End, TRUE);
+	CHECK(grid_get_cell(End) == LOG_ODDS_MAX);
+	CHECK(grid_get_cell((point_t) { 10, 0 }) == LOG_ODDS_MIN);
+
+	// A miss leaves the end cell free too
+	grid_update_beam(Origin, (point_t) { 0, -20 }, FALSE);
+	CHECK(grid_get_cell((point_t) { 0, -20 }) == LOG_ODDS_MISS);
+
+	// Beams from and to far outside the grid only touch the cells inside it
+	int8_t before[GRID_WIDTH], after[GRID_WIDTH];
+	grid_read_row(0, 0, before, GRID_WIDTH);
+	grid_update_beam((point_t) { -5000, -5000 }, (point_t) { 5000, 5000 }, TRUE);
+	grid_update_beam((point_t) { -5000, 1000 }, (point_t) { 5000, 1000 }, TRUE);
+	grid_read_row(0, 0, after, GRID_WIDTH);
+	CHECK(memcmp(before + 1, after + 1, GRID_WIDTH - 1) == 0);
+	CHECK(after[0] == LOG_ODDS_MISS);	// The diagonal passes the corner cell
+	CHECK(grid_get_cell((point_t) { 1000, 1000 }) == 0);
+}
+
+int main(void) {
+	test_room();
+	test_saturation_and_bounds();
+
+	return TEST_RESULT();
+}
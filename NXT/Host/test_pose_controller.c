@@ -0,0 +1,186 @@
+/************************************************************************/
+// File:			test_pose_controller.c
+//
+// Host test of the pure pursuit in pose_controller.c. The task runs as is,
+// and the robot is simulated on the tick hook: a unicycle whose wheels
+// follow the speed setpoints with a 60 ms lag, and a pose estimate with
+// a notification to the controller every PERIOD_ESTIMATOR_MS. A route
+// ends when the robot has stopped after sending idle.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+
+#include "channel.h"
+#include "defines.h"
+#include "host_rtos.h"
+#include "motor.h"
+#include "pose_controller.h"
+#include "types.h"
+
+volatile uint8_t gHandshook = TRUE;
+volatile uint8_t gPaused = FALSE;
+channel_t globalPoseChannel;
+channel_t movementChannel;
+QueueHandle_t poseControllerQ;
+TaskHandle_t xPoseCtrlTask;
+
+#define WHEEL_LAG_S		0.06
+#define ROUTE_TIMEOUT	120000		// [ms]
+
+static struct {
+	double x, y, theta;				// [mm], [rad]
+	double left, right;				// Wheel speeds [mm/s]
+	float leftSetpoint, rightSetpoint;
+} Robot;
+
+static const point_t *Route;
+static uint8_t routeLength;
+static double closest[WAYPOINT_QUEUE_SIZE];	// Closest approach to each waypoint
+static int idles;
+static TickType_t routeStart, routeEnd;
+static jmp_buf routeDone;
+
+void vMotorSetVelocity(float leftSpeed, float rightSpeed) {
+	Robot.leftSetpoint = leftSpeed;
+	Robot.rightSetpoint = rightSpeed;
+}
+
+void send_idle(void) {
+	idles++;
+}
+
+static void robot_tick(TickType_t tick) {
+	const double dt = 0.001;
+	Robot.left += (Robot.leftSetpoint - Robot.left) * dt / WHEEL_LAG_S;
+	Robot.right += (Robot.rightSetpoint - Robot.right) * dt / WHEEL_LAG_S;
+
+	double v = (Robot.left + Robot.right) / 2;
+	Robot.x += v * cos(Robot.theta) * dt;
+	Robot.y += v * sin(Robot.theta) * dt;
+	Robot.theta += (Robot.right - Robot.left) / WHEELBASE_MM * dt;
+
+	for (uint8_t i = 0; i < routeLength; i++) {
+		double d = hypot(Route[i].x - Robot.x, Route[i].y - Robot.y);
+		if (d < closest[i])
+			closest[i] = d;
+	}
+
+	if (tick % PERIOD_ESTIMATOR_MS == 0) {
+		pose_t Pose = { (float) remainder(Robot.theta, 2 * M_PI), (float) Robot.x, (float) Robot.y };
+		channel_write(&globalPoseChannel, &Pose);
+		xTaskNotifyGive(xPoseCtrlTask);
+	}
+
+	uint8_t stopped = fabs(Robot.left) < 1 && fabs(Robot.right) < 1;
+	if ((idles > 0 && stopped) || tick - routeStart >= ROUTE_TIMEOUT) {
+		routeEnd = tick;
+		longjmp(routeDone, 1);
+	}
+}
+
+/* Drives a route from the origin along x, returns the time taken in ms */
+static double drive(const point_t *Points, uint8_t n) {
+	Robot = (typeof(Robot)) { 0 };
+	Route = Points;
+	routeLength = n;
+	for (uint8_t i = 0; i < n; i++)
+		closest[i] = INFINITY;
+	idles = 0;
+
+	channel_init(&globalPoseChannel, sizeof(pose_t));
+	channel_init(&movementChannel, sizeof(uint8_t));
+	xQueueReset(poseControllerQ);
+	for (uint8_t i = 0; i < n; i++)
+		xQueueSendToBack(poseControllerQ, &Points[i], 0);
+
+	routeStart = gHostTick;
+	gHostTickHook = robot_tick;
+	if (!setjmp(routeDone))
+		vMainPoseControllerTask(NULL);
+	gHostTickHook = NULL;
+
+	return routeEnd - routeStart;
+}
+
+/* Checks that the route was completed through every waypoint */
+static void check_route(const char *name, double ms, double maxMs) {
+	const point_t *Last = &Route[routeLength - 1];
+	double error = hypot(Last->x - Robot.x, Last->y - Robot.y);
+	double worst = 0;
+	for (uint8_t i = 0; i < routeLength; i++)
+		if (closest[i] > worst)
+			worst = closest[i];
+
+	CHECK(idles == 1);
+	CHECK(error < 10);
+	CHECK(worst < 150);
+	CHECK(ms < maxMs);
+	printf("%-20s %5.1f s, %4.1f mm from the end, waypoints passed within %3.0f mm\n", name, ms / 1000, error, worst);
+}
+
+static void test_routes(void) {
+	static const point_t Square[] = { { 600, 0 }, { 600, 600 }, { 0, 600 }, { 0, 0 } };
+	static const point_t Zigzag[] = { { 400, 0 }, { 800, 300 }, { 1200, 0 }, { 1600, 300 }, { 2000, 0 },
+			{ 2400, 300 }, { 2800, 0 } };
+	point_t Curve[12];
+	for (uint8_t i = 0; i < 12; i++) {
+		double a = (i + 1) * M_PI / 12;
+		Curve[i] = (point_t) { (float) (800 * sin(a)), (float) (800 * (1 - cos(a))) };
+	}
+
+	// Within the times the stop-turn-drive controller took, one waypoint
+	// at a time: 28.2, 43.2 and 38.7 s
+	check_route("600 mm square", drive(Square, 4), 25000);
+	check_route("7-point zigzag", drive(Zigzag, 7), 34000);
+	check_route("12-point half circle", drive(Curve, 12), 25000);
+}
+
+static uint8_t stopsAtDisconnect;
+
+static void disconnect_tick(TickType_t tick) {
+	if (tick - routeStart == 2000)
+		gHandshook = FALSE;
+	if (tick - routeStart == 2000 + 2 * PERIOD_MOTOR_MS) {
+		stopsAtDisconnect = Robot.leftSetpoint == 0 && Robot.rightSetpoint == 0;
+		longjmp(routeDone, 1);
+	}
+	robot_tick(tick);
+}
+
+static void test_disconnect(void) {
+	static const point_t Far[] = { { 5000, 0 } };
+	Robot = (typeof(Robot)) { 0 };
+	Route = Far;
+	routeLength = 1;
+	idles = 0;
+	xQueueReset(poseControllerQ);
+	xQueueSendToBack(poseControllerQ, &Far[0], 0);
+
+	routeStart = gHostTick;
+	gHostTickHook = disconnect_tick;
+	if (!setjmp(routeDone))
+		vMainPoseControllerTask(NULL);
+	gHostTickHook = NULL;
+	gHandshook = TRUE;
+
+	CHECK(Robot.x > 100);
+	CHECK(stopsAtDisconnect);
+}
+
+int main(void) {
+	poseControllerQ = xQueueCreate(WAYPOINT_QUEUE_SIZE, sizeof(point_t));
+
+	test_routes();
+	test_disconnect();
+
+	return TEST_RESULT();
+}
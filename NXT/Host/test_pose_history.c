@@ -0,0 +1,166 @@
+/************************************************************************/
+// File:			test_pose_history.c
+//
+// Host test of the pose history. Covers the lookup and interpolation,
+// waiting for the estimate after a measurement with the estimator
+// simulated on the tick hook, and a reader racing the writer on another
+// thread.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "defines.h"
+#include "host_rtos.h"
+#include "task.h"
+#include "pose_history.h"
+
+static void test_lookup(void) {
+	pose_t Pose = { 0 };
+
+	// Empty history
+	CHECK(!pose_history_get(5, &Pose));
+	CHECK(Pose.x == 0);
+
+	// An estimate every 40 ticks from tick 1000, the heading crosses +-pi
+	for (uint32_t k = 0; k < 100; k++) {
+		float theta = 3.0f + 0.01f * k;
+		if (theta > M_PI_F)
+			theta -= 2 * M_PI_F;
+		pose_history_add(1000 + 40 * k, (pose_t) { theta, 2.0f * k, -1.0f * k });
+	}
+
+	// Between estimates 89 and 90, across the wrap of the heading
+	CHECK(pose_history_get(1000 + 40 * 89 + 10, &Pose));
+	CHECK(fabsf(Pose.x - 2 * 89.25f) < 1e-3f && fabsf(Pose.y + 89.25f) < 1e-3f);
+	CHECK(fabs(remainder(Pose.theta - (3.0 + 0.01 * 89.25), 2 * M_PI)) < 1e-5);
+	CHECK(Pose.theta >= -M_PI_F && Pose.theta <= M_PI_F);
+
+	// On an estimate
+	CHECK(pose_history_get(1000 + 40 * 95, &Pose) && fabsf(Pose.x - 190) < 1e-4f);
+
+	// Newer than the newest estimate gives the newest
+	CHECK(!pose_history_get(1000 + 40 * 99 + 5, &Pose) && fabsf(Pose.x - 198) < 1e-4f);
+
+	// Older than the oldest kept one gives the oldest kept one
+	CHECK(!pose_history_get(1000, &Pose));
+	CHECK(fabsf(Pose.x - 2 * (100 - (POSE_HISTORY_SIZE - 1))) < 1e-4f);
+
+	// Across the wrap of the tick counter
+	for (uint32_t k = 0; k < 40; k++)
+		pose_history_add(0xFFFFFF00u + 40 * k, (pose_t) { 0, (float) k, 0 });
+	CHECK(pose_history_get(0xFFFFFF00u + 40 * 20 + 20, &Pose) && fabsf(Pose.x - 20.5f) < 1e-4f);
+}
+
+/* The estimator, run on the tick hook: a pose every PERIOD_ESTIMATOR_MS
+ticks with x equal to the tick, until estimatorStop. A float x is good to
+about 0.01 at these ticks. */
+static TickType_t estimatorStop;
+
+static void estimator_tick(TickType_t tick) {
+	if (tick % PERIOD_ESTIMATOR_MS == 0 && (int32_t) (tick - estimatorStop) < 0)
+		pose_history_add(tick, (pose_t) { 0, (float) tick, 0 });
+}
+
+static void test_wait(void) {
+	pose_t Pose;
+	gHostTick = 100000;
+	estimatorStop = 200000;
+	gHostTickHook = estimator_tick;
+	vTaskDelay(PERIOD_ESTIMATOR_MS);		// First estimate
+
+	// A measurement 13 ticks after an estimate waits for the next one,
+	// without polling every tick, and gets the interpolated pose
+	vTaskDelay(13);
+	uint32_t measured = gHostTick;
+	CHECK(pose_history_wait(measured, &Pose, POSE_HISTORY_WAIT_MS));
+	CHECK(gHostTick == measured + PERIOD_ESTIMATOR_MS - 13);
+	CHECK(fabsf(Pose.x - measured) < 0.02f);
+
+	// A measurement that is already in the history returns at once
+	TickType_t before = gHostTick;
+	CHECK(pose_history_wait(measured - 10, &Pose, POSE_HISTORY_WAIT_MS));
+	CHECK(gHostTick == before && fabsf(Pose.x - (measured - 10)) < 0.02f);
+
+	// A stalled estimator times out with the newest pose
+	estimatorStop = gHostTick + 1;
+	vTaskDelay(5);
+	measured = gHostTick;
+	CHECK(!pose_history_wait(measured, &Pose, POSE_HISTORY_WAIT_MS));
+	CHECK(gHostTick == measured + POSE_HISTORY_WAIT_MS);
+	CHECK(Pose.x == (float) (estimatorStop - estimatorStop % PERIOD_ESTIMATOR_MS));
+
+	gHostTickHook = NULL;
+}
+
+/* Writer and reader on two threads. The writer adds poses with x equal to
+the tick as fast as it can, so readers are often overtaken. */
+static volatile uint32_t writerTick;
+static volatile uint8_t stop;
+
+static void *writer(void *arg) {
+	(void) arg;
+	for (uint32_t tick = 2000000; !stop && tick < 16000000; tick += 4) {
+		pose_history_add(tick, (pose_t) { 0, (float) tick, -(float) tick });
+		writerTick = tick;
+	}
+	stop = TRUE;
+	return NULL;
+}
+
+static void test_concurrent(void) {
+	stop = FALSE;
+	writerTick = 0;
+	pose_history_add(2000000 - 4, (pose_t) { 0, 2000000 - 4, -(2000000 - 4) });
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, writer, NULL);
+
+	long reads = 0, inside = 0, wrong = 0;
+	time_t start = time(NULL);
+	while (!stop && time(NULL) - start < 2) {
+		uint32_t newest = writerTick;
+		if (newest == 0)
+			continue;
+		uint32_t tick = newest - (reads % (4 * POSE_HISTORY_SIZE)) + 1;
+
+		pose_t Pose;
+		if (pose_history_get(tick, &Pose)) {
+			inside++;
+			wrong += fabsf(Pose.x - tick) > 0.5f || Pose.x != -Pose.y;
+		}
+		reads++;
+	}
+	stop = TRUE;
+	pthread_join(thread, NULL);
+
+	CHECK(inside > 1000);
+	CHECK(wrong == 0);
+	printf("test_concurrent: %ld reads, %ld inside the history, %ld wrong\n", reads, inside, wrong);
+}
+
+int main(void) {
+	test_lookup();
+	test_wait();
+	test_concurrent();
+
+	pose_t Pose;
+	const int N = 1000000;
+	volatile float sink = 0;
+	clock_t t0 = clock();
+	for (int i = 0; i < N; i++) {
+		// About 15 entries back on average
+		pose_history_get(16000000 - 4 * (i % 30) - 3, &Pose);
+		sink += Pose.x;
+	}
+	clock_t t1 = clock();
+	printf("pose_history_get: %.0f ns per lookup\n", (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N);
+
+	return TEST_RESULT();
+}
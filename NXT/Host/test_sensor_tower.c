@@ -0,0 +1,262 @@
+/************************************************************************/
+// File:			test_sensor_tower.c
+//
+// Host test of the sensor tower sweep. vMainSensorTowerTask runs as is on
+// motor.c and the motor driver, see nxt_motors_host.h. The tick hook
+// simulates the rest: the tower motor at 20 % power, the wheel encoders
+// at a given robot speed, and the pose estimator. The measurements the
+// task queues give the sample rate and how often the front is revisited,
+// and how long after the driver stopped the tower each was taken.
+//
+/************************************************************************/
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+
+#include "channel.h"
+#include "defines.h"
+#include "host_rtos.h"
+#include "motor.h"
+#include "pose_history.h"
+#include "sensor_tower.h"
+#include "types.h"
+
+#include "nxt_motors_host.h"
+
+volatile uint8_t gHandshook = TRUE;
+volatile uint8_t gPaused = FALSE;
+channel_t movementChannel;
+QueueHandle_t poseControllerQ;
+QueueHandle_t measurementQ;
+TaskHandle_t xMappingTask;
+
+/* The tower motor at 20 % power, from the servo timing the step and dwell
+ * were chosen with: 30 ms to get going, then 17.5 ms per degree */
+#define TOWER_START_MS			30
+#define TOWER_COUNTS_PER_MS		(14.2 / 17.5)
+
+#define STEP_US					100
+#define WARM_UP_MS				2000
+
+#define MAX_STOPS				4096
+
+static struct {
+	int power;
+	TickType_t poweredAt;
+	TickType_t stops[MAX_STOPS];	// Ticks the driver stopped the tower at
+	int nStops;
+	double position;			// [counts]
+	int phase;
+} Tower;
+
+static struct {
+	double speed;				// [mm/s]
+	double position;			// [mm]
+	int phase;
+} Wheels;
+
+static jmp_buf runDone;
+static TickType_t runStart, runEnd;
+static int updates;
+
+void nxt_avr_set_motor(unsigned long n, int power_percent, int brake) {
+	(void) brake;
+	if (n == servoTower && power_percent != Tower.power) {
+		Tower.power = power_percent;
+		Tower.poweredAt = gHostTick;
+		if (power_percent == 0 && Tower.nStops < MAX_STOPS)
+			Tower.stops[Tower.nStops++] = gHostTick;
+	}
+}
+
+unsigned long battery_voltage(void) {
+	return 8000;
+}
+
+uint8_t distance_get_cm(uint8_t direction) {
+	(void) direction;
+	return 80;		// Nothing close enough for the anti collision
+}
+
+void send_update(int16_t x_cm, int16_t y_cm, int16_t heading_deg, int16_t towerAngle_deg, uint8_t S1_cm,
+		uint8_t S2_cm, uint8_t S3_cm, uint8_t S4_cm) {
+	updates++;
+}
+
+void send_idle(void) {
+}
+
+static void robot_tick(TickType_t tick) {
+	for (int k = 1; k <= 1000 / STEP_US; k++) {
+		set_time((tick - 1) * 1000.0 + k * STEP_US);
+
+		if (Tower.power != 0 && tick - Tower.poweredAt > TOWER_START_MS)
+			Tower.position += (Tower.power > 0 ? 1 : -1) * TOWER_COUNTS_PER_MS * STEP_US / 1000.0;
+		Wheels.position += Wheels.speed * STEP_US * 1e-6;
+
+		int towerCount = (int) floor(Tower.position);
+		int wheelCount = (int) floor(Wheels.position / WHEEL_FACTOR_MM);
+		while (Tower.phase != towerCount || Wheels.phase != wheelCount) {
+			if (Tower.phase != towerCount) {
+				Tower.phase += (towerCount > Tower.phase) ? 1 : -1;
+				set_phase(servoTower, Tower.phase);
+			}
+			if (Wheels.phase != wheelCount) {
+				Wheels.phase += (wheelCount > Wheels.phase) ? 1 : -1;
+				set_phase(servoLeft, Wheels.phase);
+				set_phase(servoRight, Wheels.phase);
+			}
+			nxt_motor_isr_C();
+		}
+	}
+	nxt_motor_1kHz_process();
+
+	if (tick % PERIOD_ESTIMATOR_MS == 0)
+		pose_history_add(tick, (pose_t) { 0, (float) Wheels.position, 0 });
+
+	if (tick == runEnd)
+		longjmp(runDone, 1);
+}
+
+typedef struct {
+	double samplesPerSecond;
+	double meanStep;			// [deg]
+	double frontMean, frontMax;	// Time between front measurements [ms]
+	double sweep;				// Time for 0-90-0 [ms]
+	double settleMean;			// From the tower stopping to the measurement [ms]
+	uint32_t settleMin, settleMax;
+} sweep_t;
+
+/* Runs the tower for ms at a robot speed and sums up the measurements */
+static sweep_t sweep(double speed, uint32_t ms) {
+	memset(&Tower, 0, sizeof(Tower));
+	memset(&Wheels, 0, sizeof(Wheels));
+	Wheels.speed = speed;
+	motors_init();
+	vMotor_init();
+
+	uint8_t movement = (speed > 0) ? moveForward : moveStop;
+	channel_init(&movementChannel, sizeof(uint8_t));
+	channel_write(&movementChannel, &movement);
+	xQueueReset(measurementQ);
+
+	runStart = gHostTick;
+	runEnd = runStart + WARM_UP_MS + ms;
+	gHostTickHook = robot_tick;
+	if (!setjmp(runDone))
+		vMainSensorTowerTask(NULL);
+	gHostTickHook = NULL;
+
+	sweep_t Result = { 0 };
+	measurement_t Measurement;
+	long samples = 0, fronts = 0, steps = 0, turns = 0;
+	double stepSum = 0, frontSum = 0;
+	uint32_t lastFront = 0, firstTurn = 0, lastTurn = 0;
+	int lastStep = -1, lastDirection = 0, stop = 0;
+	double settleSum = 0;
+	Result.settleMin = UINT32_MAX;
+	while (xQueueReceive(measurementQ, &Measurement, 0)) {
+		while (stop + 1 < Tower.nStops && Tower.stops[stop + 1] <= Measurement.tick)
+			stop++;
+		if (Measurement.tick < runStart + WARM_UP_MS)
+			continue;
+		samples++;
+
+		uint32_t settle = Measurement.tick - Tower.stops[stop];
+		settleSum += settle;
+		if (settle < Result.settleMin)
+			Result.settleMin = settle;
+		if (settle > Result.settleMax)
+			Result.settleMax = settle;
+
+		if (lastStep >= 0 && Measurement.servoStep != lastStep) {
+			int direction = (Measurement.servoStep > lastStep) ? 1 : -1;
+			stepSum += abs(Measurement.servoStep - lastStep);
+			steps++;
+			if (direction > 0 && lastDirection < 0) {
+				if (turns++ == 0)
+					firstTurn = Measurement.tick;
+				lastTurn = Measurement.tick;
+			}
+			lastDirection = direction;
+		}
+		lastStep = Measurement.servoStep;
+
+		// The forward sensor looks within 30 degrees of the heading at
+		// 0-30, and the right sensor at 60-90
+		if (Measurement.servoStep <= 30 || Measurement.servoStep >= 60) {
+			if (lastFront) {
+				double gap = Measurement.tick - lastFront;
+				frontSum += gap;
+				fronts++;
+				if (gap > Result.frontMax)
+					Result.frontMax = gap;
+			}
+			lastFront = Measurement.tick;
+		}
+	}
+
+	Result.samplesPerSecond = samples * 1000.0 / ms;
+	Result.settleMean = settleSum / samples;
+	Result.meanStep = steps ? stepSum / steps : 0;
+	Result.frontMean = fronts ? frontSum / fronts : 0;
+	Result.sweep = (turns > 1) ? (double) (lastTurn - firstTurn) / (turns - 1) : 0;
+	return Result;
+}
+
+static void test_sweep(void) {
+	// The tower used to wait 200 ms per 5 degree step: 5 samples/s, the
+	// front revisited every 279 ms on average and 1200 ms at most
+	static const double Speeds[] = { 0, 75, 150 };
+	sweep_t Results[3];
+	for (int i = 0; i < 3; i++) {
+		Results[i] = sweep(Speeds[i], 30000);
+		printf("%3.0f mm/s: %.2f samples/s, %.1f degree steps, front every %.0f ms (at most %.0f), sweep %.2f s\n",
+				Speeds[i], Results[i].samplesPerSecond, Results[i].meanStep, Results[i].frontMean,
+				Results[i].frontMax, Results[i].sweep / 1000);
+	}
+
+	// Standing still, small steps and more samples
+	CHECK(fabs(Results[0].meanStep - TOWER_MIN_STEP_DEG) < 0.1);
+	CHECK(Results[0].samplesPerSecond > 8);
+
+	// Driving, bigger steps, and the front is revisited more often. The
+	// longest gap is a step that stops just inside a diagonal and the move
+	// across the rest of it, ~560 ms for 30 degrees
+	CHECK(Results[1].meanStep > Results[0].meanStep && Results[2].meanStep > Results[1].meanStep);
+	for (int i = 1; i < 3; i++) {
+		CHECK(Results[i].samplesPerSecond >= 4.9);
+		CHECK(Results[i].frontMean < 220 && Results[i].frontMax < 800);
+	}
+	CHECK(Results[2].sweep < Results[1].sweep && Results[1].sweep < Results[0].sweep);
+	CHECK(updates > 0);
+
+	// The encoder interrupt stops the tower and wakes the task in the ms
+	// before a tick, the task runs at that tick, so each measurement is
+	// TOWER_SETTLE_MARGIN_MS and at most one tick after the stop. Standing
+	// still, the 80 ms floor on the period could add to that, but the
+	// 2 degree steps take longer than it
+	for (int i = 0; i < 3; i++) {
+		printf("%3.0f mm/s: measured %.1f ms after the tower stopped, %u-%u ms\n", Speeds[i],
+				Results[i].settleMean, Results[i].settleMin, Results[i].settleMax);
+		CHECK(Results[i].settleMin >= TOWER_SETTLE_MARGIN_MS);
+		CHECK(Results[i].settleMax <= TOWER_SETTLE_MARGIN_MS + 1);
+	}
+}
+
+int main(void) {
+	measurementQ = xQueueCreate(1024, sizeof(measurement_t));
+	poseControllerQ = xQueueCreate(WAYPOINT_QUEUE_SIZE, sizeof(point_t));
+
+	test_sweep();
+
+	return TEST_RESULT();
+}
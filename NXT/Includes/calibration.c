@@ -40,10 +40,10 @@ void compassTask(void *par ) {
 	  gRightWheelTicks = 0;
 	  */
 	  wheel_ticks_t WheelTicks = {0};
-	  xQueueOverwrite(wheelTicksQ, &WheelTicks);
+	  vMotorGetWheelTicks(&WheelTicks);
 
-	  float previous_ticksLeft = 0;
-	  float previous_ticksRight = 0;
+	  float previous_ticksLeft = WheelTicks.left;
+	  float previous_ticksRight = WheelTicks.right;
 	  // Storing values for printing later
 	  //         uint8_t tellar = 0;
 	  //         float tabellG[200];
@@ -55,19 +55,17 @@ void compassTask(void *par ) {
 	  xLastWakeTime = xTaskGetTickCount(); 
 	  while(heading < 359){
 		vTaskDelayUntil(&xLastWakeTime, xDelay);
-		int16_t leftWheelTicks = 0;
-		int16_t rightWheelTicks = 0;
+		int32_t leftWheelTicks = 0;
+		int32_t rightWheelTicks = 0;
 		/*
 		taskENTER_CRITICAL();
 		leftWheelTicks = gLeftWheelTicks;
 		rightWheelTicks = gRightWheelTicks;
 		taskEXIT_CRITICAL();
 		*/
-		wheel_ticks_t WheelTicks = {0};
-		if (xQueueReceive(wheelTicksQ, &WheelTicks, 0) == pdTRUE) {
-			leftWheelTicks = WheelTicks.left;
-			rightWheelTicks = WheelTicks.right;
-		}
+		vMotorGetWheelTicks(&WheelTicks);
+		leftWheelTicks = WheelTicks.left;
+		rightWheelTicks = WheelTicks.right;
 
 		float dLeft = (float)(leftWheelTicks - previous_ticksLeft) * WHEEL_FACTOR_MM; // Distance left wheel has traveled since last sample
 		float dRight =(float)(rightWheelTicks - previous_ticksRight) * WHEEL_FACTOR_MM; // Distance right wheel has traveled since last sample
@@ -18,7 +18,6 @@
 
 extern volatile uint8_t gHandshook;
 
-extern QueueHandle_t wheelTicksQ;
 
 void compassTask(void *par);
 
@@ -0,0 +1,68 @@
+#include "channel.h"
+
+/* Kernel includes */
+#include "FreeRTOS.h"
+
+#include <stdint.h>
+
+#include "defines.h"
+
+/* Copies the latest complete value and returns its number, 0 if there is none */
+static uint32_t channel_copy(channel_t *Channel, uint8_t *Value) {
+	while (1) {
+		uint32_t sequence = Channel->sequence;
+		uint32_t written = sequence >> 1;
+		if (written == 0)
+			return 0;
+
+		// While a write is in progress it fills the other slot
+		volatile uint8_t *Slot = Channel->slots[written & 1];
+		for (uint8_t i = 0; i < Channel->size; i++)
+			Value[i] = Slot[i];
+
+		// The slot is reused by write number written + 2, which starts
+		// by setting sequence to 2 * written + 3
+		if (Channel->sequence - 2 * written < 3)
+			return written;
+	}
+}
+
+void channel_init(channel_t *Channel, uint8_t size) {
+	configASSERT(Channel && size <= CHANNEL_MAX_SIZE);
+
+	Channel->sequence = 0;
+	Channel->size = size;
+}
+
+void channel_write(channel_t *Channel, const void *Value) {
+	configASSERT(Channel && Value);
+
+	uint32_t written = Channel->sequence >> 1;
+	volatile uint8_t *Slot = Channel->slots[(written + 1) & 1];
+
+	Channel->sequence = 2 * written + 1;
+	for (uint8_t i = 0; i < Channel->size; i++)
+		Slot[i] = ((const uint8_t *) Value)[i];
+	Channel->sequence = 2 * written + 2;
+}
+
+uint8_t channel_read(channel_t *Channel, void *Value) {
+	configASSERT(Channel && Value);
+
+	return channel_copy(Channel, Value) != 0;
+}
+
+uint8_t channel_read_new(channel_t *Channel, void *Value, uint32_t *lastSequence) {
+	configASSERT(Channel && Value && lastSequence);
+
+	// Cheap check first, most reads find nothing new
+	if ((Channel->sequence >> 1) == *lastSequence)
+		return FALSE;
+
+	uint32_t written = channel_copy(Channel, Value);
+	if (written == 0 || written == *lastSequence)
+		return FALSE;
+
+	*lastSequence = written;
+	return TRUE;
+}
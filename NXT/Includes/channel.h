@@ -0,0 +1,74 @@
+/************************************************************************/
+// File:			channel.h
+//
+// Latest-value channel for values that one task publishes and other tasks
+// only need the newest of, such as the pose. It replaces length-1 queues
+// written with xQueueOverwrite and read with xQueuePeek, without entering
+// a critical section on either side.
+//
+// The value is kept in two slots. The writer fills the slot that does not
+// hold the latest value, so a write never waits for a reader. sequence is
+// odd while a write is in progress and counts two per write, which tells a
+// reader which slot is the latest and whether it was overwritten during the
+// copy. A reader retries only if two writes started during its copy, so a
+// high priority reader never spins on a preempted writer.
+//
+// There must be only one writer per channel.
+//
+/************************************************************************/
+
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include <stdint.h>
+
+#define CHANNEL_MAX_SIZE	36		// Bytes, the largest value is a matrix3_t
+
+typedef struct {
+	volatile uint32_t sequence;
+	uint8_t size;
+	volatile uint8_t slots[2][CHANNEL_MAX_SIZE];
+} channel_t;
+
+/**
+ * @brief      Empties a channel and sets the size of its values. Must be
+ *             called before the tasks using it are started.
+ *
+ * @param      Channel  The channel
+ * @param[in]  size     The size of a value in bytes, at most CHANNEL_MAX_SIZE
+ */
+void channel_init(channel_t *Channel, uint8_t size);
+
+/**
+ * @brief      Publishes a new value. Never blocks.
+ *
+ * @param      Channel  The channel
+ * @param[in]  Value    The value, Channel->size bytes
+ */
+void channel_write(channel_t *Channel, const void *Value);
+
+/**
+ * @brief      Copies the latest value, as xQueuePeek.
+ *
+ * @param      Channel  The channel
+ * @param      Value    Where to copy the value, Channel->size bytes
+ *
+ * @return     TRUE if a value has been written, FALSE if the channel is empty
+ */
+uint8_t channel_read(channel_t *Channel, void *Value);
+
+/**
+ * @brief      Copies the latest value if it is newer than the one the caller
+ *             read last, as xQueueReceive on a length-1 queue for a single
+ *             reader.
+ *
+ * @param      Channel       The channel
+ * @param      Value         Where to copy the value, Channel->size bytes
+ * @param      lastSequence  The number of the last value read, updated. Start
+ *                           at 0.
+ *
+ * @return     TRUE if there was a new value, FALSE if not
+ */
+uint8_t channel_read_new(channel_t *Channel, void *Value, uint32_t *lastSequence);
+
+#endif /* CHANNEL_H_ */
@@ -27,12 +27,13 @@ extern SemaphoreHandle_t xCommandReadyBSem;
 arq_connection server_connection;
 uint8_t connected = 0;
 
-uint8_t use_arq[12] = { 
+uint8_t use_arq[14] = { 
   [TYPE_HANDSHAKE] = 1,
   [TYPE_UPDATE] = 0, 
   [TYPE_IDLE] = 1, 
   [TYPE_PING_RESPONSE] = 0, 
   [TYPE_LINE] = 0,
+  [TYPE_GRID] = 0,
   [TYPE_DEBUG] = 0
 };
 
@@ -83,8 +84,22 @@ void vMainCommunicationTask( void *pvParameters )
 						(float) command_in.message.order.x * 10,
 						(float) command_in.message.order.y * 10
 					};
-					// Relay new coordinates to position controller.
-					xQueueOverwrite(poseControllerQ, &Target);
+					// Replace the route with the new coordinates.
+					xQueueReset(poseControllerQ);
+					xQueueSendToBack(poseControllerQ, &Target, 0);
+					}
+					break;
+				case TYPE_ORDER_MULTI: {
+					// Append the waypoints to the route, the ones that do not fit are dropped.
+					uint8_t count = command_in.message.order_multi.count;
+					if (count > ORDER_MULTI_MAX_POINTS) count = ORDER_MULTI_MAX_POINTS;
+					for (uint8_t i = 0; i < count; i++) {
+						point_t Waypoint = {
+							(float) command_in.message.order_multi.points[i].x * 10,
+							(float) command_in.message.order_multi.points[i].y * 10
+						};
+						xQueueSendToBack(poseControllerQ, &Waypoint, 0);
+					}
 					}
 					break;
 				case TYPE_PAUSE:
@@ -191,6 +206,20 @@ void send_line(int16_t x, int16_t y, uint16_t heading, line_t line) {
 	else simple_p_send(SERVER_ADDRESS, data, sizeof(data));
 }
 
+void send_grid(uint8_t row, uint8_t column, int8_t *cells) {
+	if (!connected) return;
+	message_t msg;
+	msg.type = TYPE_GRID;
+	msg.message.grid.row = row;
+	msg.message.grid.column = column;
+	memcpy(msg.message.grid.cells, cells, GRID_CELLS_PER_MESSAGE);
+
+	uint8_t data[sizeof(grid_message_t)+1];
+	memcpy(data, (uint8_t*) &msg, sizeof(data));
+	if(use_arq[TYPE_GRID]) arq_send(server_connection, data, sizeof(data));
+	else simple_p_send(SERVER_ADDRESS, data, sizeof(data));
+}
+
 /*
 void debug(const char *fmt, ...) {
 	uint8_t buf[100];
@@ -217,7 +246,8 @@ void server_receiver(uint8_t *data, uint16_t len) {
   if(data == NULL) { // ARQ passes NULL to the callback when connection is lost
       gHandshook = 0;
   }
-  memcpy(&message_in, data, len);
+  if(len > sizeof(message_t)) len = sizeof(message_t);
+  memcpy((void*)&message_in, data, len);
   
   xSemaphoreGive(xCommandReadyBSem);
 }
\ No newline at end of file
@@ -89,6 +89,16 @@ void send_idle(void);
  */
 void send_line(int16_t x, int16_t y, uint16_t heading, line_t line);
 
+/**
+ * @brief      Sends GRID_CELLS_PER_MESSAGE cells of one row of the occupancy
+ *             grid to the server.
+ *
+ * @param[in]  row     The row of the cells
+ * @param[in]  column  The column of the first cell
+ * @param      cells   The log-odds of the cells
+ */
+void send_grid(uint8_t row, uint8_t column, int8_t *cells);
+
 /**
  * @brief      Callback function passed to the simple protocol init in main.
  *
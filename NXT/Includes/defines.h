@@ -18,7 +18,7 @@
 /* PHYSICAL CONSTANTS - If the robot is changed these need to be changed
  Some of these will be sent to server during the start-up-handshake
  Wheel factor is the circumference divided by ticks per rotation
- -> pi*56/360 = 0.48mm Length the robot travels per tick              */
+ -> pi*56/720 = 0.24mm Length the robot travels per tick              */
 #define WHEELBASE_MM             170  /* Length between wheel centers  */
 #define ROBOT_TOTAL_WIDTH_MM     195 /* From outer rim to outer rim   */
 #define ROBOT_TOTAL_LENGTH_MM    175 /* From front to aft, total      */
@@ -33,7 +33,7 @@
 #define SENSOR4_HEADING_DEG      270
 #define NUMBER_OF_SENSORS		 4
 
-#define WHEEL_FACTOR_MM 0.469   /* Calculated, measured   */
+#define WHEEL_FACTOR_MM 0.2345f /* Calculated, measured, per quadrature edge */
 
 /************************************************************************/
 /* Program settings                                                     */
@@ -41,6 +41,21 @@
 #define PERIOD_MOTOR_MS         20
 #define PERIOD_ESTIMATOR_MS     40
 #define PERIOD_SENSORS_MS       200
+#define EKF_DISTANCE_VARIANCE   0.5f   /* [mm^2 per mm] Odometry distance noise     */
+#define EKF_INITIAL_VARIANCE    1.0f   /* Covariance diagonal at start            */
+#define POSE_HISTORY_SIZE       32     /* Poses kept, 1.28 s at PERIOD_ESTIMATOR_MS */
+#define POSE_HISTORY_WAIT_MS    (2 * PERIOD_ESTIMATOR_MS) /* Longest wait for the estimate after a reading */
+#define WAYPOINT_QUEUE_SIZE     16     /* Waypoints queued for the pose controller */
+#define MOTION_ACCELERATION     250    /* [mm/s^2] Limit on the forward speed, below wheel slip */
+#define MOTION_TURN_ACCELERATION 150   /* [mm/s^2] Limit on the wheel speed difference from turning */
+#define MOTION_JERK             3000   /* [mm/s^3] Limit on the change of both accelerations */
+#define TOWER_MIN_STEP_DEG      2      /* Tower step when standing still             */
+#define TOWER_MAX_STEP_DEG      15
+#define TOWER_STEP_SPEED        50     /* [mm/s] Robot speed per degree added to the step */
+#define TOWER_SETTLE_MARGIN_MS  50     /* IR sensor update after the tower has settled */
+#define TOWER_MIN_PERIOD_MS     80     /* Leaves time to send the previous update     */
+#define TOWER_SETTLE_TIMEOUT_MS 700    /* Give up waiting for the tower after this, the 30 degree diagonal takes ~560 ms */
+#define ORDER_MULTI_MAX_POINTS  8      /* Waypoints in one TYPE_ORDER_MULTI message */
 #define moveStop                0
 #define moveForward             1
 #define moveBackward            2
@@ -60,20 +75,38 @@
 /************************************************************************/
 /* Macros                                                               */
 #define M_PI 3.14159265358979323846
-#define DEG2RAD M_PI / 180.0
-#define RAD2DEG 180.0 / M_PI
+#define M_PI_F 3.14159265358979323846f // M_PI in single precision
+#define DEG2RAD (M_PI_F / 180.0f)
+#define RAD2DEG (180.0f / M_PI_F)
 #define ROUND(x) ((x)>=0?(long)((x)+0.5):(long)((x)-0.5))
 
 /************************************************************************/
 /* Mapping defines */
 #define PB_SIZE 				50
 #define LB_SIZE					50
-#define L_SIZE          		50
+#define L_SIZE          		200
 #define MAX_IR_DISTANCE			40	// [cm]
 
-#define COLLINEAR_TOLERANCE		15	// [cm]
-#define MU 						0.3 // slope
+#define LINE_FIT_TOLERANCE		3	// [cm] Max distance of a new point from the fitted line
+#define LINE_FIT_MAX_RESIDUAL	1.5f	// [cm] Max RMS distance of all points from the line
+#define LINE_FIT_MAX_GAP		10	// [cm] Max distance between neighbouring points on a line
+#define LINE_FIT_MIN_POINTS		3
+#define MU 						0.3f // [rad] Max angle between mergeable lines
 #define DELTA					10 	// [cm]
+#define LINE_INDEX_BUCKETS		256	// Must be a power of two, at most 256
+#define LINE_INDEX_ANGLE_BINS	((int8_t) (M_PI_F / MU))	// floor(pi / MU), so each bin is at least MU wide. MU must be above pi / 127
+
+/* Occupancy grid defines, 80x80 cells of 5 cm covers 4x4 m in 6400 bytes */
+#define GRID_CELL_SIZE_CM		5	// [cm]
+#define GRID_WIDTH				80	// [cells]
+#define GRID_HEIGHT				80	// [cells]
+#define GRID_ORIGIN_X			40	// Cell containing the start position
+#define GRID_ORIGIN_Y			40
+#define LOG_ODDS_HIT			12	// Added to the cell a beam ends in
+#define LOG_ODDS_MISS			-4	// Added to the cells a beam passes
+#define LOG_ODDS_MAX			100
+#define LOG_ODDS_MIN			-100
+#define GRID_CELLS_PER_MESSAGE	40	// Cells in one TYPE_GRID message, half a row
 
 /************************************************************************/
 /* Communication defines */
@@ -89,6 +122,8 @@
 #define TYPE_PING_RESPONSE  9
 #define TYPE_LINE           10
 #define TYPE_DEBUG          11
+#define TYPE_ORDER_MULTI    12
+#define TYPE_GRID           13
 
 #define SERVER_ADDRESS       0
 
@@ -97,8 +132,13 @@
 //#define COMPASS_CALIBRATE		// Compass calibration task
 //#define SENSOR_CALIBRATE		// Sensor calibration task
 //#define MAPPING 				// Mapping task
+//#define OCCUPANCY_GRID 		// Occupancy grid instead of line segments in mapping task
 //#define SEND_LINE 			// Sending of lines to server in mapping task
+//#define SEND_GRID 			// Sending of the occupancy grid to server in mapping task
 #define SEND_UPDATE			  // Sending of IR data to server in sensor tower task
+//#define FIXED_POINT_MATH		// Q16.16 trig and square roots in the estimator, controller and mapper
+//#define TASK_LOAD_STATS		// Busy time of the 1 kHz task in gTask1000HzLoad
+//#define HEAP_STATS			// Lowest free FreeRTOS heap seen in gHeapMinimumFree
 //#define MANUAL				// Manual drive mode
 
 #endif /* DEFINES_H_ */
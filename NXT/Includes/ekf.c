@@ -0,0 +1,123 @@
+#include "ekf.h"
+
+/* Kernel includes */
+#include "FreeRTOS.h"
+
+#include <stdint.h>
+#include <math.h>
+
+#include "defines.h"
+#include "functions.h"
+
+/* C = A * B */
+static void ekf_mul(const matrix3_t *A, const matrix3_t *B, matrix3_t *C) {
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = 0; j < 3; j++) {
+			C->m[i][j] = A->m[i][0] * B->m[0][j] + A->m[i][1] * B->m[1][j] + A->m[i][2] * B->m[2][j];
+		}
+	}
+}
+
+/* Averages P with its transpose, rounding errors would otherwise break the symmetry */
+static void ekf_symmetrize(matrix3_t *P) {
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = i + 1; j < 3; j++) {
+			float mean = 0.5f * (P->m[i][j] + P->m[j][i]);
+			P->m[i][j] = mean;
+			P->m[j][i] = mean;
+		}
+	}
+}
+
+void ekf_init(ekf_t *Filter) {
+	configASSERT(Filter);
+
+	*Filter = (ekf_t) { 0 };
+	for (uint8_t i = 0; i < 3; i++)
+		Filter->P.m[i][i] = EKF_INITIAL_VARIANCE;
+}
+
+void ekf_predict(ekf_t *Filter, float dDistance, float dTheta, float varDistance, float varTheta) {
+	configASSERT(Filter);
+
+	// The robot is assumed to move along the heading halfway through the turn
+	float phi = Filter->Pose.theta + 0.5f * dTheta;
+	float c = func_cos(phi);
+	float s = func_sin(phi);
+
+	Filter->Pose.x += dDistance * c;
+	Filter->Pose.y += dDistance * s;
+	Filter->Pose.theta += dTheta;
+	vFunc_Inf2pi(&Filter->Pose.theta);
+
+	// Jacobian of the motion model with respect to the state
+	matrix3_t F = { {
+		{ 1, 0, -dDistance * s },
+		{ 0, 1,  dDistance * c },
+		{ 0, 0,  1 }
+	} };
+
+	// P = F P F^T
+	matrix3_t FP, FPFt;
+	ekf_mul(&F, &Filter->P, &FP);
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = 0; j < 3; j++) {
+			FPFt.m[i][j] = FP.m[i][0] * F.m[j][0] + FP.m[i][1] * F.m[j][1] + FP.m[i][2] * F.m[j][2];
+		}
+	}
+
+	// + G M G^T, with the Jacobian G with respect to (dDistance, dTheta) and
+	// the input noise M = diag(varDistance, varTheta)
+	float G[3][2] = {
+		{ c, -0.5f * dDistance * s },
+		{ s,  0.5f * dDistance * c },
+		{ 0,  1 }
+	};
+
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = 0; j < 3; j++) {
+			Filter->P.m[i][j] = FPFt.m[i][j] + G[i][0] * G[j][0] * varDistance + G[i][1] * G[j][1] * varTheta;
+		}
+	}
+
+	ekf_symmetrize(&Filter->P);
+}
+
+float ekf_heading_innovation(ekf_t *Filter, float heading) {
+	configASSERT(Filter);
+
+	float innovation = heading - Filter->Pose.theta;
+	vFunc_Inf2pi(&innovation);
+	return innovation;
+}
+
+float ekf_update_heading(ekf_t *Filter, float heading, float variance) {
+	configASSERT(Filter);
+
+	float innovation = ekf_heading_innovation(Filter, heading);
+
+	// H = [0 0 1], so S = P[2][2] + R and K = P[:][2] / S
+	float S = Filter->P.m[EKF_THETA][EKF_THETA] + variance;
+	if (S <= 0)
+		return innovation;
+
+	float K[3];
+	for (uint8_t i = 0; i < 3; i++)
+		K[i] = Filter->P.m[i][EKF_THETA] / S;
+
+	Filter->Pose.x += K[EKF_X] * innovation;
+	Filter->Pose.y += K[EKF_Y] * innovation;
+	Filter->Pose.theta += K[EKF_THETA] * innovation;
+	vFunc_Inf2pi(&Filter->Pose.theta);
+
+	// P = (I - K H) P, the row of theta is subtracted from every row
+	float thetaRow[3] = { Filter->P.m[EKF_THETA][0], Filter->P.m[EKF_THETA][1], Filter->P.m[EKF_THETA][2] };
+	for (uint8_t i = 0; i < 3; i++) {
+		for (uint8_t j = 0; j < 3; j++) {
+			Filter->P.m[i][j] -= K[i] * thetaRow[j];
+		}
+	}
+
+	ekf_symmetrize(&Filter->P);
+	return innovation;
+}
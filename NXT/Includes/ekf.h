@@ -0,0 +1,69 @@
+/************************************************************************/
+// File:			ekf.h
+//
+// Extended Kalman filter over the pose (x, y, theta) of the robot. The
+// covariance is a fixed 3x3 matrix in an ekf_t, so the filter never
+// allocates memory.
+//
+// The prediction step integrates one odometry increment, a travelled
+// distance and a change of heading, with the midpoint model used by the
+// pose estimator. The update step corrects the heading with an absolute
+// measurement, such as the compass.
+//
+/************************************************************************/
+
+#ifndef EKF_H_
+#define EKF_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define EKF_X				0
+#define EKF_Y				1
+#define EKF_THETA			2
+
+/**
+ * @brief      Puts the filter at the origin with heading 0, and
+ *             EKF_INITIAL_VARIANCE on the diagonal of the covariance.
+ *
+ * @param      Filter  The filter
+ */
+void ekf_init(ekf_t *Filter);
+
+/**
+ * @brief      Moves the pose by one odometry increment, and grows the
+ *             covariance with the Jacobians of the motion model.
+ *
+ * @param      Filter       The filter
+ * @param[in]  dDistance    Distance travelled by the robot centre [mm]
+ * @param[in]  dTheta       Change of heading [rad]
+ * @param[in]  varDistance  Variance of dDistance [mm^2]
+ * @param[in]  varTheta     Variance of dTheta [rad^2]
+ */
+void ekf_predict(ekf_t *Filter, float dDistance, float dTheta, float varDistance, float varTheta);
+
+/**
+ * @brief      Corrects the pose with a measurement of the absolute heading.
+ *
+ * @param      Filter    The filter
+ * @param[in]  heading   The measured heading [rad]
+ * @param[in]  variance  Variance of the measurement [rad^2]
+ *
+ * @return     The innovation, the measured minus the predicted heading
+ *             wrapped to [-pi,pi] [rad]
+ */
+float ekf_update_heading(ekf_t *Filter, float heading, float variance);
+
+/**
+ * @brief      The innovation a heading measurement would give, without
+ *             applying it. Lets the caller gate outliers.
+ *
+ * @param      Filter   The filter
+ * @param[in]  heading  The measured heading [rad]
+ *
+ * @return     The innovation [rad]
+ */
+float ekf_heading_innovation(ekf_t *Filter, float heading);
+
+#endif /* EKF_H_ */
@@ -0,0 +1,208 @@
+#include "fixed_point.h"
+
+#include <stdint.h>
+
+/* sin over [0,pi/2] in 256 steps, with the end point */
+static const fix16_t fix16_sin_table[257] = {
+	0, 402, 804, 1206, 1608, 2010, 2412, 2814,
+	3216, 3617, 4019, 4420, 4821, 5222, 5623, 6023,
+	6424, 6824, 7224, 7623, 8022, 8421, 8820, 9218,
+	9616, 10014, 10411, 10808, 11204, 11600, 11996, 12391,
+	12785, 13180, 13573, 13966, 14359, 14751, 15143, 15534,
+	15924, 16314, 16703, 17091, 17479, 17867, 18253, 18639,
+	19024, 19409, 19792, 20175, 20557, 20939, 21320, 21699,
+	22078, 22457, 22834, 23210, 23586, 23961, 24335, 24708,
+	25080, 25451, 25821, 26190, 26558, 26925, 27291, 27656,
+	28020, 28383, 28745, 29106, 29466, 29824, 30182, 30538,
+	30893, 31248, 31600, 31952, 32303, 32652, 33000, 33347,
+	33692, 34037, 34380, 34721, 35062, 35401, 35738, 36075,
+	36410, 36744, 37076, 37407, 37736, 38064, 38391, 38716,
+	39040, 39362, 39683, 40002, 40320, 40636, 40951, 41264,
+	41576, 41886, 42194, 42501, 42806, 43110, 43412, 43713,
+	44011, 44308, 44604, 44898, 45190, 45480, 45769, 46056,
+	46341, 46624, 46906, 47186, 47464, 47741, 48015, 48288,
+	48559, 48828, 49095, 49361, 49624, 49886, 50146, 50404,
+	50660, 50914, 51166, 51417, 51665, 51911, 52156, 52398,
+	52639, 52878, 53114, 53349, 53581, 53812, 54040, 54267,
+	54491, 54714, 54934, 55152, 55368, 55582, 55794, 56004,
+	56212, 56418, 56621, 56823, 57022, 57219, 57414, 57607,
+	57798, 57986, 58172, 58356, 58538, 58718, 58896, 59071,
+	59244, 59415, 59583, 59750, 59914, 60075, 60235, 60392,
+	60547, 60700, 60851, 60999, 61145, 61288, 61429, 61568,
+	61705, 61839, 61971, 62101, 62228, 62353, 62476, 62596,
+	62714, 62830, 62943, 63054, 63162, 63268, 63372, 63473,
+	63572, 63668, 63763, 63854, 63944, 64031, 64115, 64197,
+	64277, 64354, 64429, 64501, 64571, 64639, 64704, 64766,
+	64827, 64884, 64940, 64993, 65043, 65091, 65137, 65180,
+	65220, 65259, 65294, 65328, 65358, 65387, 65413, 65436,
+	65457, 65476, 65492, 65505, 65516, 65525, 65531, 65535,
+	65536,
+};
+
+/* atan(2^-i) for the CORDIC iterations */
+static const fix16_t fix16_atan_table[16] = {
+	51472, 30386, 16055, 8150, 4091, 2047, 1024, 512,
+	256, 128, 64, 32, 16, 8, 4, 2
+};
+
+/* Table steps per radian for the full circle of 1024 steps, in Q16 */
+#define FIX16_SIN_STEPS_PER_RAD		10680707
+
+/* Magnitude of a fixed-point number, also for INT32_MIN */
+static uint32_t fix16_abs(fix16_t x) {
+	return (x < 0) ? 0u - (uint32_t) x : (uint32_t) x;
+}
+
+static uint32_t fix16_isqrt64(uint64_t num) {
+	uint64_t res = 0;
+	uint64_t bit = (uint64_t) 1 << 62;
+
+	while (bit > num)
+		bit >>= 2;
+
+	while (bit) {
+		if (num >= res + bit) {
+			num -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (uint32_t) res;
+}
+
+fix16_t fix16_mul(fix16_t a, fix16_t b) {
+	return (fix16_t) (((int64_t) a * b) >> 16);
+}
+
+fix16_t fix16_div(fix16_t a, fix16_t b) {
+	if (b == 0)
+		return (a >= 0) ? INT32_MAX : INT32_MIN;
+
+	return (fix16_t) (((int64_t) a * 65536) / b);
+}
+
+fix16_t fix16_sin(fix16_t angle) {
+	fix16_wrap_to_2pi(&angle);
+
+	// Position on the circle in table steps, 16 fractional bits
+	uint32_t pos = (uint32_t) (((uint64_t) angle * FIX16_SIN_STEPS_PER_RAD) >> 16);
+	uint16_t step = (pos >> 16) & 1023;
+	int32_t frac = pos & 0xFFFF;
+
+	uint8_t quadrant = step >> 8;
+	uint16_t i = step & 255;
+	fix16_t a, b;
+
+	// The second and fourth quadrant run through the table backwards
+	if (quadrant & 1) {
+		a = fix16_sin_table[256 - i];
+		b = fix16_sin_table[255 - i];
+	} else {
+		a = fix16_sin_table[i];
+		b = fix16_sin_table[i + 1];
+	}
+
+	fix16_t value = a + (fix16_t) (((int64_t) (b - a) * frac) >> 16);
+	return (quadrant & 2) ? -value : value;
+}
+
+fix16_t fix16_cos(fix16_t angle) {
+	// Wrap first, so adding a quarter turn cannot overflow
+	fix16_wrap_to_2pi(&angle);
+	return fix16_sin(angle + FIX16_HALF_PI);
+}
+
+fix16_t fix16_atan2(fix16_t y, fix16_t x) {
+	if (x == 0 && y == 0)
+		return 0;
+
+	// Scale the vector to about 2^28, leaving headroom for the CORDIC gain.
+	// The magnitudes are scaled, as shifting negative values is undefined
+	uint32_t ux = fix16_abs(x);
+	uint32_t uy = fix16_abs(y);
+	while (ux >= (1u << 29) || uy >= (1u << 29)) {
+		ux >>= 1;
+		uy >>= 1;
+	}
+	while (ux < (1u << 27) && uy < (1u << 27)) {
+		ux <<= 1;
+		uy <<= 1;
+	}
+	x = (x < 0) ? -(fix16_t) ux : (fix16_t) ux;
+	y = (y < 0) ? -(fix16_t) uy : (fix16_t) uy;
+
+	// CORDIC converges for vectors in the right half plane
+	fix16_t angle = 0;
+	if (x < 0) {
+		angle = (y >= 0) ? FIX16_PI : -FIX16_PI;
+		x = -x;
+		y = -y;
+	}
+
+	for (uint8_t i = 0; i < 16; i++) {
+		fix16_t xNext;
+		if (y > 0) {
+			xNext = x + (y >> i);
+			y -= x >> i;
+			angle += fix16_atan_table[i];
+		} else {
+			xNext = x - (y >> i);
+			y += x >> i;
+			angle -= fix16_atan_table[i];
+		}
+		x = xNext;
+	}
+
+	fix16_inf2pi(&angle);
+	return angle;
+}
+
+fix16_t fix16_sqrt(fix16_t a) {
+	if (a <= 0)
+		return 0;
+
+	return (fix16_t) fix16_isqrt64((uint64_t) a << 16);
+}
+
+void fix16_inf2pi(fix16_t *angle_in_radians) {
+	fix16_t angle = *angle_in_radians % FIX16_TWO_PI;
+
+	if (angle > FIX16_PI) angle -= FIX16_TWO_PI;
+	else if (angle < -FIX16_PI) angle += FIX16_TWO_PI;
+
+	*angle_in_radians = angle;
+}
+
+void fix16_wrap_to_2pi(fix16_t *angle_in_radians) {
+	fix16_t angle = *angle_in_radians % FIX16_TWO_PI;
+
+	if (angle < 0) angle += FIX16_TWO_PI;
+
+	*angle_in_radians = angle;
+}
+
+fix_point_t fix16_polar2cart(fix16_t theta, fix16_t r) {
+	fix16_t x = fix16_mul(r, fix16_cos(theta));
+	fix16_t y = fix16_mul(r, fix16_sin(theta));
+	return (fix_point_t) { x, y };
+}
+
+fix16_t fix16_distance_between(fix_point_t *Pos1, fix_point_t *Pos2) {
+	int64_t dx = (int64_t) Pos1->x - Pos2->x;
+	int64_t dy = (int64_t) Pos1->y - Pos2->y;
+	uint64_t ux = (uint64_t) (dx < 0 ? -dx : dx);
+	uint64_t uy = (uint64_t) (dy < 0 ? -dy : dy);
+
+	// Points more than 32768 apart in x or y are further apart than a fix16_t
+	// can hold, and their squares could overflow
+	if (ux > INT32_MAX || uy > INT32_MAX)
+		return INT32_MAX;
+
+	// Sum of squares in Q32, below 2^63, its square root is in Q16
+	uint32_t distance = fix16_isqrt64(ux * ux + uy * uy);
+
+	return (distance > INT32_MAX) ? INT32_MAX : (fix16_t) distance;
+}
@@ -0,0 +1,97 @@
+/************************************************************************/
+// File:			fixed_point.h
+//
+// Q16.16 fixed-point math for the tasks that would otherwise spend their
+// time in soft-float emulation, the AT91SAM7S has no FPU. A fix16_t holds
+// a signed value with 16 integer and 16 fractional bits, so the range is
+// about +-32767 with a resolution of 1.5e-5.
+//
+// sin and cos are read from a quarter wave table with linear interpolation,
+// atan2 is 16 iterations of CORDIC and sqrt is bitwise integer square root.
+// Angles are in radians.
+//
+// The float functions in functions.c use these when FIXED_POINT_MATH is
+// defined.
+//
+/************************************************************************/
+
+#ifndef FIXED_POINT_H_
+#define FIXED_POINT_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define FIX16_ONE				65536
+#define FIX16_PI				205887
+#define FIX16_HALF_PI			102944
+#define FIX16_TWO_PI			411775
+
+#define FIX16_FROM_INT(x)		((fix16_t) (x) * FIX16_ONE)
+#define FIX16_FROM_FLOAT(x)		((fix16_t) ((x) >= 0 ? (x) * 65536.0f + 0.5f : (x) * 65536.0f - 0.5f))
+#define FIX16_TO_FLOAT(x)		((float) (x) * (1.0f / 65536.0f))
+
+/**
+ * @brief      Multiplies two fixed-point numbers.
+ */
+fix16_t fix16_mul(fix16_t a, fix16_t b);
+
+/**
+ * @brief      Divides two fixed-point numbers. Saturates on division by zero.
+ */
+fix16_t fix16_div(fix16_t a, fix16_t b);
+
+/**
+ * @brief      Sine of an angle.
+ *
+ * @param[in]  angle  The angle [rad]
+ *
+ * @return     sin(angle)
+ */
+fix16_t fix16_sin(fix16_t angle);
+
+/**
+ * @brief      Cosine of an angle.
+ *
+ * @param[in]  angle  The angle [rad]
+ *
+ * @return     cos(angle)
+ */
+fix16_t fix16_cos(fix16_t angle);
+
+/**
+ * @brief      Angle of the vector (x, y), as atan2 in math.h.
+ *
+ * @return     The angle in [-pi,pi] [rad]
+ */
+fix16_t fix16_atan2(fix16_t y, fix16_t x);
+
+/**
+ * @brief      Square root. Negative numbers give 0.
+ */
+fix16_t fix16_sqrt(fix16_t a);
+
+/**
+ * @brief      Wraps an angle into [-pi,pi], as vFunc_Inf2pi.
+ */
+void fix16_inf2pi(fix16_t *angle_in_radians);
+
+/**
+ * @brief      Wraps an angle into [0,2pi), as func_wrap_to_2pi.
+ */
+void fix16_wrap_to_2pi(fix16_t *angle_in_radians);
+
+/**
+ * @brief      Converts polar coordinates to cartesian, as func_polar2cart.
+ */
+fix_point_t fix16_polar2cart(fix16_t theta, fix16_t r);
+
+/**
+ * @brief      Distance between two points, as func_distance_between. The
+ *             squares are summed in 64 bits, so the result is rounded down to
+ *             the nearest step while the distance is below 32768. Points
+ *             further apart give the largest fix16_t.
+ */
+fix16_t fix16_distance_between(fix_point_t *Pos1, fix_point_t *Pos2);
+
+#endif /* FIXED_POINT_H_ */
@@ -11,21 +11,65 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "defines.h"
+#include "fixed_point.h"
+
+
+/* 2pi split in two floats. TWO_PI_HI has 9 significant bits, so k * TWO_PI_HI
+is exact for |k| < 2^15 and the low bits of the angle survive the
+subtraction. Angles beyond WRAP_LIMIT, and inf and NaN, go through fmod in
+double, which is slow but exact. */
+#define TWO_PI_HI       6.28125f
+#define TWO_PI_LO       1.93530717958647692e-3f
+#define INV_TWO_PI      0.159154943f
+#define WRAP_LIMIT      2.0e5f
 
 /* Take any angle and put it inside -pi,pi */
 void vFunc_Inf2pi(float *angle_in_radians){
-    do{
-        if (*angle_in_radians > M_PI) *angle_in_radians -= 2*M_PI;
-        else if (*angle_in_radians < -M_PI) *angle_in_radians += 2*M_PI;
-    } while (fabs(*angle_in_radians) > M_PI);
+    float angle = *angle_in_radians;
+
+    // Most angles are already inside
+    if (fabsf(angle) <= M_PI_F)
+        return;
+
+    if (!(fabsf(angle) < WRAP_LIMIT))
+        angle = (float) fmod(angle, 6.283185307179586);
+
+    // Subtract the nearest multiple of 2pi, the same work for any angle
+    float turns = angle * INV_TWO_PI;
+    int32_t k = (int32_t) turns;
+    k += (turns - k > 0.5f) - (turns - k < -0.5f);
+
+    angle = (angle - k * TWO_PI_HI) - k * TWO_PI_LO;
+
+    // turns is rounded, so k can be one off
+    angle -= (angle > M_PI_F) * (2 * M_PI_F);
+    angle += (angle < -M_PI_F) * (2 * M_PI_F);
+
+    *angle_in_radians = angle;
 }
 
 /* Wrap any angle in radians into the interval [0,2pi) */
 void func_wrap_to_2pi(float *angle_in_radians) {
-    do {
-        if (*angle_in_radians >= 2*M_PI) *angle_in_radians -= 2*M_PI;
-        else if (*angle_in_radians < 0) *angle_in_radians += 2*M_PI;
-    } while (fabs(*angle_in_radians) >= 2*M_PI);
+    float angle = *angle_in_radians;
+
+    if (angle >= 0 && angle < 2 * M_PI_F)
+        return;
+
+    if (!(fabsf(angle) < WRAP_LIMIT))
+        angle = (float) fmod(angle, 6.283185307179586);
+
+    // Subtract the multiple of 2pi below the angle
+    float turns = angle * INV_TWO_PI;
+    int32_t k = (int32_t) turns;
+    k -= (turns < k);
+
+    angle = (angle - k * TWO_PI_HI) - k * TWO_PI_LO;
+
+    angle += (angle < 0) * (2 * M_PI_F);
+    angle -= (angle >= 2 * M_PI_F) * (2 * M_PI_F);
+
+    *angle_in_radians = angle;
 }
 
 /* Parse the update message from uart by using tokens */
@@ -158,22 +202,70 @@ void reverse(char s[])
     }
 }
 
+float func_sin(float angle) {
+#ifdef FIXED_POINT_MATH
+    return FIX16_TO_FLOAT(fix16_sin(FIX16_FROM_FLOAT(angle)));
+#else
+    return sinf(angle);
+#endif
+}
+
+float func_cos(float angle) {
+#ifdef FIXED_POINT_MATH
+    return FIX16_TO_FLOAT(fix16_cos(FIX16_FROM_FLOAT(angle)));
+#else
+    return cosf(angle);
+#endif
+}
+
+float func_atan2(float y, float x) {
+#ifdef FIXED_POINT_MATH
+    // Infinite or NaN input can not be scaled into range
+    if (!isfinite(x) || !isfinite(y))
+        return 0.0f;
+
+    // Only the direction matters, so scale both down into the fixed-point range
+    while (fabsf(x) >= 32767.0f || fabsf(y) >= 32767.0f) {
+        x *= 0.5f;
+        y *= 0.5f;
+    }
+    return FIX16_TO_FLOAT(fix16_atan2(FIX16_FROM_FLOAT(y), FIX16_FROM_FLOAT(x)));
+#else
+    return atan2f(y, x);
+#endif
+}
+
 point_t func_polar2cart(float theta, float r) {
-    float x = r * cos(theta);
-    float y = r * sin(theta);
+    float x = r * func_cos(theta);
+    float y = r * func_sin(theta);
     return (point_t) { x, y };
 }
 
-float func_get_slope(line_t *Line) {
-    return (Line->Q.y - Line->P.y) / (Line->Q.x - Line->P.x);
+line_t func_line_from_points(point_t P, point_t Q, float residual) {
+    float dx = Q.x - P.x;
+    float dy = Q.y - P.y;
+
+    // The normal (-dy, dx) is folded into [0,pi), flipping the sign of rho
+    float theta = func_atan2(dx, -dy);
+    if (theta < 0) theta += M_PI_F;
+    if (theta >= M_PI_F) theta -= M_PI_F;
+
+    float rho = P.x * func_cos(theta) + P.y * func_sin(theta);
+    return (line_t) { P, Q, residual, theta, rho, sqrtf(dx * dx + dy * dy) };
 }
 
 float func_distance_between(point_t *Pos1, point_t *Pos2) {
-    return sqrt( pow(Pos1->x - Pos2->x, 2) + pow(Pos1->y - Pos2->y, 2) );
+#ifdef FIXED_POINT_MATH
+    fix_point_t P1 = { FIX16_FROM_FLOAT(Pos1->x), FIX16_FROM_FLOAT(Pos1->y) };
+    fix_point_t P2 = { FIX16_FROM_FLOAT(Pos2->x), FIX16_FROM_FLOAT(Pos2->y) };
+    return FIX16_TO_FLOAT(fix16_distance_between(&P1, &P2));
+#else
+    return sqrtf(func_distance_squared(Pos1, Pos2));
+#endif
 }
 
-point_t func_get_projected_point(point_t P, float a, float b) {
-    float x = (P.x + a * P.y - a * b) / (1 + pow(a, 2));
-    float y = (a * P.x + pow(a, 2) * P.y + b) / (1 + pow(a, 2));
-    return (point_t) { x, y };
+float func_distance_squared(point_t *Pos1, point_t *Pos2) {
+    float dx = Pos1->x - Pos2->x;
+    float dy = Pos1->y - Pos2->y;
+    return dx * dx + dy * dy;
 }
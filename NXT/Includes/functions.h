@@ -37,14 +37,22 @@ void itoa(int n, char s[]);
 
 void reverse(char s[]);
 
+/* Trig for the hot tasks, in Q16.16 fixed-point when FIXED_POINT_MATH is defined */
+float func_sin(float angle);
+
+float func_cos(float angle);
+
+float func_atan2(float y, float x);
+
 point_t func_polar2cart(float theta, float r);
 
-float func_get_slope(line_t *Line);
+/* Create a line segment between P and Q, with its normal form and length */
+line_t func_line_from_points(point_t P, point_t Q, float residual);
 
 float func_distance_between(point_t *Pos1, point_t *Pos2);
 
-int8_t vFunc_isMergeable(line_t *Line1, line_t *Line2);
+float func_distance_squared(point_t *Pos1, point_t *Pos2);
 
-point_t func_get_projected_point(point_t P, float a, float b);
+int8_t vFunc_isMergeable(line_t *Line1, line_t *Line2);
 
 #endif /* FUNCTIONS_H_ */
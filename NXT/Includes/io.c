@@ -9,6 +9,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "cobs.h"
 #include "io.h"
@@ -17,12 +18,30 @@
 #include "task.h"
 #include "display.h"
 #include "semphr.h"
+#include "timers.h"
 #include "crc.h"
 #include "functions.h"
 #include "hs.h"
 #include "network.h"
 
-#define BUFFER_SIZE 128
+#define BUFFER_SIZE 132         // Type, tag and CRC around the 128 bytes of a bluetooth response
+#define BURST_SIZE 64           // hs_write sends up to 64 bytes at a time
+#define BURST_ACK_SIZE 5        // A tagged RECEIVE_BT or ALIVE_TEST with its delimiter, asks for an answer at the end of a burst
+#define MAX_OUTSTANDING 4       // Requests waiting for a response at the same time
+#define REPLY_TIMEOUT_MS 20
+#define SENSOR_PERIOD_MS 30     // The estimator task runs every 30 ms, and should have updated values every time
+#define SUBSCRIBE_TIMEOUT_MS (3*SENSOR_PERIOD_MS) // Subscribe again if no sensor data has been pushed for this long
+#define PUSH_GUARD_MS 6         // Don't start a burst this close to the next sensor push. Covers sampling, the push itself and the tick it is read in
+#define BLUETOOTH_PERIOD_MS 50
+// Events in the notification value of the io task
+#define IO_NOTIFY_RX 0x01          // A burst has been received, set by the RS485 interrupt
+#define IO_NOTIFY_SEND 0x02        // A message has been queued
+#define IO_NOTIFY_SENSORS 0x04     // Check that sensor data is still pushed
+#define IO_NOTIFY_BLUETOOTH 0x08   // Ask for stored bluetooth data
+#define CLOCK_WINDOW 32         // Samples in each window of the clock mapping, about one second of pushes
+#define CLOCK_WINDOWS 8         // Windows the rate of the IO-microcontroller tick is measured over
+#define CLOCK_RESET_MS 200      // A sample this far off the mapping means the IO-microcontroller has been reset
+#define IO_TICKS_PER_SLIP 576    // Timer 0 of the IO-microcontroller at 7.3728 MHz / 64 / 115 ticks 576 times in 575 ms
 
 //Ditance sensors calibration
 uint8_t voltage_to_cm[4][256]={
@@ -91,41 +110,86 @@ struct from_io {
 	int16_t		compass_x;
 	int16_t		compass_y;
 	int16_t		compass_z;
+	uint16_t	sample_count;	// Increased for every sample taken
+	uint16_t	sample_tick;	// Tick of the IO-microcontroller when the gyro was read
 	uint8_t		dongle_status;
 };
 
 struct from_io io_values;
 
+// Maps the tick of the IO-microcontroller to the NXT tick. A message is
+// delayed by a varying amount after the sample is taken, but never by less
+// than it takes to sample and send it. The offset between the clocks is
+// therefore the smallest difference seen in a window of samples, and the rate
+// difference is how that smallest difference drifts over CLOCK_WINDOWS windows.
+struct io_clock_t {
+  uint8_t valid;
+  uint16_t lastCount;
+  uint16_t lastTick;
+  uint32_t tick;                      // Tick of the IO-microcontroller since the mapping was started, without wrap around
+  TickType_t start;                   // NXT tick when the mapping was started
+  float skew;                         // Measured minus nominal NXT ms per tick of the IO-microcontroller
+  uint8_t samples;                    // Samples in the current window
+  uint32_t windowTick;                // Tick with the smallest offset in the current window
+  float windowOffset;
+  uint8_t windows;                    // Finished windows, up to CLOCK_WINDOWS
+  uint8_t newest;
+  uint32_t minTick[CLOCK_WINDOWS];    // Tick with the smallest offset in each finished window
+  float minOffset[CLOCK_WINDOWS];
+};
+
+struct io_clock_t io_clock;
+
+// The last gyro samples, with the NXT time they were taken at. The time is
+// kept as a tick and a fraction of a tick, a float alone loses the fraction
+// once the tick count grows large.
+struct io_sample_t {
+  uint16_t sequence;
+  int16_t gyro_z;
+  TickType_t tick;
+  float fraction;
+};
+
+struct io_sample_t io_samples[IO_SAMPLE_HISTORY];
+uint16_t io_sequence = 0;
+
 void io_task(void *pvParamters);
-uint8_t io_send(uint8_t *data, uint8_t len, uint8_t should_wait);
+uint8_t io_encode(uint8_t *encoded, uint8_t *data, uint8_t len, uint8_t tag);
+uint8_t io_next_tag(void);
 uint8_t io_format_and_send(uint8_t *data, uint8_t len);
-uint8_t io_send(uint8_t *data, uint8_t len, uint8_t should_wait);
-void get_io_values(void);
-void bluetooth_receive(void);
+uint8_t io_send(uint8_t *data, uint8_t len, uint8_t tag);
+void io_subscribe_sensors(void);
+void io_sensor_timer(TimerHandle_t xTimer);
+void io_bluetooth_timer(TimerHandle_t xTimer);
 uint8_t io_should_wait(uint8_t type);
+uint8_t io_may_send(TickType_t now);
 struct message_t io_message_unpack(uint8_t *msg, uint8_t len);
+float io_clock_offset(struct io_clock_t *clock);
+float io_clock_nominal(uint32_t tick, TickType_t *whole);
+TickType_t io_clock_map(struct io_clock_t *clock, uint16_t count, uint16_t tick, TickType_t arrival, float *fraction);
 void (*bluetooth_callback)(uint8_t*, uint16_t);
 
+// Messages in both directions have the format
+// | Type (1 byte) | Tag (1 byte) | Data (variable bytes) | CRC (1 byte) |
+// A request that expects a response gets a tag from 1 to 255, and the
+// IO-microcontroller sends the same tag back in the response. Tag 0 is
+// used for messages without a response.
 struct message_t {
   uint8_t type;
+  uint8_t tag;
   uint8_t len;
   char contents[BUFFER_SIZE];
   uint8_t crc;
 };
 
-typedef enum
-{
-  FREE		            = 0x00,
-  WAITING               = 0x01
-} io_status;
-
 typedef enum
 {
   SET_LED				= 0x01,
   SEND_BT				= 0x02,
   RECEIVE_BT			= 0x03,
   RECEIVE_SENSORS	    = 0x04,
-  ALIVE_TEST            = 0x05
+  ALIVE_TEST            = 0x05,
+  SUBSCRIBE_SENSORS     = 0x06
 } nxt_message_type;
 
 typedef enum
@@ -136,89 +200,82 @@ typedef enum
 } io_message_type;
 
 buffer_t send_buffer;
-buffer_t msg_type_buffer;
+buffer_t msg_info_buffer;
 
 SemaphoreHandle_t send_queue_mutex;
 
+TaskHandle_t io_task_handle = NULL;
+TimerHandle_t sensor_timer;
+TimerHandle_t bluetooth_timer;
+
 uint8_t io_alive = 0;
+uint8_t io_tag = 0;
+TickType_t push_tick = 0; // When the last sensor data was sampled, the next push is due SENSOR_PERIOD_MS later
 
 void io_task(void *pvParamters) {
-  const TickType_t xDelay = 1 / portTICK_PERIOD_MS;
   TickType_t xLastWakeTime = xTaskGetTickCount();
   
-  char message[BUFFER_SIZE];
-  uint8_t received_bytes[BUFFER_SIZE];
-  uint8_t num_received_bytes = 0;
+  uint8_t message[BUFFER_SIZE];
+  hs_frame_t frame;
   cobs_decode_result cobs_result;
   
-  uint16_t time = 0;
+  uint8_t outstanding[MAX_OUTSTANDING]; // Tags of the requests waiting for a response
+  uint8_t num_outstanding = 0;
+  uint8_t info[2];
+  uint8_t i;
+  TickType_t sent_tick = 0;
+  uint8_t tx_busy = 0;
+  uint8_t bt_poll = 0; // Ask for the stored bluetooth messages in the next burst
   uint8_t timeouts = 0;
   uint8_t number_of_errors = 0;
-  uint8_t len = 0;
-  uint16_t io_counter = 0;
-  uint16_t bt_counter = 0;
-  io_status status = FREE;
+  uint16_t len = 0;
   struct message_t io_message;
   
   while(1) { // Loop until a connection with the IO-card is confirmed
     if(!io_alive) {
-      uint8_t data[4] = {0};
-      uint8_t num = hs_read_delimiter(data, 0, 4, 0x00);
-      if(num != 0 && data[1] == ALIVE_RESPONSE) {
+      uint8_t data[1] = {ALIVE_TEST};
+      uint8_t num = hs_read_frame(&frame, 0x00);
+      uint8_t response = num > 1 ? frame.data[1] : 0;
+      hs_release_frames();
+      if(response == ALIVE_RESPONSE) {
         io_alive = 1;
         break;
       }
-      data[0] = 0x03; // COBS overhead byte
-      data[1] = ALIVE_TEST; //(0x05)
-      data[2] = 0x3F; // CRC for 0x05 (ALIVE_TEST id)
-      data[3] = 0x00; // Delimiter
-      hs_write(data, 0, 4);
+      hs_write(message, 0, io_encode(message, data, 1, 0)); // Untagged, the response is recognised by its type
     }
     vTaskDelayUntil(&xLastWakeTime, 100 / portTICK_PERIOD_MS);
   }
   
+  push_tick = xTaskGetTickCount() - SUBSCRIBE_TIMEOUT_MS / portTICK_PERIOD_MS;
+  io_subscribe_sensors();
+  xTimerStart(sensor_timer, 0);
+  xTimerStart(bluetooth_timer, 0);
+  
   while(1) { // Main IO-loop
-    vTaskDelayUntil(&xLastWakeTime, xDelay);
-
-    if(++io_counter % 30  == 0) { // Tell IO-module to send sensors every 30 ms ( The estimator task runs every 30 ms, and should have updated values every time)
-      get_io_values();
-      io_counter = 0;
+    TickType_t xWait = portMAX_DELAY;
+    if(num_outstanding > 0) { // Don't sleep past the deadline of the responses we are waiting for
+      TickType_t waited = xTaskGetTickCount() - sent_tick;
+      xWait = waited < REPLY_TIMEOUT_MS / portTICK_PERIOD_MS ? REPLY_TIMEOUT_MS / portTICK_PERIOD_MS - waited : 0;
+    } else if(tx_busy) { // The last message is still being sent, try again next tick
+      xWait = 1;
     }
-    if(++bt_counter == 50) { // Tell IO-module to send bluetooth messages (if any are stored) every 50 ms
-      bluetooth_receive();
-      bt_counter = 0;
+    uint32_t events = 0;
+    xTaskNotifyWait(0, 0xFFFFFFFF, &events, xWait); // Woken by the RS485 interrupt at the end of a received burst, by io_send or by the timers
+    
+    // The timers only set a bit, queueing the requests may block and the timer task has a small stack
+    if((events & IO_NOTIFY_SENSORS) && xTaskGetTickCount() - push_tick >= SUBSCRIBE_TIMEOUT_MS / portTICK_PERIOD_MS) { // The IO-microcontroller has stopped pushing, it may have been reset
+      io_subscribe_sensors();
     }
-    xSemaphoreTake(send_queue_mutex, portMAX_DELAY);
-    len = send_buffer.len;
-    xSemaphoreGive(send_queue_mutex);
-
-    if(status == FREE && len > 0) { // If the rs485 line is available and send buffer is not empty: send the first message in the buffer
-      xSemaphoreTake(send_queue_mutex, portMAX_DELAY);
-      uint16_t num_bytes = buffer_remove_token(&send_buffer, message, 0x00, BUFFER_SIZE); // Read from the send buffer until the 0x00 is found (0x00 signals end of message to be sent)
-      buffer_remove(&msg_type_buffer, &status, 1); // Get the status the IO should go to after sending this message (IDLE if no response to this message is expected)
-      xSemaphoreGive(send_queue_mutex);
-
-      hs_write(message, 0, num_bytes); // Send the bytes using the RS485 interface
-
-      time = 0;
-      
-    } else if(status != FREE && time <= 20)  { // Increase the timer if we are waiting for a message from the IO module
-      time += 1;
-    } else if(status != FREE && time > 20){ //Have been waiting for a response for 20ms, assume message lost and make the bus available to send more data
-      time = 0;
-      status = FREE;
-      display_goto_xy(0,0);
-      display_int(++timeouts, 2);
-      display_update();
+    if(events & IO_NOTIFY_BLUETOOTH) {
+      bt_poll = 1;
     }
     
-    num_received_bytes = hs_read_delimiter((unsigned char*) received_bytes, 0, BUFFER_SIZE, 0x00); // Get a message from the receive buffer if a complete message has been received (signaled by 0x00 at the end)
-    
-    if(num_received_bytes > 0) {
+    while(hs_read_frame(&frame, 0x00) > 0) { // Handle every complete message in the receive ring (signaled by 0x00 at the end)
 
-      cobs_result = cobs_decode(message, BUFFER_SIZE, received_bytes, num_received_bytes-1);
+      cobs_result = cobs_decode(message, BUFFER_SIZE, frame.data, frame.len-1); // Decode straight from the ring
+      hs_release_frames();
     
-      if(cobs_result.status != COBS_DECODE_OK) continue; // COBS error
+      if(cobs_result.status != COBS_DECODE_OK || cobs_result.out_len < 3) continue; // COBS error
 
       io_message = io_message_unpack(message, cobs_result.out_len);
 
@@ -229,13 +286,26 @@ void io_task(void *pvParamters) {
         display_update();
         continue;
       } 
-      if((io_message.type == SENSOR_DATA && status == WAITING) || (io_message.type == BT_DATA && status == WAITING)) { // Free the send bus when a message we were waiting for arrives
-        status = FREE;
-        time = 0;
+      for(i=0;i<num_outstanding;i++) { // Match the response with its request
+        if(outstanding[i] == io_message.tag) {
+          outstanding[i] = outstanding[--num_outstanding];
+          break;
+        }
       }
       if(io_message.type == SENSOR_DATA) {
+        TickType_t arrival = xTaskGetTickCount();
+        push_tick = arrival; // The IO-microcontroller times the next push from every SENSOR_DATA message
         vTaskSuspendAll(); //Prevent another task from seeing inconsistent io data
         memcpy((void*) &io_values, io_message.contents, sizeof(io_values)); // Populate io values with the new data
+        if(!io_clock.valid || io_values.sample_count != io_clock.lastCount) { // Responses to RECEIVE_SENSORS may repeat the last sample
+          struct io_sample_t *sample = &io_samples[++io_sequence % IO_SAMPLE_HISTORY];
+          sample->tick = io_clock_map(&io_clock, io_values.sample_count, io_values.sample_tick, arrival, &sample->fraction);
+          sample->sequence = io_sequence;
+          sample->gyro_z = io_values.gyro_z;
+          // The push period starts when the sample is taken. Timed from there, a slow push or the io task
+          // running late does not move the guard into the next push
+          if((int32_t) (arrival - sample->tick) > 0) push_tick = sample->tick;
+        }
         xTaskResumeAll();
         /*display_clear(0);
         display_goto_xy(0,2);
@@ -251,31 +321,84 @@ void io_task(void *pvParamters) {
         uint8_t *tmp = pvPortMalloc(MAX_FRAME_SIZE);
         static uint8_t buffer[MAX_FRAME_SIZE];
         static uint8_t buffer_count = 0;
+        static uint8_t overlong = 0; // The dongle lost a delimiter, skip to the next one
         
         if(tmp == NULL) return;
         
         for(i=0;i<io_message.len;i++) {
           if(io_message.contents[i] == 0x00) { // Look for end of frame
-            if(buffer_count != 0) { // Bytes belonging to this frame have been stored previously
-              memcpy(tmp, buffer, buffer_count);
-              memcpy(tmp+buffer_count, io_message.contents, i+1);
-              bluetooth_callback(tmp, buffer_count+i+1);
-              frame_start = i+1;
-              buffer_count = 0;
-            } else {
-              memcpy(tmp, io_message.contents+frame_start, i-frame_start+1); 
-              bluetooth_callback(tmp, i-frame_start+1);
-              frame_start = i+1;
+            if(!overlong && buffer_count+i-frame_start+1 <= MAX_FRAME_SIZE) {
+              memcpy(tmp, buffer, buffer_count); // Bytes belonging to this frame may have been stored previously
+              memcpy(tmp+buffer_count, io_message.contents+frame_start, i-frame_start+1);
+              bluetooth_callback(tmp, buffer_count+i-frame_start+1);
             }
+            frame_start = i+1;
+            buffer_count = 0;
+            overlong = 0;
           }
         }
         if(frame_start != io_message.len) { // More bytes remaining, belonging to another frame, store them to combine with the rest of the message when it arrives
-          memcpy(buffer+buffer_count, io_message.contents+frame_start, io_message.len-frame_start);
-          buffer_count += (io_message.len-frame_start);
+          if(overlong || buffer_count+io_message.len-frame_start > MAX_FRAME_SIZE) {
+            overlong = 1;
+            buffer_count = 0;
+          } else {
+            memcpy(buffer+buffer_count, io_message.contents+frame_start, io_message.len-frame_start);
+            buffer_count += (io_message.len-frame_start);
+          }
         }
         vPortFree(tmp);
       }
     }
+    
+    if(num_outstanding > 0 && xTaskGetTickCount() - sent_tick >= REPLY_TIMEOUT_MS / portTICK_PERIOD_MS) { //Have been waiting for the responses for 20ms, assume they are lost and make the bus available to send more data
+      num_outstanding = 0;
+      display_goto_xy(0,0);
+      display_int(++timeouts, 2);
+      display_update();
+    }
+    
+    // The IO-microcontroller only answers after it has received a burst, and the
+    // RS485 line is half duplex. Send all queued messages in one burst once
+    // every response to the previous burst has arrived.
+    tx_busy = 0;
+    if(num_outstanding == 0 && io_may_send(xTaskGetTickCount())) {
+      if(hs_pending() & 2) { // Previous burst not sent yet
+        tx_busy = 1;
+        continue;
+      }
+      
+      len = 0;
+      uint8_t last_tag = 0;
+      xSemaphoreTake(send_queue_mutex, portMAX_DELAY);
+      while(msg_info_buffer.len > 0 && num_outstanding < MAX_OUTSTANDING) {
+        buffer_read(&msg_info_buffer, info, msg_info_buffer.tail, 2); // Tag and length of the next message
+        if(len > 0 && len + info[1] + BURST_ACK_SIZE > BURST_SIZE) break;
+        
+        buffer_remove(&msg_info_buffer, NULL, 2);
+        len += buffer_remove(&send_buffer, message+len, info[1]);
+        if(info[0] != 0) outstanding[num_outstanding++] = info[0];
+        last_tag = info[0];
+      }
+      xSemaphoreGive(send_queue_mutex);
+      
+      // The IO-microcontroller handles the messages of a burst in order, and
+      // SEND_BT keeps it busy while the dongle UART sends. End the burst with
+      // a request, so the next burst waits until the whole burst is handled.
+      // The bluetooth poll is that request when it is due, it does not queue
+      // behind SEND_BT in the send buffer
+      if((bt_poll && num_outstanding < MAX_OUTSTANDING) || (len > 0 && last_tag == 0)) {
+        uint8_t request[1] = {bt_poll ? RECEIVE_BT : ALIVE_TEST};
+        uint8_t tag = io_next_tag();
+        len += io_encode(message+len, request, 1, tag);
+        outstanding[num_outstanding++] = tag;
+        bt_poll = 0;
+      }
+      
+      if(len > 0) {
+        hs_write(message, 0, len); // Send the bytes using the RS485 interface
+        sent_tick = xTaskGetTickCount();
+      }
+    }
   }
 }
 
@@ -287,10 +410,12 @@ uint8_t io_init(void) {
   hs_init();
   hs_enable(BAUD_RATE);
   char *buf = pvPortMalloc(500);
-  char *type_buffer = pvPortMalloc(50);
+  char *info_buffer = pvPortMalloc(50);
   send_queue_mutex = xSemaphoreCreateMutex();
+  sensor_timer = xTimerCreate("IO sensors", SUBSCRIBE_TIMEOUT_MS / portTICK_PERIOD_MS, pdTRUE, NULL, io_sensor_timer); // Subscribe again if the IO-module stops sending sensors
+  bluetooth_timer = xTimerCreate("IO bluetooth", BLUETOOTH_PERIOD_MS / portTICK_PERIOD_MS, pdTRUE, NULL, io_bluetooth_timer); // Tell IO-module to send bluetooth messages (if any are stored)
   
-  if(buf == NULL || type_buffer == NULL) {
+  if(buf == NULL || info_buffer == NULL || sensor_timer == NULL || bluetooth_timer == NULL) {
     display_goto_xy(0,0);
     display_string("IO init malloc error");
     display_update();
@@ -298,12 +423,13 @@ uint8_t io_init(void) {
   }
   
   buffer_init(&send_buffer, buf, 500); // Buffer to store outgoing messages until they are sent by the io task.
-  buffer_init(&msg_type_buffer, type_buffer, 50); // Buffer to store the types of the messages in the send buffer
+  buffer_init(&msg_info_buffer, info_buffer, 50); // Buffer to store the tag and length of the messages in the send buffer
   
   uint8_t init[5] = {0x01, 0x02, 0x03, 0x04, 0x00};
   hs_write(init, 0, 5); //First byte sent after boot is always wrong for some reason. Sending some dummy text to stop actual data from being corrupted  
   
-  xTaskCreate(io_task, "IO", 250, NULL, 5, NULL);
+  xTaskCreate(io_task, "IO", 250, NULL, 5, &io_task_handle);
+  hs_set_rx_notify(io_task_handle, IO_NOTIFY_RX);
   
   return 1;
 }
@@ -316,36 +442,62 @@ uint8_t io_send_bluetooth(uint8_t *data, uint16_t len) {
   message[0] = SEND_BT;
   memcpy(message+1, data, len);
   
-  io_format_and_send(message, len+1);
+  uint8_t ret_value = io_format_and_send(message, len+1);
   
   vPortFree(message);
   
-  return 1;
+  return ret_value;
 }
 
 uint8_t io_send_bluetooth_string(char *str) {
   return io_send_bluetooth((uint8_t*) str, strlen(str));
 }
 
-//Add CRC, encode the message with COBS and add it to the send buffer
+//Add the tag and CRC, and encode the message with COBS. 'encoded' must have room for len+4 bytes
+//Returns the number of encoded bytes, including the delimiter, or 0 on error
+uint8_t io_encode(uint8_t *encoded, uint8_t *data, uint8_t len, uint8_t tag) {
+  uint8_t *message = pvPortMalloc(len+2);
+  
+  if(message == NULL) return 0;
+  
+  message[0] = data[0];
+  message[1] = tag;
+  memcpy(message+2, data+1, len-1);
+  message[len+1] = calculate_crc(message, len+1);
+  cobs_encode_result result = cobs_encode(encoded, len+4, message, len+2);
+  vPortFree(message);
+  
+  if(result.status != COBS_ENCODE_OK) return 0;
+  encoded[result.out_len] = 0x00; //Add message delimiter
+  
+  return result.out_len+1;
+}
+
+//The tag for the next request that expects a response
+uint8_t io_next_tag(void) {
+  uint8_t tag;
+  
+  taskENTER_CRITICAL();
+  if(++io_tag == 0) io_tag = 1; // Tag 0 means no response
+  tag = io_tag;
+  taskEXIT_CRITICAL();
+  
+  return tag;
+}
+
+//Tag the message, encode it and add it to the send buffer
 uint8_t io_format_and_send(uint8_t *data, uint8_t len) {
-  uint8_t *message = pvPortMalloc(len+1);
-  uint8_t *encoded_message = pvPortMalloc(len+3);
+  uint8_t *encoded_message = pvPortMalloc(len+4);
   uint8_t ret_value = 0;
-  memcpy(message, data, len);
-  message[len] = calculate_crc(message, len);
-  cobs_encode_result result = cobs_encode(encoded_message, len+3, message, len+1);
+  uint8_t tag = 0;
   
-  if(result.status != COBS_ENCODE_OK) {
-    vPortFree(message);
-    vPortFree(encoded_message);
-    return 0;
-  }
-  encoded_message[result.out_len] = 0x00; //Add message delimiter
+  if(encoded_message == NULL) return 0;
   
-  ret_value = io_send(encoded_message, result.out_len+1, io_should_wait(message[0]));
+  if(io_should_wait(data[0])) tag = io_next_tag();
+  
+  uint8_t num_bytes = io_encode(encoded_message, data, len, tag);
+  if(num_bytes > 0) ret_value = io_send(encoded_message, num_bytes, tag);
   
-  vPortFree(message);
   vPortFree(encoded_message);
   
   return ret_value;
@@ -356,18 +508,22 @@ uint8_t io_send_led_command(uint8_t leds) {
   return io_format_and_send(message, 2);
 }
 
-//Add the data to the send buffer
-uint8_t io_send(uint8_t *data, uint8_t len, uint8_t should_wait) {
-  if(data == NULL || len <= 0 || should_wait > 1 || !io_alive) return 0;
+//Add the data to the send buffer. The tag is 0 if no response is expected
+uint8_t io_send(uint8_t *data, uint8_t len, uint8_t tag) {
+  if(data == NULL || len <= 0 || len > BURST_SIZE - BURST_ACK_SIZE || !io_alive) return 0;
   
-  io_status tmp = should_wait ? WAITING : FREE;
+  uint8_t info[2] = {tag, len};
   
-  uint8_t success = 1;
+  uint8_t success = 0;
   
   xSemaphoreTake(send_queue_mutex, portMAX_DELAY);
-  success *= buffer_append(&send_buffer, data, len);
-  success *= buffer_append(&msg_type_buffer, &tmp, 1);
+  if(send_buffer.capacity - send_buffer.len >= len && msg_info_buffer.capacity - msg_info_buffer.len >= 2) { // Both or neither, so they stay in step
+    buffer_append(&send_buffer, data, len);
+    buffer_append(&msg_info_buffer, info, 2);
+    success = 1;
+  }
   xSemaphoreGive(send_queue_mutex);
+  xTaskNotify(io_task_handle, IO_NOTIFY_SEND, eSetBits); // Wake the io task to send it
   
   if(success == 0) {
     display_goto_xy(0,0);
@@ -378,33 +534,112 @@ uint8_t io_send(uint8_t *data, uint8_t len, uint8_t should_wait) {
   return 1;
 }
 
-void bluetooth_receive(void) {
-  uint8_t encoded_message[4] = {0x03, RECEIVE_BT, 0xE2, 0x00}; //Raw data to be sent: RECEIVE_SENSORS (0x03). 0xE2 is the calculated crc for 0x03, 0x00 is the message delimiter, and the initial 0x03 is used for the cobs encoding
-  io_send(encoded_message, 4, 1);
+//Tell the IO-microcontroller to push io-values every SENSOR_PERIOD_MS. The first
+//values are sent as a response right away
+void io_subscribe_sensors(void) {
+  uint8_t message[2] = {SUBSCRIBE_SENSORS, SENSOR_PERIOD_MS};
+  io_format_and_send(message, 2);
+}
+
+void io_sensor_timer(TimerHandle_t xTimer) {
+  xTaskNotify(io_task_handle, IO_NOTIFY_SENSORS, eSetBits);
 }
 
-//Tell the IO-microcontroller to send io-values
-void get_io_values(void) {
-  uint8_t encoded_message[4] = {0x03, RECEIVE_SENSORS, 0x61, 0x00}; //Raw data to be sent: RECEIVE_SENSORS (0x04). 0x61 is the calculated crc for 0x04, 0x00 is the message delimiter, and the initial 0x03 is used for the cobs encoding
-  io_send(encoded_message, 4, 1);
+void io_bluetooth_timer(TimerHandle_t xTimer) {
+  xTaskNotify(io_task_handle, IO_NOTIFY_BLUETOOTH, eSetBits);
 }
 
-//Should we wait for a response to this message before sending anything more?
+//Does the IO-microcontroller respond to this message?
 uint8_t io_should_wait(uint8_t type) {
   switch(type) {
     case RECEIVE_BT:
     case RECEIVE_SENSORS:
+    case SUBSCRIBE_SENSORS:
       return 1;
     default:
       return 0;
   }
 }
 
+//The IO-microcontroller pushes sensor data every SENSOR_PERIOD_MS without being
+//asked, and the RS485 line is half duplex. Bursts may only start until shortly
+//before the next push is due, and then not until the push has arrived. The
+//push is late if the IO-microcontroller was still answering the last burst.
+uint8_t io_may_send(TickType_t now) {
+  TickType_t since_push = now - push_tick;
+  
+  if(since_push >= SUBSCRIBE_TIMEOUT_MS / portTICK_PERIOD_MS) return 1; // Not pushing
+  return since_push < (SENSOR_PERIOD_MS - PUSH_GUARD_MS) / portTICK_PERIOD_MS;
+}
+
+//Offset of the NXT tick from the nominal IO-microcontroller tick at the last sample
+float io_clock_offset(struct io_clock_t *clock) {
+  float offset = clock->windowOffset + clock->skew * (float) (clock->tick - clock->windowTick);
+  
+  if(clock->windows > 0) { // The finished window has seen more samples, use it unless the offset has moved down since
+    float previous = clock->minOffset[clock->newest] + clock->skew * (float) (clock->tick - clock->minTick[clock->newest]);
+    if(previous < offset) offset = previous;
+  }
+  return offset;
+}
+
+//Nominal NXT ms for a number of IO-microcontroller ticks, as whole ms and the fraction to add to them.
+//Integer steps keep it exact however long the mapping runs
+float io_clock_nominal(uint32_t tick, TickType_t *whole) {
+  *whole = tick - tick / IO_TICKS_PER_SLIP;
+  return -(float) (tick % IO_TICKS_PER_SLIP) / IO_TICKS_PER_SLIP;
+}
+
+//Adds a sample to the clock mapping, and returns the NXT tick it was taken at. The fraction of a tick
+//to add is returned in fraction
+TickType_t io_clock_map(struct io_clock_t *clock, uint16_t count, uint16_t tick, TickType_t arrival, float *fraction) {
+  uint8_t oldest;
+  TickType_t whole;
+  
+  if(clock->valid) {
+    clock->tick += (uint16_t) (tick - clock->lastTick);
+  }
+  float nominal = io_clock_nominal(clock->tick, &whole);
+  float offset = (float) (int32_t) (arrival - clock->start - whole) - nominal;
+  
+  if(!clock->valid || (int16_t) (count - clock->lastCount) < 0 || fabsf(offset - io_clock_offset(clock)) > CLOCK_RESET_MS) { // Start over
+    memset(clock, 0, sizeof(struct io_clock_t));
+    clock->valid = 1;
+    clock->start = arrival;
+    offset = 0;
+  }
+  clock->lastCount = count;
+  clock->lastTick = tick;
+  
+  if(clock->samples == 0 || offset < clock->windowOffset) {
+    clock->windowOffset = offset;
+    clock->windowTick = clock->tick;
+  }
+  if(++clock->samples == CLOCK_WINDOW) { // Window finished, measure the rate from the oldest window kept
+    clock->newest = (clock->newest + 1) % CLOCK_WINDOWS;
+    clock->minOffset[clock->newest] = clock->windowOffset;
+    clock->minTick[clock->newest] = clock->windowTick;
+    if(clock->windows < CLOCK_WINDOWS) clock->windows++;
+    
+    oldest = (clock->newest + CLOCK_WINDOWS + 1 - clock->windows) % CLOCK_WINDOWS;
+    if(clock->windows > 1) {
+      clock->skew = (clock->minOffset[clock->newest] - clock->minOffset[oldest]) / (float) (clock->minTick[clock->newest] - clock->minTick[oldest]);
+    }
+    clock->samples = 0;
+  }
+  
+  float time = io_clock_nominal(clock->tick, &whole) + io_clock_offset(clock); // Since the mapping was started, in addition to whole
+  float below = floorf(time);
+  *fraction = time - below;
+  return clock->start + whole + (int32_t) below;
+}
+
 struct message_t io_message_unpack(uint8_t *msg, uint8_t len) {
   struct message_t message;
   message.type = msg[0];
-  message.len = len-2;
-  memcpy(message.contents, msg+1, len-2);
+  message.tag = msg[1];
+  message.len = len-3;
+  memcpy(message.contents, msg+2, len-3);
   message.crc = msg[len-1];
   return message;
 }
@@ -426,6 +661,28 @@ float gyro_get_dps_z(void) {
     return (float) io_values.gyro_z * 4.375 / 1000; //Calculate degrees per second from raw value
 }
 
+uint16_t gyro_get_sequence(void) {
+  return io_sequence;
+}
+
+//Gets a gyro sample with the NXT tick it was taken at, and the fraction of a tick after it. Returns 0 if
+//the sample is no longer kept
+uint8_t gyro_get_sample_z(uint16_t sequence, float *dps, uint32_t *tick, float *fraction) {
+  uint8_t found = 0;
+  
+  vTaskSuspendAll();
+  struct io_sample_t *sample = &io_samples[sequence % IO_SAMPLE_HISTORY];
+  if(sample->sequence == sequence && sequence != 0) {
+    *dps = (float) sample->gyro_z * 4.375 / 1000;
+    *tick = sample->tick;
+    *fraction = sample->fraction;
+    found = 1;
+  }
+  xTaskResumeAll();
+  
+  return found;
+}
+
 void compass_get(int16_t *xCom, int16_t *yCom, int16_t *zCom) {
   *xCom = io_values.compass_x;
   *yCom = io_values.compass_y;
@@ -11,6 +11,7 @@
 #include <stdint.h>
 
 #define BAUD_RATE       230400
+#define IO_SAMPLE_HISTORY 4 // Gyro samples kept with the time they were taken, see gyro_get_sample_z
 
 uint8_t io_init(void);
 void vIOTask(void *pvParamters);
@@ -22,6 +23,8 @@ void gyro_get_raw(int16_t *xGyro, int16_t *yGyro, int16_t *zGyro);
 float gyro_get_dps_x(void);
 float gyro_get_dps_y(void);
 float gyro_get_dps_z(void);
+uint16_t gyro_get_sequence(void);
+uint8_t gyro_get_sample_z(uint16_t sequence, float *dps, uint32_t *tick, float *fraction);
 void compass_get(int16_t *xCom, int16_t *yCom, int16_t *zCom);
 uint8_t dongle_connected(void);
 uint8_t distance_get_cm(uint8_t direction);
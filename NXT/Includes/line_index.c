@@ -0,0 +1,132 @@
+#include "line_index.h"
+
+/* Kernel includes */
+#include "FreeRTOS.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Bin of lines without a direction, they are candidates for any line */
+#define LINE_INDEX_ANY_ANGLE	INT8_MIN
+
+static int16_t line_index_cell(float coordinate) {
+	return (int16_t) floorf(coordinate / DELTA);
+}
+
+static int8_t line_index_angle_bin(line_t *Line) {
+	// Zero-length lines have no direction, and pass the angle test with any line
+	if (Line->length <= 0)
+		return LINE_INDEX_ANY_ANGLE;
+
+	int8_t bin = (int8_t) (Line->theta * (LINE_INDEX_ANGLE_BINS / M_PI_F));
+	if (bin >= LINE_INDEX_ANGLE_BINS)
+		return LINE_INDEX_ANGLE_BINS - 1;
+
+	return bin;
+}
+
+static uint8_t line_index_angle_near(int8_t bin1, int8_t bin2) {
+	if (bin1 == LINE_INDEX_ANY_ANGLE || bin2 == LINE_INDEX_ANY_ANGLE)
+		return 1;
+
+	// The bins wrap around at pi, so the first and last bin are neighbours
+	int8_t diff = abs(bin1 - bin2);
+	return diff <= 1 || diff == LINE_INDEX_ANGLE_BINS - 1;
+}
+
+static uint8_t line_index_hash(int16_t cx, int16_t cy) {
+	uint32_t h = (uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u;
+	return (uint8_t) (h & (LINE_INDEX_BUCKETS - 1));
+}
+
+static void line_index_link(line_index_t *Index, uint16_t entry, point_t *Endpoint) {
+	uint8_t b = line_index_hash(line_index_cell(Endpoint->x), line_index_cell(Endpoint->y));
+	Index->bucket[entry] = b;
+	Index->next[entry] = Index->head[b];
+	Index->head[b] = entry;
+}
+
+static void line_index_unlink(line_index_t *Index, uint16_t entry) {
+	uint16_t *link = &Index->head[Index->bucket[entry]];
+
+	while (*link != LINE_INDEX_NONE) {
+		if (*link == entry) {
+			*link = Index->next[entry];
+			return;
+		}
+		link = &Index->next[*link];
+	}
+}
+
+void line_index_clear(line_index_t *Index) {
+	configASSERT(Index);
+
+	for (uint16_t b = 0; b < LINE_INDEX_BUCKETS; b++)
+		Index->head[b] = LINE_INDEX_NONE;
+
+	memset(Index->visited, 0, sizeof(Index->visited));
+	Index->stamp = 0;
+}
+
+void line_index_insert(line_index_t *Index, line_t *Line, uint16_t id) {
+	configASSERT(Index && Line && id < L_SIZE);
+
+	Index->angleBin[id] = line_index_angle_bin(Line);
+	line_index_link(Index, 2 * id, &Line->P);
+	line_index_link(Index, 2 * id + 1, &Line->Q);
+}
+
+void line_index_remove(line_index_t *Index, uint16_t id) {
+	configASSERT(Index && id < L_SIZE);
+
+	line_index_unlink(Index, 2 * id);
+	line_index_unlink(Index, 2 * id + 1);
+}
+
+uint16_t line_index_query(line_index_t *Index, line_t *Line) {
+	configASSERT(Index && Line);
+
+	// New stamp for this query, so lines found through several buckets are
+	// only reported once
+	if (++Index->stamp == 0) {
+		memset(Index->visited, 0, sizeof(Index->visited));
+		Index->stamp = 1;
+	}
+
+	uint16_t count = 0;
+	int8_t angleBin = line_index_angle_bin(Line);
+	point_t *Endpoints[2] = { &Line->P, &Line->Q };
+
+	for (uint8_t e = 0; e < 2; e++) {
+		int16_t cx = line_index_cell(Endpoints[e]->x);
+		int16_t cy = line_index_cell(Endpoints[e]->y);
+
+		for (int8_t dx = -1; dx <= 1; dx++) {
+			for (int8_t dy = -1; dy <= 1; dy++) {
+				uint8_t b = line_index_hash(cx + dx, cy + dy);
+
+				for (uint16_t entry = Index->head[b]; entry != LINE_INDEX_NONE; entry = Index->next[entry]) {
+					uint16_t id = entry >> 1;
+					if (Index->visited[id] == Index->stamp)
+						continue;
+					Index->visited[id] = Index->stamp;
+
+					if (!line_index_angle_near(angleBin, Index->angleBin[id]))
+						continue;
+
+					// Insertion sort keeps the candidates in repo order
+					uint16_t pos = count++;
+					while (pos > 0 && Index->candidates[pos-1] > id) {
+						Index->candidates[pos] = Index->candidates[pos-1];
+						pos--;
+					}
+					Index->candidates[pos] = id;
+				}
+			}
+		}
+	}
+
+	return count;
+}
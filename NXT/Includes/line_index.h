@@ -0,0 +1,76 @@
+/************************************************************************/
+// File:			line_index.h
+//
+// Spatial hash index over the endpoints of the line segments in the line
+// repo. The plane is divided into cells of DELTA x DELTA cm, and both
+// endpoints of every line are hashed into buckets on their cell. Each line
+// also keeps the bin its normal angle theta falls in, with LINE_INDEX_ANGLE_BINS
+// bins of at least MU over [0,pi). Two lines can only pass
+// mapping_is_mergeable if an endpoint of one lies in one of the 3x3 cells
+// around an endpoint of the other, and their angle bins are the same or
+// neighbours, where the first and last bin are neighbours too. A query
+// therefore only visits 2 * 9 buckets, whatever the size of the repo, and
+// skips the lines in them with a different direction.
+//
+// The index only returns candidates. The caller still has to run the exact
+// mergeability test on each of them.
+//
+/************************************************************************/
+
+#ifndef LINE_INDEX_H_
+#define LINE_INDEX_H_
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "types.h"
+
+#define LINE_INDEX_NONE		0xFFFF
+
+typedef struct {
+	uint16_t head[LINE_INDEX_BUCKETS];		// First entry in each bucket
+	uint16_t next[2 * L_SIZE];				// Next entry in the same bucket
+	uint8_t bucket[2 * L_SIZE];				// Bucket each entry is stored in
+	int8_t angleBin[L_SIZE];				// Angle bin of each line
+	uint16_t candidates[L_SIZE];			// Result of the last query
+	uint8_t visited[L_SIZE];				// Query stamp per line
+	uint8_t stamp;
+} line_index_t;
+
+/**
+ * @brief      Removes all lines from the index.
+ *
+ * @param      Index  The index
+ */
+void line_index_clear(line_index_t *Index);
+
+/**
+ * @brief      Adds both endpoints of a line to the index.
+ *
+ * @param      Index  The index
+ * @param      Line   The line
+ * @param[in]  id     The position of the line in the repo
+ */
+void line_index_insert(line_index_t *Index, line_t *Line, uint16_t id);
+
+/**
+ * @brief      Removes both endpoints of a line from the index.
+ *
+ * @param      Index  The index
+ * @param[in]  id     The position of the line in the repo
+ */
+void line_index_remove(line_index_t *Index, uint16_t id);
+
+/**
+ * @brief      Finds all lines in the index that may be mergeable with the
+ *             given line. The ids are written to Index->candidates in
+ *             ascending order.
+ *
+ * @param      Index  The index
+ * @param      Line   The line to find merge candidates for
+ *
+ * @return     The number of candidates
+ */
+uint16_t line_index_query(line_index_t *Index, line_t *Line);
+
+#endif /* LINE_INDEX_H_ */
@@ -14,33 +14,67 @@
 #include "defines.h"
 #include "functions.h"
 #include "communication.h"
+#include "occupancy_grid.h"
+#include "line_index.h"
+#include "pose_history.h"
+#include "channel.h"
 
 extern volatile uint8_t gHandshook;
 extern volatile uint8_t gPaused;
 
 extern QueueHandle_t measurementQ;
-extern QueueHandle_t globalPoseQ;
+extern channel_t globalPoseChannel;
 extern TaskHandle_t xMappingTask;
 
+#ifndef OCCUPANCY_GRID
+/* Statically allocated buffers for the line extraction. The mapping task never
+uses the FreeRTOS heap, so a long mission cannot fragment it. */
+static point_buffer_t PointBuffers[NUMBER_OF_SENSORS];
+static line_buffer_t LineBuffers[NUMBER_OF_SENSORS];
+
+/* The two halves of the repo double buffer. mapping_repo_merge reads the
+current repo and writes the merged lines into the other one. */
+static line_repo_t RepoArena[2];
+
+/* Index of the lines in the current LineRepo, used to find merge candidates */
+static line_index_t RepoIndex;
+#endif /* OCCUPANCY_GRID */
+
+/* sin of every whole degree in [0,90], the servo angles of the tower. Kept
+in flash, generated with Python's math.sin. */
+static const float SinDeg[91] = {
+	0.0000000f, 0.0174524f, 0.0348995f, 0.0523360f, 0.0697565f, 0.0871557f, 0.1045285f, 0.1218693f,
+	0.1391731f, 0.1564345f, 0.1736482f, 0.1908090f, 0.2079117f, 0.2249511f, 0.2419219f, 0.2588190f,
+	0.2756374f, 0.2923717f, 0.3090170f, 0.3255682f, 0.3420201f, 0.3583679f, 0.3746066f, 0.3907311f,
+	0.4067366f, 0.4226183f, 0.4383711f, 0.4539905f, 0.4694716f, 0.4848096f, 0.5000000f, 0.5150381f,
+	0.5299193f, 0.5446390f, 0.5591929f, 0.5735764f, 0.5877853f, 0.6018150f, 0.6156615f, 0.6293204f,
+	0.6427876f, 0.6560590f, 0.6691306f, 0.6819984f, 0.6946584f, 0.7071068f, 0.7193398f, 0.7313537f,
+	0.7431448f, 0.7547096f, 0.7660444f, 0.7771460f, 0.7880108f, 0.7986355f, 0.8090170f, 0.8191520f,
+	0.8290376f, 0.8386706f, 0.8480481f, 0.8571673f, 0.8660254f, 0.8746197f, 0.8829476f, 0.8910065f,
+	0.8987940f, 0.9063078f, 0.9135455f, 0.9205049f, 0.9271839f, 0.9335804f, 0.9396926f, 0.9455186f,
+	0.9510565f, 0.9563048f, 0.9612617f, 0.9659258f, 0.9702957f, 0.9743701f, 0.9781476f, 0.9816272f,
+	0.9848078f, 0.9876883f, 0.9902681f, 0.9925462f, 0.9945219f, 0.9961947f, 0.9975641f, 0.9986295f,
+	0.9993908f, 0.9998477f, 1.0000000f,
+};
+
 void vMainMappingTask( void *pvParameters )
 {
-	// Initialize the buffers used for mapping operations. Each sensor has its
-	// own buffers that are allocated on the heap.
-	point_buffer_t *PointBuffers = pvPortMalloc(NUMBER_OF_SENSORS * sizeof(point_buffer_t));
-	line_buffer_t *LineBuffers = pvPortMalloc(NUMBER_OF_SENSORS * sizeof(line_buffer_t));
-	
-	// Set initial lengths to 0
+#ifdef OCCUPANCY_GRID
+	// The grid is statically allocated, only clear it
+	grid_init();
+#else
+	// Set initial lengths to 0. Each sensor has its own buffers.
 	for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
 		PointBuffers[i].len = 0;
 		LineBuffers[i].len = 0;
 	}
 
-	// Initialize the repo for storing the completely merged line segments
-	line_repo_t *LineRepo = pvPortMalloc(sizeof(line_repo_t));
+	// The repo for storing the completely merged line segments starts out in
+	// the first half of the arena
+	line_repo_t *LineRepo = &RepoArena[0];
 	LineRepo->len = 0;
-
-	// Verify allocation
-	configASSERT(PointBuffers && LineBuffers && LineRepo );
+	line_index_clear(&RepoIndex);
+#endif /* OCCUPANCY_GRID */
 
 	// Set task to run at a fixed frequency
 	/*
@@ -55,24 +89,43 @@ void vMainMappingTask( void *pvParameters )
 		
 		if (gHandshook == TRUE && gPaused == FALSE)
 		{
-			// Read the robots current pose
-			pose_t Pose;
-			xQueuePeek(globalPoseQ, &Pose, 10 / portTICK_PERIOD_MS);
+			// Block here waiting for measurement from the sensor tower.
+			measurement_t Measurement;
+			BaseType_t received = xQueueReceive(measurementQ, &Measurement, 200 / portTICK_PERIOD_MS);
+
+			// Read the robots current pose, after the wait so it is not stale
+			pose_t Pose = { 0 };
+			channel_read(&globalPoseChannel, &Pose);
+
+			// Use the pose the robot had when the measurement was taken. The
+			// tower samples between estimates, so wait for the estimate after it.
+			// If that times out, the newest pose is used.
+			if (received == pdTRUE)
+				pose_history_wait(Measurement.tick, &Pose, POSE_HISTORY_WAIT_MS / portTICK_PERIOD_MS);
 
 			// Convert to centimeters
-			Pose.x /= 10.0;
-			Pose.y /= 10.0;
+			Pose.x /= 10.0f;
+			Pose.y /= 10.0f;
 
 			// Put inside [0,2pi)
 			func_wrap_to_2pi(&Pose.theta);
 
-			// Block here waiting for measurement from the sensor tower.
-			measurement_t Measurement;
-			if (xQueueReceive(measurementQ, &Measurement, 200 / portTICK_PERIOD_MS) == pdTRUE) {				
-				// Append new IR measurements to the end of each PB
-				mapping_update_point_buffers(PointBuffers, Measurement, Pose);
+			if (received == pdTRUE) {
+				#ifdef OCCUPANCY_GRID
+					// Trace each of the beams into the grid
+					mapping_update_grid(Measurement, Pose);
+				#else
+					// Append new IR measurements to the end of each PB
+					mapping_update_point_buffers(PointBuffers, Measurement, Pose);
+				#endif /* OCCUPANCY_GRID */
 			}
-			
+
+			#if defined(OCCUPANCY_GRID) && defined(SEND_GRID)
+			// Send the next part of the grid to the server
+			mapping_send_grid();
+			#endif /* OCCUPANCY_GRID && SEND_GRID */
+
+			#ifndef OCCUPANCY_GRID
 			// Check for notification from sensor tower task. Do not wait.
 			if (ulTaskNotifyTake(pdTRUE, 0) == 1) {
 
@@ -82,24 +135,29 @@ void vMainMappingTask( void *pvParameters )
 					mapping_line_merge(&LineBuffers[j], LineRepo);
 				}
 
-				// Merge the repo with itself until it cannot be reduced further
-				uint8_t lastRepoLen;
+				// Merge the repo with itself until it cannot be reduced further.
+				// Each pass writes into the other half of the arena.
+				uint16_t lastRepoLen;
 				do {
 					lastRepoLen = LineRepo->len;
-					LineRepo = mapping_repo_merge(LineRepo);
-				} while (LineRepo->len < lastRepoLen);	
+					line_repo_t *MergedRepo = (LineRepo == &RepoArena[0]) ? &RepoArena[1] : &RepoArena[0];
+					mapping_repo_merge(LineRepo, MergedRepo);
+					LineRepo = MergedRepo;
+				} while (LineRepo->len < lastRepoLen);
 			}
 
 			line_t LineOut = { 0 };
 			if (LineRepo->len > 0) {
 				LineOut = LineRepo->buffer[LineRepo->len-1];
 				LineRepo->len--;
+				line_index_remove(&RepoIndex, LineRepo->len);
 			}
 
 			#ifdef SEND_LINE
 				// Send update to server. LineOut contains all zeroes if one was not available from the LineRepo.
 				send_line(ROUND(Pose.x), ROUND(Pose.y), ROUND(Pose.theta*RAD2DEG), LineOut);
 			#endif /* SEND_LINE */
+			#endif /* OCCUPANCY_GRID */
 		}
 
 		else {
@@ -110,24 +168,42 @@ void vMainMappingTask( void *pvParameters )
 	}
 }
 
+static point_t mapping_beam_direction(uint8_t servoStep, float heading) {
+	// Direction of the forward sensor relative to the robot, from the table.
+	// Steps past 90 degrees are mirrored, sin(180 - a) = sin(a).
+	float c, s;
+	if (servoStep <= 90) {
+		c = SinDeg[90 - servoStep];
+		s = SinDeg[servoStep];
+	} else {
+		configASSERT(servoStep <= 180);
+		c = -SinDeg[servoStep - 90];
+		s = SinDeg[180 - servoStep];
+	}
+
+	// One rotation by the heading of the robot
+	float cosHeading = func_cos(heading);
+	float sinHeading = func_sin(heading);
+
+	return (point_t) { c * cosHeading - s * sinHeading, s * cosHeading + c * sinHeading };
+}
+
+#ifndef OCCUPANCY_GRID
 static void mapping_update_point_buffers(point_buffer_t *Buffers, measurement_t Measurement, pose_t Pose) {
-	float towerAngle = (float) Measurement.servoStep * DEG2RAD; //[0,pi/2]
-	float theta = towerAngle + Pose.theta;
+	point_t Direction = mapping_beam_direction(Measurement.servoStep, Pose.theta);
 
 	for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
+		// The sensors are 90 degrees apart, which rotates the direction exactly
 		if (i > 0)
-			theta += 0.5 * M_PI;
+			Direction = (point_t) { -Direction.y, Direction.x };
 
-		func_wrap_to_2pi(&theta); //[0,2pi)
 		uint8_t r = Measurement.data[i];
 		// Abort if the measurement is outside the valid range
 		if (r <= 0 || r > 40)
 			continue;
 		
-		point_t Pos = func_polar2cart(theta, (float) r);
 		// Get the coordinates relative to the global coordinate system
-		Pos.x += Pose.x;
-		Pos.y += Pose.y;
+		point_t Pos = { Pose.x + r * Direction.x, Pose.y + r * Direction.y };
 		uint8_t currentLength = Buffers[i].len;
 		Buffers[i].buffer[currentLength] = Pos;
 		Buffers[i].len++;
@@ -140,47 +216,99 @@ static void mapping_update_point_buffers(point_buffer_t *Buffers, measurement_t
 	}
 }
 
+#endif /* OCCUPANCY_GRID */
+
+#ifdef OCCUPANCY_GRID
+static void mapping_update_grid(measurement_t Measurement, pose_t Pose) {
+	point_t Direction = mapping_beam_direction(Measurement.servoStep, Pose.theta);
+	point_t Origin = { Pose.x, Pose.y };
+
+	for (uint8_t i = 0; i < NUMBER_OF_SENSORS; i++) {
+		if (i > 0)
+			Direction = (point_t) { -Direction.y, Direction.x };
+
+		uint8_t r = Measurement.data[i];
+		// No reading at all from this sensor
+		if (r <= 0)
+			continue;
+
+		// Readings beyond the valid range only tell that the beam is free
+		uint8_t hit = (r <= MAX_IR_DISTANCE);
+		if (!hit)
+			r = MAX_IR_DISTANCE;
+
+		point_t End = { Pose.x + r * Direction.x, Pose.y + r * Direction.y };
+		grid_update_beam(Origin, End, hit);
+	}
+}
+
+#ifdef SEND_GRID
+static void mapping_send_grid(void) {
+	// One message per call, going through the grid row by row
+	static uint8_t row = 0;
+	static uint8_t column = 0;
+	int8_t cells[GRID_CELLS_PER_MESSAGE];
+
+	grid_read_row(row, column, cells, GRID_CELLS_PER_MESSAGE);
+	send_grid(row, column, cells);
+
+	column += GRID_CELLS_PER_MESSAGE;
+	if (column >= GRID_WIDTH) {
+		column = 0;
+		if (++row >= GRID_HEIGHT)
+			row = 0;
+	}
+}
+#endif /* SEND_GRID */
+#endif /* OCCUPANCY_GRID */
+
+#ifndef OCCUPANCY_GRID
+
 static void mapping_line_create(point_buffer_t *PointBuffer, line_buffer_t *LineBuffer) {
 	configASSERT(PointBuffer && LineBuffer);
 	configASSERT(LineBuffer->buffer);
 
 	LineBuffer->len = 0;
 
-	if (PointBuffer->len < 3) {
+	if (PointBuffer->len < LINE_FIT_MIN_POINTS) {
 		PointBuffer->len = 0;
 		return;
 	}
-	
-	point_t A = PointBuffer->buffer[0];
-	point_t B = PointBuffer->buffer[1];
-
-	for (uint8_t i = 2; i < PointBuffer->len; i++) {
-		line_t Line;
-		if (mapping_are_collinear(&A, &B, &PointBuffer->buffer[i])) {
-			if (i == PointBuffer->len-1) {
-				Line = (line_t) {
-					{A.x, A.y},
-					{PointBuffer->buffer[i].x, PointBuffer->buffer[i].y}
-				};
-			} else {
-				continue;
+
+	// Walk the points once, growing the current segment as long as each new
+	// point fits the line through the previous ones. Every point costs O(1).
+	line_fit_t Fit;
+	uint8_t first = 0;
+	mapping_fit_reset(&Fit, &PointBuffer->buffer[0]);
+
+	for (uint8_t i = 1; i < PointBuffer->len; i++) {
+		point_t *Point = &PointBuffer->buffer[i];
+
+		line_fit_t Next = Fit;
+		mapping_fit_add(&Next, Point);
+
+		uint8_t breaks = func_distance_squared(Point, &PointBuffer->buffer[i-1]) > LINE_FIT_MAX_GAP * LINE_FIT_MAX_GAP;
+		if (!breaks && Fit.n >= 2) {
+			breaks = mapping_fit_distance(&Fit, Point) > LINE_FIT_TOLERANCE ||
+					 mapping_fit_residual(&Next) > LINE_FIT_MAX_RESIDUAL;
+		}
+
+		if (breaks) {
+			// Point starts a new segment. Keep the finished one if it has enough points.
+			if (Fit.n >= LINE_FIT_MIN_POINTS) {
+				LineBuffer->buffer[LineBuffer->len] = mapping_fit_line(&Fit, &PointBuffer->buffer[first], &PointBuffer->buffer[i-1]);
+				LineBuffer->len++;
 			}
+			first = i;
+			mapping_fit_reset(&Fit, Point);
 		} else {
-			Line = (line_t) {
-				{A.x, A.y},
-				{PointBuffer->buffer[i-1].x, PointBuffer->buffer[i-1].y}
-			};
-			if (i > PointBuffer->len-3) {
-				break;
-			} else {
-				A = PointBuffer->buffer[i];
-				B = PointBuffer->buffer[i+1];
-				i++;
-			}
+			Fit = Next;
 		}
-		LineBuffer->buffer[LineBuffer->len] = Line;
+	}
+
+	if (Fit.n >= LINE_FIT_MIN_POINTS) {
+		LineBuffer->buffer[LineBuffer->len] = mapping_fit_line(&Fit, &PointBuffer->buffer[first], &PointBuffer->buffer[PointBuffer->len-1]);
 		LineBuffer->len++;
-		configASSERT(LineBuffer->buffer);
 	}
 
 	configASSERT(LineBuffer->len <= LB_SIZE);
@@ -194,30 +322,31 @@ static void mapping_line_merge(line_buffer_t *LineBuffer, line_repo_t *LineRepo)
 	configASSERT(LineBuffer->buffer);
 	configASSERT(LineRepo->buffer);
 
-	if (LineRepo->len == 0) {
-		for (uint8_t i = 0; i < LineBuffer->len; i++) {
-			LineRepo->buffer[i] = LineBuffer->buffer[i];
-			//configASSERT(LineRepo->buffer != NULL);
-			LineRepo->len++;
-		}
-	} else {
-		uint8_t newLen = LineRepo->len;
-		for (uint8_t j = 0; j < LineBuffer->len; j++) {
-			uint8_t merged = FALSE;
-			for (uint8_t k = 0; k < LineRepo->len; k++) {
-				if (mapping_is_mergeable(&LineBuffer->buffer[j], &LineRepo->buffer[k])) {
-					LineRepo->buffer[k] = mapping_merge_segments(&LineBuffer->buffer[j], &LineRepo->buffer[k]);
-					merged = TRUE;
-					break;
-				}
-			}
-			if (!merged) {
-				LineRepo->buffer[newLen] = LineBuffer->buffer[j];
-				newLen++;
+	for (uint8_t j = 0; j < LineBuffer->len; j++) {
+		line_t *Line = &LineBuffer->buffer[j];
+		uint8_t merged = FALSE;
+
+		// Only the lines sharing a bucket with Line can be mergeable. The
+		// candidates are in repo order, so the first mergeable one is used.
+		uint16_t n = line_index_query(&RepoIndex, Line);
+		for (uint16_t c = 0; c < n; c++) {
+			uint16_t k = RepoIndex.candidates[c];
+			if (mapping_is_mergeable(Line, &LineRepo->buffer[k])) {
+				LineRepo->buffer[k] = mapping_merge_segments(Line, &LineRepo->buffer[k]);
+				line_index_remove(&RepoIndex, k);
+				line_index_insert(&RepoIndex, &LineRepo->buffer[k], k);
+				merged = TRUE;
+				break;
 			}
 		}
-		LineRepo->len = newLen;
-		configASSERT(LineRepo->len <= L_SIZE);
+
+		// Lines that do not fit anywhere are added to the end of the repo.
+		// When the repo is full the line is dropped.
+		if (!merged && LineRepo->len < L_SIZE) {
+			LineRepo->buffer[LineRepo->len] = *Line;
+			line_index_insert(&RepoIndex, Line, LineRepo->len);
+			LineRepo->len++;
+		}
 	}
 
 	// Reset LineBuffer length
@@ -227,79 +356,92 @@ static void mapping_line_merge(line_buffer_t *LineBuffer, line_repo_t *LineRepo)
 static uint8_t mapping_is_mergeable(line_t *Line1, line_t *Line2) {
 	configASSERT(Line1 && Line2);
 
-    //MU = 0.5; // slope
-    //DELTA = 1.0; // cm
-
-    float m1 = func_get_slope(Line1);
-    float m2 = func_get_slope(Line2);
+	// Test angle between the lines, theta wraps around at pi
+	float dTheta = fabsf(Line1->theta - Line2->theta);
+	if (dTheta > 0.5f * M_PI_F)
+		dTheta = M_PI_F - dTheta;
 
-    // Test slope
-    if (fabs(m1 - m2) > MU)
-        return 0; // Slope-test failed
+	if (dTheta > MU)
+		return 0; // Angle-test failed
 
-    // Test distance between endpoints
-    float d1 = func_distance_between(&Line1->P, &Line2->P);
-    float d2 = func_distance_between(&Line1->P, &Line2->Q);
-    float d3 = func_distance_between(&Line1->Q, &Line2->P);
-    float d4 = func_distance_between(&Line1->Q, &Line2->Q);
+	// Test distance between endpoints
+	const float delta2 = DELTA * DELTA;
 
-    if ( (d1 <= DELTA) || (d2 <= DELTA) || (d3 <= DELTA) || (d4 <= DELTA) )
-        return 1;
-    
-    return 0;
+	return ( func_distance_squared(&Line1->P, &Line2->P) <= delta2 ||
+			 func_distance_squared(&Line1->P, &Line2->Q) <= delta2 ||
+			 func_distance_squared(&Line1->Q, &Line2->P) <= delta2 ||
+			 func_distance_squared(&Line1->Q, &Line2->Q) <= delta2 );
 }
 
 static line_t mapping_merge_segments(line_t *Line1, line_t *Line2) {
 	configASSERT(Line1 && Line2);
 
-	float a1 = func_get_slope(Line1);
-	float a2 = func_get_slope(Line2);
-	float b1 = Line1->P.y - a1 * Line1->P.x;
-	float b2 = Line2->P.y - a2 * Line2->P.x;
-	float l1 = func_distance_between(&Line1->P, &Line1->Q);
-	float l2 = func_distance_between(&Line2->P, &Line2->Q);
+	float l1 = Line1->length;
+	float l2 = Line2->length;
+	if (l1 + l2 <= 0)
+		return *Line1;
+
+	// (theta + pi, -rho) is the same line as (theta, rho). Move Line2 to the
+	// same side of the wrap as Line1 before averaging.
+	float theta2 = Line2->theta;
+	float rho2 = Line2->rho;
+	if (theta2 - Line1->theta > 0.5f * M_PI_F) {
+		theta2 -= M_PI_F;
+		rho2 = -rho2;
+	} else if (Line1->theta - theta2 > 0.5f * M_PI_F) {
+		theta2 += M_PI_F;
+		rho2 = -rho2;
+	}
 
 	// Find parameters for the merged line
-	float a = (l1 * a1 + l2 * a2) / (l1 + l2);
-	float b = (l1 * b1 + l2 * b2) / (l1 + l2);
-
-	// Find projections of all 4 points onto the merged line
-	point_t projectedPoints[] = { 
-		func_get_projected_point(Line1->P, a, b),
-		func_get_projected_point(Line2->P, a, b),
-		func_get_projected_point(Line1->Q, a, b),
-		func_get_projected_point(Line2->Q, a, b)
-	};
+	float theta = (l1 * Line1->theta + l2 * theta2) / (l1 + l2);
+	float rho = (l1 * Line1->rho + l2 * rho2) / (l1 + l2);
+	if (theta < 0) {
+		theta += M_PI_F;
+		rho = -rho;
+	} else if (theta >= M_PI_F) {
+		theta -= M_PI_F;
+		rho = -rho;
+	}
 
-	// Find the points farthest away from each other
-	point_t P = projectedPoints[0];
-	point_t Q = P;
+	// Position of all 4 endpoints along the merged line, with direction (-s, c)
+	float c = func_cos(theta);
+	float s = func_sin(theta);
+	point_t *Endpoints[] = { &Line1->P, &Line1->Q, &Line2->P, &Line2->Q };
+	float tMin = c * Endpoints[0]->y - s * Endpoints[0]->x;
+	float tMax = tMin;
 
 	for (uint8_t i = 1; i < 4; i++) {
-		if (projectedPoints[i].x < P.x)
-			P = projectedPoints[i];
-		
-		if (projectedPoints[i].x > P.x)
-			Q = projectedPoints[i];
+		float t = c * Endpoints[i]->y - s * Endpoints[i]->x;
+		if (t < tMin)
+			tMin = t;
+		if (t > tMax)
+			tMax = t;
 	}
 
-	return (line_t) { P, Q };
+	// The points farthest away from each other, projected onto the merged line
+	point_t P = { rho * c - tMin * s, rho * s + tMin * c };
+	point_t Q = { rho * c - tMax * s, rho * s + tMax * c };
+
+	return (line_t) { P, Q, (l1 * Line1->residual + l2 * Line2->residual) / (l1 + l2), theta, rho, tMax - tMin };
 }
 
-static line_repo_t* mapping_repo_merge(line_buffer_t *Repo) {
-	configASSERT(Repo);
+static void mapping_repo_merge(line_repo_t *Repo, line_repo_t *MergedRepo) {
+	configASSERT(Repo && MergedRepo && Repo != MergedRepo);
 
-	// Allocate memory on the heap for the resulting repo
-	line_repo_t *MergedRepo = pvPortMalloc(sizeof(line_repo_t));
 	MergedRepo->len = 0;
 
-	for (uint8_t i = 0; i < Repo->len; i++) {
+	for (uint16_t i = 0; i < Repo->len; i++) {
 
 		if (!mapping_is_empty(Repo->buffer[i])) {
 			uint8_t merged = FALSE;
-			for (uint8_t j = i + 1; j < Repo->len; j++) {
 
-				if (!mapping_is_empty(Repo->buffer[j])) {
+			// RepoIndex still describes Repo, so it gives the candidates for line i
+			uint16_t n = line_index_query(&RepoIndex, &Repo->buffer[i]);
+			for (uint16_t c = 0; c < n; c++) {
+				uint16_t j = RepoIndex.candidates[c];
+
+				if (j > i && !mapping_is_empty(Repo->buffer[j])) {
 					if (mapping_is_mergeable(&Repo->buffer[i], &Repo->buffer[j])) {
 						// Add merged line to MergedRepo
 						MergedRepo->buffer[MergedRepo->len] = mapping_merge_segments(&Repo->buffer[i], &Repo->buffer[j]);
@@ -322,16 +464,98 @@ static line_repo_t* mapping_repo_merge(line_buffer_t *Repo) {
 		
 	}
 
-	// Free the memory from the original repo and return a pointer to the merged one
-	vPortFree(Repo);
-	Repo = NULL;
-	return MergedRepo;
+	// Rebuild the index for the merged repo
+	line_index_clear(&RepoIndex);
+	for (uint16_t i = 0; i < MergedRepo->len; i++)
+		line_index_insert(&RepoIndex, &MergedRepo->buffer[i], i);
+
+	// The lines of Repo are now all in MergedRepo, and Repo can be reused
+	Repo->len = 0;
+}
+
+static void mapping_fit_reset(line_fit_t *Fit, point_t *First) {
+	*Fit = (line_fit_t) { *First, 1, 0, 0, 0, 0, 0 };
+}
+
+static void mapping_fit_add(line_fit_t *Fit, point_t *Point) {
+	float x = Point->x - Fit->Origin.x;
+	float y = Point->y - Fit->Origin.y;
+
+	Fit->n++;
+	Fit->sx += x;
+	Fit->sy += y;
+	Fit->sxx += x * x;
+	Fit->syy += y * y;
+	Fit->sxy += x * y;
+}
+
+static void mapping_fit_moments(line_fit_t *Fit, point_t *Mean, float *cxx, float *cyy, float *cxy) {
+	float n = (float) Fit->n;
+
+	Mean->x = Fit->sx / n;
+	Mean->y = Fit->sy / n;
+	*cxx = Fit->sxx / n - Mean->x * Mean->x;
+	*cyy = Fit->syy / n - Mean->y * Mean->y;
+	*cxy = Fit->sxy / n - Mean->x * Mean->y;
 }
 
-static uint8_t mapping_are_collinear(point_t *a, point_t *b, point_t *c) {
-    return fabs( (a->y - b->y) * (a->x - c->x) - (a->y - c->y) * (a->x - b->x) ) <= COLLINEAR_TOLERANCE;
+static point_t mapping_fit_direction(float cxx, float cyy, float cxy) {
+	// Eigenvector of the largest eigenvalue of the covariance matrix
+	float lambda = 0.5f * (cxx + cyy) + sqrtf(0.25f * (cxx - cyy) * (cxx - cyy) + cxy * cxy);
+	point_t U = (cxx >= cyy) ? (point_t) { lambda - cyy, cxy } : (point_t) { cxy, lambda - cxx };
+
+	float norm = sqrtf(U.x * U.x + U.y * U.y);
+	if (norm <= 0)
+		return (point_t) { 1, 0 };
+
+	return (point_t) { U.x / norm, U.y / norm };
+}
+
+static float mapping_fit_residual(line_fit_t *Fit) {
+	point_t Mean;
+	float cxx, cyy, cxy;
+	mapping_fit_moments(Fit, &Mean, &cxx, &cyy, &cxy);
+
+	// The smallest eigenvalue of the covariance matrix is the mean squared
+	// distance of the points from the best line through them
+	float lambda = 0.5f * (cxx + cyy) - sqrtf(0.25f * (cxx - cyy) * (cxx - cyy) + cxy * cxy);
+	if (lambda <= 0)
+		return 0;
+
+	return sqrtf(lambda);
+}
+
+static float mapping_fit_distance(line_fit_t *Fit, point_t *Point) {
+	point_t Mean;
+	float cxx, cyy, cxy;
+	mapping_fit_moments(Fit, &Mean, &cxx, &cyy, &cxy);
+	point_t U = mapping_fit_direction(cxx, cyy, cxy);
+
+	float dx = Point->x - Fit->Origin.x - Mean.x;
+	float dy = Point->y - Fit->Origin.y - Mean.y;
+	return fabsf(dx * U.y - dy * U.x);
+}
+
+static line_t mapping_fit_line(line_fit_t *Fit, point_t *First, point_t *Last) {
+	point_t Mean;
+	float cxx, cyy, cxy;
+	mapping_fit_moments(Fit, &Mean, &cxx, &cyy, &cxy);
+	point_t U = mapping_fit_direction(cxx, cyy, cxy);
+
+	// The endpoints are the first and last point projected onto the fitted line
+	Mean.x += Fit->Origin.x;
+	Mean.y += Fit->Origin.y;
+	float s1 = (First->x - Mean.x) * U.x + (First->y - Mean.y) * U.y;
+	float s2 = (Last->x - Mean.x) * U.x + (Last->y - Mean.y) * U.y;
+
+	point_t P = { Mean.x + s1 * U.x, Mean.y + s1 * U.y };
+	point_t Q = { Mean.x + s2 * U.x, Mean.y + s2 * U.y };
+
+	return func_line_from_points(P, Q, mapping_fit_residual(Fit));
 }
 
 static uint8_t mapping_is_empty(line_t line) {
 	return ( line.P.x == 0 && line.P.y == 0 && line.Q.x == 0 && line.Q.y == 0 );
-}
\ No newline at end of file
+}
+
+#endif /* OCCUPANCY_GRID */
@@ -3,7 +3,8 @@
 // Author:			Geir Eikeland, NTNU Spring 2018
 //
 // The functions that are used in the mapping task. Most are declared static
-// since they are only used here.
+// since they are only used here. All buffers used by the task are statically
+// allocated in mapping.c, and the task does not use the FreeRTOS heap.
 //
 //
 /************************************************************************/
@@ -15,6 +16,19 @@
 
 void vMainMappingTask( void *pvParameters );
 
+/**
+ * @brief      Calculates the global direction of the forward sensor beam. The
+ *             tower angle is read from a table, and rotated once by the
+ *             heading. The other sensors are 90 degree rotations of it.
+ *
+ * @param[in]  servoStep  The tower angle [deg]
+ * @param[in]  heading    The heading of the robot [rad]
+ *
+ * @return     Unit vector along the beam
+ */
+static point_t mapping_beam_direction(uint8_t servoStep, float heading);
+
+#ifndef OCCUPANCY_GRID
 /**
  * @brief      Updates each of the point buffers corresponding to each distance
  *             sensor with a position calculated from the given measurement data
@@ -25,10 +39,35 @@ void vMainMappingTask( void *pvParameters );
  * @param[in]  Pose         The current pose of the robot
  */
 static void mapping_update_point_buffers(point_buffer_t *Buffers, measurement_t Measurement, pose_t Pose);
+#endif /* OCCUPANCY_GRID */
+
+#ifdef OCCUPANCY_GRID
+/**
+ * @brief      Traces each of the IR beams in a measurement into the occupancy
+ *             grid. Only used when OCCUPANCY_GRID is defined.
+ *
+ * @param[in]  Measurement  A struct containing measurement data
+ * @param[in]  Pose         The current pose of the robot
+ */
+static void mapping_update_grid(measurement_t Measurement, pose_t Pose);
 
+#ifdef SEND_GRID
 /**
- * @brief      Checks the points in the point buffers for collinearity, and adds
- *             the extracted line segments to the line buffer.
+ * @brief      Sends the next GRID_CELLS_PER_MESSAGE cells of the occupancy grid
+ *             to the server, going through the grid row by row. Only used when
+ *             OCCUPANCY_GRID and SEND_GRID are defined.
+ */
+static void mapping_send_grid(void);
+#endif /* SEND_GRID */
+#endif /* OCCUPANCY_GRID */
+
+#ifndef OCCUPANCY_GRID
+/**
+ * @brief      Fits lines to the points in the point buffer with incremental
+ *             least squares, and adds the extracted line segments to the line
+ *             buffer. A point that lies too far from the line through the
+ *             previous points, or too far from the previous point, starts a
+ *             new segment.
  *
  * @param      PointBuffer  A pointer to a point buffer
  * @param      LineBuffer   A pointer to a line buffer
@@ -36,10 +75,11 @@ static void mapping_update_point_buffers(point_buffer_t *Buffers, measurement_t
 static void mapping_line_create(point_buffer_t *PointBuffer, line_buffer_t *LineBuffer);
 
 /**
- * @brief      Compare all the lines in the LineBuffer with the ones in
- *             LineRepo, and replaces the ones in LineRepo with the ones that
- *             can be merged. If a line cannot be merged it is added to the end
- *             of the LineRepo.
+ * @brief      Compare all the lines in the LineBuffer with the merge
+ *             candidates in LineRepo found through the line index, and
+ *             replaces the ones in LineRepo with the ones that can be merged.
+ *             If a line cannot be merged it is added to the end of the
+ *             LineRepo.
  *
  * @param      LineBuffer  A reference to a LineBuffer
  * @param      LineRepo    A reference to the LineRepo
@@ -47,7 +87,9 @@ static void mapping_line_create(point_buffer_t *PointBuffer, line_buffer_t *Line
 static void mapping_line_merge(line_buffer_t *LineBuffer, line_repo_t *LineRepo);
 
 /**
- * @brief      Determine if 2 lines are eligible for merging.
+ * @brief      Determine if 2 lines are eligible for merging. The angle between
+ *             them must be at most MU, and an endpoint of one must be within
+ *             DELTA of an endpoint of the other.
  *
  * @param      Line1  The line 1
  * @param      Line2  The line 2
@@ -58,7 +100,9 @@ static uint8_t mapping_is_mergeable(line_t *Line1, line_t *Line2);
 
 /**
  * @brief      Merges two lines and returns a new line from the calculated
- *             parameters.
+ *             parameters. The normal form of the new line is the length
+ *             weighted average of the two, and its endpoints are the outermost
+ *             of the four endpoints projected onto it.
  *
  * @param      Line1  The line 1
  * @param      Line2  The line 2
@@ -68,25 +112,77 @@ static uint8_t mapping_is_mergeable(line_t *Line1, line_t *Line2);
 static line_t mapping_merge_segments(line_t *Line1, line_t *Line2);
 
 /**
- * @brief      Merges the lines in the repo with each other until it cannot be
- *             reduced further.
+ * @brief      Merges each line in the repo with the later lines that the line
+ *             index reports as candidates, and writes the result to the other
+ *             half of the repo double buffer. The index is rebuilt for the
+ *             merged repo, and Repo is left empty.
  *
- * @param      Repo  A LineRepo
+ * @param      Repo        A LineRepo
+ * @param      MergedRepo  The LineRepo to write the merged lines to
+ */
+static void mapping_repo_merge(line_repo_t *Repo, line_repo_t *MergedRepo);
+
+/**
+ * @brief      Starts a new line fit with a single point.
  *
- * @return     A LineRepo of merged lines
+ * @param      Fit    The line fit
+ * @param      First  The first point of the segment
  */
-static line_repo_t* mapping_repo_merge(line_buffer_t *Repo);
+static void mapping_fit_reset(line_fit_t *Fit, point_t *First);
 
 /**
- * @brief      Check if 3 points are collinear within a given tolerance
+ * @brief      Adds a point to the running sums of a line fit.
  *
- * @param      a     A point (x,y)
- * @param      b     A point (x,y)
- * @param      c     A point (x,y)
+ * @param      Fit    The line fit
+ * @param      Point  The point
+ */
+static void mapping_fit_add(line_fit_t *Fit, point_t *Point);
+
+/**
+ * @brief      Calculates the mean and covariance of the points in a line fit,
+ *             relative to the origin of the fit.
+ */
+static void mapping_fit_moments(line_fit_t *Fit, point_t *Mean, float *cxx, float *cyy, float *cxy);
+
+/**
+ * @brief      Finds the unit direction vector of the total least squares line
+ *             for the given covariance.
+ *
+ * @return     The direction of the line
+ */
+static point_t mapping_fit_direction(float cxx, float cyy, float cxy);
+
+/**
+ * @brief      Calculates the RMS distance of the points in a line fit from the
+ *             fitted line.
+ *
+ * @param      Fit   The line fit
  *
- * @return     1 if the points are collinear
+ * @return     The residual [cm]
+ */
+static float mapping_fit_residual(line_fit_t *Fit);
+
+/**
+ * @brief      Calculates the distance of a point from the fitted line.
+ *
+ * @param      Fit    The line fit
+ * @param      Point  The point
+ *
+ * @return     The distance [cm]
+ */
+static float mapping_fit_distance(line_fit_t *Fit, point_t *Point);
+
+/**
+ * @brief      Creates the line segment of a line fit. The endpoints are the
+ *             first and last point of the segment projected onto the line.
+ *
+ * @param      Fit    The line fit
+ * @param      First  The first point of the segment
+ * @param      Last   The last point of the segment
+ *
+ * @return     A line segment
  */
-static uint8_t mapping_are_collinear(point_t *a, point_t *b, point_t *c);
+static line_t mapping_fit_line(line_fit_t *Fit, point_t *First, point_t *Last);
 
 /**
  * @brief      Checks if all values in the line coordinates are 0.
@@ -96,5 +192,6 @@ static uint8_t mapping_are_collinear(point_t *a, point_t *b, point_t *c);
  * @return     1 if the line is empty
  */
 static uint8_t mapping_is_empty(line_t line);
+#endif /* OCCUPANCY_GRID */
 
 #endif
\ No newline at end of file
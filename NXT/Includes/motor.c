@@ -3,22 +3,42 @@
 /* Kernel includes */
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "task.h"
 
 #include <math.h>
 
 #include "defines.h"
 #include "nxt_motors.h"
+#include "nxt_avr.h"
 #include "display.h"
 
 
 #define SPEED 50
 #define TOWER_SPEED 20
 
-#define TICKS_PER_DEGREE 7.1
+#define TICKS_PER_DEGREE 14.2
+
+/* Wheel velocity control, tuned on a first order motor model with 2 ms of
+ * actuation delay, over +-25% motor constant and 7.2-9 V battery */
+#define VELOCITY_PERIOD_MS      5
+#define VELOCITY_KP             0.8f    /* [% per mm/s] */
+#define VELOCITY_KI             10.0f   /* [% per mm]   */
+#define VELOCITY_FF_MV_PER_MMPS 18.8f   /* [mV per mm/s] Back-EMF, ~480 mm/s at 9 V without load */
+#define VELOCITY_FF_STATIC_MV   600.0f  /* [mV] Voltage needed to overcome friction */
+#define BATTERY_NOMINAL_MV      8000.0f /* Used until the AVR reports the battery */
 
 extern volatile uint8_t gHandshook;
 
-extern QueueHandle_t wheelTicksQ;
+/* Wheel speed setpoints in mm/s, used while velocityControl is set */
+static volatile float leftSetpoint = 0;
+static volatile float rightSetpoint = 0;
+static volatile uint8_t velocityControl = FALSE;
+
+/* Forward speed and turn, half the wheel speed difference, as given to the
+ * velocity control. They follow the setpoints within the motion limits */
+static motion_profile_t ForwardProfile = {0};
+static motion_profile_t TurnProfile = {0};
+
 
 void vMotor_init(void) {
   nxt_motor_set_speed(servoLeft, 0, 1);
@@ -50,16 +70,18 @@ static void vMotorMoveRightBackward(uint8_t actuation, uint8_t *rightWheelDirect
     *rightWheelDirection = motorBackward;
 }
 
-static void vMotorBrakeLeft() {
+void vMotorBrakeLeft(void) {
 	nxt_motor_set_speed(servoLeft, 0, 1); // use break here?
 }
 
-static void vMotorBrakeRight() {
+void vMotorBrakeRight(void) {
 	nxt_motor_set_speed(servoRight, 0, 1); // use break here?
 }
 
 /* Switch for robot movement to abstract the logic away from main */
 void vMotorMovementSwitch(int16_t leftSpeed, int16_t rightSpeed, uint8_t *leftWheelDirection, uint8_t *rightWheelDirection){
+    velocityControl = FALSE;
+
     if (leftSpeed > 0) {
 		vMotorMoveLeftForward(leftSpeed, leftWheelDirection);
     } else if(leftSpeed < 0) {
@@ -77,48 +99,120 @@ void vMotorMovementSwitch(int16_t leftSpeed, int16_t rightSpeed, uint8_t *leftWh
 	}
 }
 
+void vMotorSetVelocity(float leftSpeed, float rightSpeed) {
+  taskENTER_CRITICAL();
+  leftSetpoint = leftSpeed;
+  rightSetpoint = rightSpeed;
+  velocityControl = TRUE;
+  taskEXIT_CRITICAL();
+}
+
+/* PI on the wheel speed, on top of the duty cycle that gives the setpoint at steady state */
+static int16_t sMotorVelocityPI(float setpoint, float velocity, float batteryMv, float *integral) {
+  if (setpoint == 0) {
+    *integral = 0;
+    return 0;
+  }
+
+  float feedForward = 100.0f * (VELOCITY_FF_MV_PER_MMPS * setpoint + (setpoint > 0 ? VELOCITY_FF_STATIC_MV : -VELOCITY_FF_STATIC_MV)) / batteryMv;
+  float error = setpoint - velocity;
+  float actuation = feedForward + VELOCITY_KP * error + *integral;
+
+  // Stop integrating while saturated in the direction of the error
+  if ((actuation < 100 || error < 0) && (actuation > -100 || error > 0))
+    *integral += VELOCITY_KI * error * (VELOCITY_PERIOD_MS / 1000.0f);
+
+  if (actuation > 100) {
+    actuation = 100;
+  } else if (actuation < -100) {
+    actuation = -100;
+  }
+  return (int16_t) ROUND(actuation);
+}
+
+/* One step of an S-curve towards target. The acceleration ramps with the jerk
+ * limit, and starts ramping down in time to reach zero at the target */
+static float sMotorProfileStep(motion_profile_t *Profile, float target, float acceleration, float jerk) {
+  const float dt = VELOCITY_PERIOD_MS / 1000.0f;
+  float error = target - Profile->velocity;
+  float stopping = Profile->acceleration * fabsf(Profile->acceleration) / (2 * jerk);
+
+  if (error > stopping) {
+    Profile->acceleration += jerk * dt;
+  } else {
+    Profile->acceleration -= jerk * dt;
+  }
+
+  if (Profile->acceleration > acceleration) {
+    Profile->acceleration = acceleration;
+  } else if (Profile->acceleration < -acceleration) {
+    Profile->acceleration = -acceleration;
+  }
+
+  float velocity = Profile->velocity + Profile->acceleration * dt;
+
+  // Settle on the target instead of passing it
+  if ((target - velocity) * error <= 0) {
+    velocity = target;
+    Profile->acceleration = 0;
+  }
+
+  Profile->velocity = velocity;
+  return velocity;
+}
+
+void vMotorVelocityControl(void) {
+  static uint8_t ticks = 0;
+  static float leftIntegral = 0;
+  static float rightIntegral = 0;
+
+  if (++ticks < VELOCITY_PERIOD_MS)
+    return;
+  ticks = 0;
+
+  if (!velocityControl) {
+    leftIntegral = 0;
+    rightIntegral = 0;
+    ForwardProfile.velocity = ForwardProfile.acceleration = 0;
+    TurnProfile.velocity = TurnProfile.acceleration = 0;
+    return;
+  }
+
+  float forward = sMotorProfileStep(&ForwardProfile, (leftSetpoint + rightSetpoint) / 2, MOTION_ACCELERATION, MOTION_JERK);
+  float turn = sMotorProfileStep(&TurnProfile, (rightSetpoint - leftSetpoint) / 2, MOTION_TURN_ACCELERATION, MOTION_JERK);
+
+  float batteryMv = (float) battery_voltage();
+  if (batteryMv < 1000)
+    batteryMv = BATTERY_NOMINAL_MV;
+
+  float leftVelocity = nxt_motor_get_velocity(servoLeft) * WHEEL_FACTOR_MM;
+  float rightVelocity = nxt_motor_get_velocity(servoRight) * WHEEL_FACTOR_MM;
+
+  nxt_motor_set_speed(servoLeft, sMotorVelocityPI(forward - turn, leftVelocity, batteryMv, &leftIntegral), 1);
+  nxt_motor_set_speed(servoRight, sMotorVelocityPI(forward + turn, rightVelocity, batteryMv, &rightIntegral), 1);
+}
+
 void vMotorSetAngle(uint8_t motor, int16_t angle) {
   angle = -angle; //Application code uses opposite encoder values to the nxt
   if(angle < -90) angle = -90;
   nxt_motor_command(motor, (int) floor(angle*TICKS_PER_DEGREE), TOWER_SPEED);
 }
 
-void vMotorCountUpdate(void) {
-  wheel_ticks_t WheelTicks;
-  WheelTicks.right = nxt_motor_get_count(servoRight);
-  WheelTicks.left = nxt_motor_get_count(servoLeft);
-  // Pass the motor count values to the global queue containing wheel ticks
-  xQueueOverwrite(wheelTicksQ, &WheelTicks);
-}
-
-/* Handle ISR ticks from encoder, Please note that we are losing accuracy here due to division */
-void vMotorEncoderLeftTickFromISR(uint8_t wheelDirection, int16_t *leftWheelTicks, uint8_t leftEncoderTicks){
-    switch (wheelDirection){
-        case motorForward:{
-            *leftWheelTicks += leftEncoderTicks / 2;
-            break;
-        }
-        case  motorBackward:{
-            *leftWheelTicks -= leftEncoderTicks / 2;
-            break;
-        }
-        default:
-        // We have a count when the robot is supposedly not moving.
-        break;
-    }
-}
-void vMotorEncoderRightTickFromISR(uint8_t wheelDirection, int16_t *rightWheelTicks, uint8_t rightEncoderTicks){
-    switch (wheelDirection){
-        case motorForward:{
-            *rightWheelTicks += rightEncoderTicks / 2;
-            break;
-        }
-        case  motorBackward:{
-            *rightWheelTicks -= rightEncoderTicks / 2;
-            break;
-        }
-        default:
-        // We have a count when the robot is supposedly not moving.
-        break;
-    }
-}
\ No newline at end of file
+uint8_t ucMotorAngleReached(uint8_t motor) {
+  return !nxt_motor_has_target(motor);
+}
+
+float fMotorGetSpeed(void) {
+  return (nxt_motor_get_velocity(servoLeft) + nxt_motor_get_velocity(servoRight)) * (WHEEL_FACTOR_MM / 2);
+}
+
+void vMotorGetWheelTicks(wheel_ticks_t *WheelTicks) {
+  // Read both counts at the same instant, the encoder interrupt only waits for two loads
+  taskENTER_CRITICAL();
+  int right = nxt_motor_get_count(servoRight);
+  int left = nxt_motor_get_count(servoLeft);
+  taskEXIT_CRITICAL();
+
+  WheelTicks->right = right;
+  WheelTicks->left = left;
+}
@@ -19,14 +19,18 @@
 void vMotorMovementSwitch(int16_t leftSpeed, int16_t rightSpeed, uint8_t *leftWheelDirection, uint8_t *rightWheelDirection); // new
 void vMotorBrakeLeft(void);
 void vMotorBrakeRight(void);                                                                                                                              
-void vMotorCountUpdate(void);
+/* Snapshot of the encoder counts of both wheels, for the pose estimator */
+void vMotorGetWheelTicks(wheel_ticks_t *WheelTicks);
 void vMotor_init(void);
+/* Closed loop wheel speeds in mm/s, held until the next call or vMotorMovementSwitch.
+ * The wheels get there within MOTION_ACCELERATION, MOTION_TURN_ACCELERATION and MOTION_JERK */
+void vMotorSetVelocity(float leftSpeed, float rightSpeed);
+/* Runs the wheel velocity control, called every ms from the 1 kHz task */
+void vMotorVelocityControl(void);
 void vMotorSetAngle(uint8_t motor, int16_t angle);
-
-/* Handle ISR ticks from encoder */
-void vMotorEncoderLeftTickFromISR(uint8_t wheelDirection, int16_t *leftWheelTicks, uint8_t leftEncoderTicks);
-
-/* Handle ISR ticks from encoder */
-void vMotorEncoderRightTickFromISR(uint8_t wheelDirection, int16_t *rightWheelTicks, uint8_t rightEncoderTicks);
+/* Whether the motor has got to the angle of the last vMotorSetAngle */
+uint8_t ucMotorAngleReached(uint8_t motor);
+/* Forward speed of the robot in mm/s, from the wheel encoders */
+float fMotorGetSpeed(void);
 
 #endif
@@ -17,10 +17,27 @@
 #include "task.h"
 #include "nxt_lcd.h"
 #include "led.h"
+#include "defines.h"
 
 #define FALSE 0
 #define TRUE 1
 
+#ifdef HEAP_STATS
+// Lowest free heap seen by the 1 Hz task. Read it with the debugger after a
+// mission to see how much of configTOTAL_HEAP_SIZE is left over
+volatile size_t gHeapMinimumFree = ( size_t ) -1;
+#endif
+
+#ifdef TASK_LOAD_STATS
+// Share of each tick spent in the 1 kHz task body, in permille, averaged over one second
+volatile uint16_t gTask1000HzLoad = 0;
+
+// Position within the current tick, in PIT counts since the last tick interrupt
+static uint32_t ulPitCount(void) {
+  return AT91C_BASE_PITC->PITC_PIIR & AT91C_SYSC_CPIV;
+}
+#endif
+
 extern TaskHandle_t xPoseCtrlTask; // For direct to pose controller notification
 
 void vTask1000Hz( void *pvParameters );
@@ -35,7 +52,7 @@ void nxt_init(void) {
   vMotor_init();
   prvSetupHardware();
   
-  xTaskCreate(vTask1000Hz, "1000Hz", 75, NULL, 5, NULL);
+  xTaskCreate(vTask1000Hz, "1000Hz", 100, NULL, 5, NULL);
   xTaskCreate(vTask1Hz, "1Hz", 75, NULL, 1, NULL);
   
   display_clear(1);
@@ -61,13 +78,20 @@ void vTask1000Hz( void *pvParameters ) {
   const TickType_t xDelay = 1 / portTICK_PERIOD_MS;
   TickType_t xLastWakeTime;
   xLastWakeTime = xTaskGetTickCount();
+#ifdef TASK_LOAD_STATS
+  const uint32_t ulPitPeriod = (AT91C_BASE_PITC->PITC_PIMR & AT91C_SYSC_PIV) + 1;
+  uint32_t ulBusyCounts = 0;
+  uint16_t usRuns = 0;
+#endif
   
   while(1) {
 	vTaskDelayUntil(&xLastWakeTime, xDelay);
+#ifdef TASK_LOAD_STATS
+	uint32_t ulStart = ulPitCount();
+#endif
 	nxt_avr_1kHz_update();
 	nxt_motor_1kHz_process();
-	
-	vMotorCountUpdate();
+	vMotorVelocityControl();
 	
 	if(buttons_get() & 0x8) {
       nxt_motor_set_speed(0, 0, 1);
@@ -76,6 +100,16 @@ void vTask1000Hz( void *pvParameters ) {
 	  nxt_lcd_power_down();
 	  nxt_avr_power_down();
 	}
+#ifdef TASK_LOAD_STATS
+	// The body is far shorter than a tick, so the counter wraps at most once
+	uint32_t ulEnd = ulPitCount();
+	ulBusyCounts += (ulEnd >= ulStart) ? ulEnd - ulStart : ulEnd + ulPitPeriod - ulStart;
+	if (++usRuns == 1000) {
+	  gTask1000HzLoad = (uint16_t) (ulBusyCounts / ulPitPeriod);
+	  ulBusyCounts = 0;
+	  usRuns = 0;
+	}
+#endif
   }
 }
 
@@ -90,6 +124,10 @@ void vTask1Hz( void *pvParameters ) {
   
   while(1) {
 	vTaskDelayUntil(&xLastWakeTime, xDelay);
+#ifdef HEAP_STATS
+	size_t xFree = xPortGetFreeHeapSize();
+	if (xFree < gHeapMinimumFree) gHeapMinimumFree = xFree;
+#endif
   
 	if(dongle_connected() != prev_dongle_status) {
 	  prev_dongle_status = dongle_connected();
@@ -0,0 +1,85 @@
+#include "occupancy_grid.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "FreeRTOS.h"
+
+#include "defines.h"
+
+#ifdef OCCUPANCY_GRID
+
+/* The map, row major. GRID_WIDTH * GRID_HEIGHT bytes of static RAM. */
+static int8_t grid[GRID_HEIGHT][GRID_WIDTH];
+
+static int16_t grid_cell_from_cm(float coordinate, int16_t origin) {
+	return (int16_t) floorf(coordinate / GRID_CELL_SIZE_CM) + origin;
+}
+
+static void grid_add(int16_t cx, int16_t cy, int8_t logOdds) {
+	if (cx < 0 || cx >= GRID_WIDTH || cy < 0 || cy >= GRID_HEIGHT)
+		return;
+
+	// Saturate instead of wrapping around
+	int16_t value = grid[cy][cx] + logOdds;
+	if (value > LOG_ODDS_MAX)
+		value = LOG_ODDS_MAX;
+	else if (value < LOG_ODDS_MIN)
+		value = LOG_ODDS_MIN;
+
+	grid[cy][cx] = (int8_t) value;
+}
+
+void grid_init(void) {
+	memset(grid, 0, sizeof(grid));
+}
+
+void grid_update_beam(point_t Origin, point_t End, uint8_t hit) {
+	int16_t x0 = grid_cell_from_cm(Origin.x, GRID_ORIGIN_X);
+	int16_t y0 = grid_cell_from_cm(Origin.y, GRID_ORIGIN_Y);
+	int16_t x1 = grid_cell_from_cm(End.x, GRID_ORIGIN_X);
+	int16_t y1 = grid_cell_from_cm(End.y, GRID_ORIGIN_Y);
+
+	int16_t dx = abs(x1 - x0);
+	int16_t dy = -abs(y1 - y0);
+	int16_t sx = (x0 < x1) ? 1 : -1;
+	int16_t sy = (y0 < y1) ? 1 : -1;
+	int16_t err = dx + dy;
+
+	// Every cell the beam passes through before the end point is free
+	while (x0 != x1 || y0 != y1) {
+		grid_add(x0, y0, LOG_ODDS_MISS);
+
+		int16_t e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+
+	grid_add(x1, y1, hit ? LOG_ODDS_HIT : LOG_ODDS_MISS);
+}
+
+int8_t grid_get_cell(point_t Position) {
+	int16_t cx = grid_cell_from_cm(Position.x, GRID_ORIGIN_X);
+	int16_t cy = grid_cell_from_cm(Position.y, GRID_ORIGIN_Y);
+
+	if (cx < 0 || cx >= GRID_WIDTH || cy < 0 || cy >= GRID_HEIGHT)
+		return 0;
+
+	return grid[cy][cx];
+}
+
+void grid_read_row(uint8_t row, uint8_t column, int8_t *cells, uint8_t count) {
+	configASSERT(cells && row < GRID_HEIGHT && column + count <= GRID_WIDTH);
+
+	memcpy(cells, &grid[row][column], count);
+}
+
+#endif /* OCCUPANCY_GRID */
@@ -0,0 +1,57 @@
+/************************************************************************/
+// File:			occupancy_grid.h
+//
+// Fixed-size log-odds occupancy grid used by the mapping task when
+// OCCUPANCY_GRID is defined. Every cell is a signed byte holding the log-odds
+// of the cell being occupied, so the whole map is a single static array of
+// GRID_WIDTH * GRID_HEIGHT bytes and is never allocated on the heap.
+//
+// Beams are traced with integer Bresenham. All cells between the sensor and
+// the measured point are made less likely to be occupied, and the cell of
+// the measured point is made more likely to be occupied.
+//
+/************************************************************************/
+
+#ifndef OCCUPANCY_GRID_H_
+#define OCCUPANCY_GRID_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+/**
+ * @brief      Sets all cells in the grid to unknown (log-odds 0).
+ */
+void grid_init(void);
+
+/**
+ * @brief      Updates the grid along a single IR beam.
+ *
+ * @param[in]  Origin  The position of the sensor [cm]
+ * @param[in]  End     The end point of the beam [cm]
+ * @param[in]  hit     1 if the beam was reflected at End, 0 if End is only
+ *                     the limit of the sensor range
+ */
+void grid_update_beam(point_t Origin, point_t End, uint8_t hit);
+
+/**
+ * @brief      Reads the log-odds value of the cell containing a point.
+ *
+ * @param[in]  Position  The point [cm]
+ *
+ * @return     The log-odds of the cell, 0 (unknown) outside the grid
+ */
+int8_t grid_get_cell(point_t Position);
+
+/**
+ * @brief      Copies cells from one row of the grid, for sending it to the
+ *             server.
+ *
+ * @param[in]  row     The row
+ * @param[in]  column  The first column, the cells must end inside the row
+ * @param      cells   Where to put the log-odds of the cells
+ * @param[in]  count   The number of cells
+ */
+void grid_read_row(uint8_t row, uint8_t column, int8_t *cells, uint8_t count);
+
+#endif /* OCCUPANCY_GRID_H_ */
@@ -12,13 +12,14 @@
 #include "functions.h"
 #include "motor.h"
 #include "communication.h"
+#include "channel.h"
 
 extern volatile uint8_t gHandshook;
 extern volatile uint8_t gPaused;
 
-extern QueueHandle_t globalPoseQ;
+extern channel_t globalPoseChannel;
 extern QueueHandle_t poseControllerQ;
-extern QueueHandle_t movementQ;
+extern channel_t movementChannel;
 extern TaskHandle_t xPoseCtrlTask;
 
 void vMainPoseControllerTask( void *pvParameters )
@@ -33,17 +34,16 @@ void vMainPoseControllerTask( void *pvParameters )
 	float radiusEpsilon = 5; //[mm]The acceptable radius from goal for completion
 	uint8_t lastMovement = 0;
 	
-	// Find better values for NXT
-	float maxRotateActuation = 40; //The max speed the motors will run at during rotation (was 75)
-	float maxDriveActuation = 45; //The max speed the motors will run at during drive (was 100)
-	float currentDriveActuation = maxRotateActuation;
+	// Wheel speeds, held by the velocity control in the motor driver
+	float maxRotateSpeed = 130; //[mm/s] The max wheel speed during rotation
+	float maxDriveSpeed = 150; //[mm/s] The max wheel speed during drive
+	float currentDriveSpeed = maxRotateSpeed;
 	
 	/* Controller variables for tuning, probably needs calculation for NXT */
-	float rotateThreshold = 0.5235; // [rad] The threshold at which the robot will go from driving to rotation. Equals 10 degrees
-	float driveThreshold = 0.0174; // [rad]The threshold at which the robot will go from rotation to driving. In degrees.
-	float driveKp = 600; //Proportional gain for theta control during drive
-	float driveKi = 10; //Integral gain for theta during drive
-	float speedDecreaseThreshold = 300; //[mm] Distance from goal where the robot will decrease its speed inverse proportionally
+	float rotateThreshold = 1.5708; // [rad] The threshold at which the robot will go from driving to rotation. Equals 90 degrees
+	float driveThreshold = 0.5235; // [rad]The threshold at which the robot will go from rotation to driving. Equals 30 degrees
+	float lookahead = 150; //[mm] Distance at which the robot heads on for the next waypoint
+	float speedDecreaseThreshold = 300; //[mm] Distance from the last waypoint where the robot will decrease its speed inverse proportionally
 	
 	/* Current position variables */	
 	float thetahat = 0;
@@ -57,14 +57,8 @@ void vMainPoseControllerTask( void *pvParameters )
 	float xTargt = 0;
 	float yTargt = 0;
 	
-	float leftIntError = 0;
-	float rightIntError = 0;
-	
 	uint8_t doneTurning = TRUE;
 	
-	uint8_t gLeftWheelDirection = 0;
-	uint8_t gRightWheelDirection = 0;
-	
 	uint8_t idleSent = FALSE;
       
 	while(1) {
@@ -75,28 +69,42 @@ void vMainPoseControllerTask( void *pvParameters )
 			// 1000ms to check if we are still connected.
 			ulTaskNotifyTake(pdTRUE, 1000 / portTICK_PERIOD_MS);
 
-			if (xQueuePeek(globalPoseQ, &GlobalPose, 0) == pdTRUE) {
+			if (channel_read(&globalPoseChannel, &GlobalPose)) {
 				thetahat = GlobalPose.theta;
 				xhat = GlobalPose.x;
 				yhat = GlobalPose.y;
 			}
 			
-			// Check if a new update is received
-			if (xQueuePeek(poseControllerQ, &Target, 0) == pdTRUE) { // Read theta and radius set points from com task
+			// Head for the first waypoint from the com task. Waypoints within the lookahead
+			// are dropped as long as there is another one after them, so the robot keeps
+			// moving through the route and only stops at the last one.
+			// Only tasks use the queue, so suspending the scheduler is enough and the
+			// encoder interrupt is not held off while the waypoints are checked.
+			point_t PosePoint = { xhat, yhat };
+			uint8_t lastWaypoint = TRUE;
+			vTaskSuspendAll();
+			if (xQueuePeek(poseControllerQ, &Target, 0) == pdTRUE) {
+				while (uxQueueMessagesWaiting(poseControllerQ) > 1 && func_distance_squared(&Target, &PosePoint) < lookahead * lookahead) {
+					xQueueReceive(poseControllerQ, &Target, 0);
+					xQueuePeek(poseControllerQ, &Target, 0);
+				}
+				lastWaypoint = (uxQueueMessagesWaiting(poseControllerQ) == 1);
 				xTargt = Target.x;
 				yTargt = Target.y;
 			} else {
 				xTargt = xhat;
 				yTargt = yhat;
 			}
+			xTaskResumeAll();
 			
-			distance = sqrt((xTargt-xhat)*(xTargt-xhat) + (yTargt-yhat)*(yTargt-yhat));
+			point_t TargetPoint = { xTargt, yTargt };
+			distance = func_distance_between(&TargetPoint, &PosePoint);
 			
-			//Simple speed controller as the robot nears the target
-			if (distance < speedDecreaseThreshold) {
-				currentDriveActuation = (maxDriveActuation - 0.32 * maxDriveActuation)*distance / speedDecreaseThreshold + 0.32 * maxDriveActuation; //Reverse proportional + a constant so it reaches. 
+			//Simple speed controller as the robot nears the end of the route
+			if (lastWaypoint && distance < speedDecreaseThreshold) {
+				currentDriveSpeed = (maxDriveSpeed - 0.32f * maxDriveSpeed)*distance / speedDecreaseThreshold + 0.32f * maxDriveSpeed; //Reverse proportional + a constant so it reaches. 
 			} else {
-				currentDriveActuation = maxDriveActuation;
+				currentDriveSpeed = maxDriveSpeed;
 			}
 			
 			if (distance > radiusEpsilon) { //Not close enough to target
@@ -104,14 +112,14 @@ void vMainPoseControllerTask( void *pvParameters )
 				
 				float xdiff = xTargt - xhat;
 				float ydiff = yTargt - yhat;
-				float thetaTargt = atan2(ydiff,xdiff); //atan() returns radians
+				float thetaTargt = func_atan2(ydiff,xdiff); //atan() returns radians
 				thetaDiff = thetaTargt - thetahat; //Might be outside pi to -pi degrees
 				vFunc_Inf2pi(&thetaDiff);
 
 				//Hysteresis mechanics
-				if (fabs(thetaDiff) > rotateThreshold) {
+				if (fabsf(thetaDiff) > rotateThreshold) {
 					doneTurning = FALSE;
-				} else if (fabs(thetaDiff) < driveThreshold) {
+				} else if (fabsf(thetaDiff) < driveThreshold) {
 					doneTurning = TRUE;
 				}
 				
@@ -119,55 +127,34 @@ void vMainPoseControllerTask( void *pvParameters )
 				float RSpeed = 0;
 				
 				if (doneTurning) { //Start forward movement
-					if (thetaDiff >= 0) { //Moving left
-						LSpeed = currentDriveActuation - driveKp*fabs(thetaDiff) - driveKi*leftIntError; //Simple PI controller for theta 
-						
-						//Saturation
-						if (LSpeed > currentDriveActuation) {
-							LSpeed = currentDriveActuation;
-						} else if (LSpeed < 0) {
-							LSpeed = 0;
-						}
-						RSpeed = currentDriveActuation;
-					} else { //Moving right
-						RSpeed = currentDriveActuation - driveKp*fabs(thetaDiff) - driveKi*rightIntError; //Simple PI controller for theta
-						
-						//Saturation
-						if (RSpeed > currentDriveActuation) {
-							RSpeed = currentDriveActuation;
-						} else if (RSpeed < 0) {
-							RSpeed = 0;
-						}
-						LSpeed = currentDriveActuation;
-					}
+					// Pure pursuit, drive the arc that starts along the current heading and
+					// passes through the waypoint. Its curvature is 2*sin(thetaDiff)/distance
+					float curvature = 2 * func_sin(thetaDiff) / distance;
+					LSpeed = currentDriveSpeed * (1 - curvature * WHEELBASE_MM / 2);
+					RSpeed = currentDriveSpeed * (1 + curvature * WHEELBASE_MM / 2);
 					
-					leftIntError += thetaDiff;
-					rightIntError -= thetaDiff;
+					//Saturation, slow down both wheels to keep the arc
+					float fastest = fabsf(LSpeed) > fabsf(RSpeed) ? fabsf(LSpeed) : fabsf(RSpeed);
+					if (fastest > currentDriveSpeed) {
+						LSpeed *= currentDriveSpeed / fastest;
+						RSpeed *= currentDriveSpeed / fastest;
+					}
 					
-					gRightWheelDirection = motorForward; //?
-					gLeftWheelDirection = motorForward;
 					lastMovement = moveForward;
 					
-				} else { //Turn within 1 degree of target
+				} else { //Turn within 30 degrees of target
 					if (thetaDiff >= 0) { //Rotating left
-						LSpeed = -maxRotateActuation*(0.3 + 0.22*(fabs(thetaDiff)));
-						gLeftWheelDirection = motorBackward;
-						RSpeed = maxRotateActuation*(0.3 + 0.22*(fabs(thetaDiff)));
-						gRightWheelDirection = motorForward;
+						LSpeed = -maxRotateSpeed*(0.3f + 0.22f*(fabsf(thetaDiff)));
+						RSpeed = maxRotateSpeed*(0.3f + 0.22f*(fabsf(thetaDiff)));
 						lastMovement = moveCounterClockwise;
 					} else { //Rotating right
-						LSpeed = maxRotateActuation*(0.3 + 0.22*(fabs(thetaDiff)));
-						gLeftWheelDirection = motorForward;
-						RSpeed = -maxRotateActuation*(0.3 + 0.22*(fabs(thetaDiff)));
-						gRightWheelDirection = motorBackward;
+						LSpeed = maxRotateSpeed*(0.3f + 0.22f*(fabsf(thetaDiff)));
+						RSpeed = -maxRotateSpeed*(0.3f + 0.22f*(fabsf(thetaDiff)));
 						lastMovement = moveClockwise;
 					}
-					
-					leftIntError = 0;
-					rightIntError = 0;
 				}
 
-				vMotorMovementSwitch(ROUND(LSpeed), ROUND(RSpeed), &gLeftWheelDirection, &gRightWheelDirection);
+				vMotorSetVelocity(LSpeed, RSpeed);
 		
 			} else {
 				if (idleSent == FALSE) {
@@ -175,17 +162,17 @@ void vMainPoseControllerTask( void *pvParameters )
 					idleSent = TRUE;
 				}
 				// Set speed of both motors to 0
-				vMotorMovementSwitch(0, 0, &gLeftWheelDirection, &gRightWheelDirection);
+				vMotorSetVelocity(0, 0);
 				lastMovement = moveStop;
 			}
 
 			// Send the current movement to the sensor tower task
-			xQueueOverwrite(movementQ, &lastMovement);
+			channel_write(&movementChannel, &lastMovement);
 			
 		} else {
 			// Stop motors if we get disconnected
 			if (lastMovement != moveStop) {
-				vMotorMovementSwitch(0, 0, &gLeftWheelDirection, &gRightWheelDirection);	
+				vMotorSetVelocity(0, 0);
 			}
 			vTaskDelay(PERIOD_MOTOR_MS / portTICK_PERIOD_MS);
 		}
@@ -5,8 +5,8 @@
 // 					mechanisms by Geir Eikeland, NTNU Spring 2018.
 //
 // Contains the main task responsible for control of the servos for the wheels.
-// It receives setpoints from the communication task, and uses a PI-controller
-// algorithm to regulate the motor actuation.
+// It receives a queue of waypoints from the communication task, and follows
+// them with pure pursuit, setting the wheel speeds in the motor driver.
 //
 // /************************************************************************/
 
@@ -15,8 +15,8 @@
 
 /**
  * @brief      The main task that is responsible for control of the wheels.
- *             Takes in setpoints in (x,y)-coordinates and uses a PI-controller
- *             to adjust the actuation from readings of the global pose.
+ *             Takes in waypoints in (x,y)-coordinates and drives through
+ *             them with pure pursuit, from readings of the global pose.
  *
  * @param      pvParameters  The pv parameters
  */
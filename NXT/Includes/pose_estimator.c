@@ -12,11 +12,15 @@
 #include "types.h"
 #include "functions.h"
 #include "io.h"
+#include "ekf.h"
+#include "pose_history.h"
+#include "channel.h"
+#include "motor.h"
 
 extern volatile uint8_t gHandshook;
 
-extern QueueHandle_t globalPoseQ;
-extern QueueHandle_t wheelTicksQ;
+extern channel_t globalPoseChannel;
+extern channel_t poseCovarianceChannel;
 extern TaskHandle_t xPoseCtrlTask;
 
 void vMainPoseEstimatorTask( void *pvParameters )
@@ -25,42 +29,46 @@ void vMainPoseEstimatorTask( void *pvParameters )
     const TickType_t xDelay = PERIOD_ESTIMATOR_MS;
     float period_in_S = PERIOD_ESTIMATOR_MS / 1000.0f;
     
-    float kalmanGain = 0.5;
-    
-    float predictedTheta = 0.0; // Start-heading i 90 degrees ?
-    float predictedX = 0.0;
-    float predictedY = 0.0;
-    pose_t PredictedPose = {0};
+    // Extended Kalman filter over (x, y, theta), see ekf.h
+    ekf_t Filter;
+    ekf_init(&Filter);
     
     float gyroOffset = 0.0;
-    //float compassOffset = 0.0;
+    
+    // Last gyro sample integrated, and the turn at its rate from then until the last estimate
+    uint16_t gyroSequence = gyro_get_sequence();
+    float gyroRate = 0.0;
+    uint32_t gyroTick = 0;
+    float gyroFraction = 0.0;
+    uint8_t gyroValid = FALSE;
+    float gyroAhead = 0.0;
+    
+    #ifdef COMPASS_ENABLED
+    float compassOffset = 0.0;
     
     // Found by using calibration task
-    //int16_t xComOff = 11; 
-    //int16_t yComOff = -78;
-    //int16_t xComOff = -321; 
-    //int16_t yComOff = -25;
+    int16_t xComOff = -321; 
+    int16_t yComOff = -25;
+    #endif /* COMPASS_ENABLED */
     
     float variance_gyro = 0.0482f; // [rad] calculated offline, see report
     float variance_encoder = (2.0f * WHEEL_FACTOR_MM) / (WHEELBASE_MM); // approximation, 0.0257 [rad]
     
     float variance_gyro_encoder = (variance_gyro + variance_encoder) * period_in_S; // (Var gyro + var encoder) * timestep
-    float covariance_filter_predicted = 0;
     
     #ifdef COMPASS_ENABLED
     #define CONST_VARIANCE_COMPASS 0.0349f // 2 degrees in rads, as specified in the data sheet
 	#define COMPASS_FACTOR 10000.0f// We are driving inside with a lot of interference, compass needs to converge slowly
     #endif
 
-    #ifndef COMPASS_ENABLED
-    #define CONST_VARIANCE_COMPASS 0.0f
-    #define COMPASS_FACTOR 0.0f
-    #endif
-
     float gyroWeight = 0.5;//encoderError / (encoderError + gyroError);
+    #ifdef COMPASS_ENABLED
     uint8_t robot_is_turning = 0;
+    #endif
 
+    // Start from the current counts, the wheels may have moved before the estimator
     wheel_ticks_t WheelTicks = { 0, 0 };
+    vMotorGetWheelTicks(&WheelTicks);
     wheel_ticks_t PreviousWheelTicks = WheelTicks;
     
     // Initialise the xLastWakeTime variable with the current time.
@@ -76,52 +84,77 @@ void vMainPoseEstimatorTask( void *pvParameters )
             float dRobot = 0;
             float dTheta = 0;
 
-            // Read wheel ticks from queue written to by motor driver
-            // This part is executed only if there is a new tick-value in the queue
-            if (xQueueReceive(wheelTicksQ, &WheelTicks, 0) == pdTRUE) {
-
-                // Distance wheels have travelled since last sample
-                float dLeft = (float) (WheelTicks.left - PreviousWheelTicks.left) * WHEEL_FACTOR_MM; 
-                float dRight = (float) (WheelTicks.right - PreviousWheelTicks.right) * WHEEL_FACTOR_MM;
-            
-                PreviousWheelTicks.left = WheelTicks.left;
-                PreviousWheelTicks.right = WheelTicks.right;
-                       
-                dRobot = (dLeft + dRight) / 2;
-                // Get angle from encoders, dervied from arch of circles formula
-                dTheta = (dRight - dLeft) / WHEELBASE_MM;
-            }
+            // Read wheel ticks from the motor driver
+            vMotorGetWheelTicks(&WheelTicks);
+
+            // Distance wheels have travelled since last sample
+            float dLeft = (float) (WheelTicks.left - PreviousWheelTicks.left) * WHEEL_FACTOR_MM; 
+            float dRight = (float) (WheelTicks.right - PreviousWheelTicks.right) * WHEEL_FACTOR_MM;
+        
+            PreviousWheelTicks.left = WheelTicks.left;
+            PreviousWheelTicks.right = WheelTicks.right;
+                   
+            dRobot = (dLeft + dRight) / 2;
+            // Get angle from encoders, dervied from arch of circles formula
+            dTheta = (dRight - dLeft) / WHEELBASE_MM;
             
             
             /* PREDICT */
-            // Get gyro data:
-            float gyrZ = (gyro_get_dps_z() - gyroOffset);
+            // Integrate the gyro samples taken since the last estimate over the
+            // time between them, the samples do not arrive exactly once per period.
+            // The turn since the last sample is carried at its rate, and taken back
+            // once the next sample has been integrated
+            float gyrZ = 0;
+            uint16_t latest = gyro_get_sequence();
+            if ((uint16_t) (latest - gyroSequence) > IO_SAMPLE_HISTORY) {
+                gyroSequence = latest - 1; // Fell behind, start over from the newest sample
+                gyroValid = FALSE;
+            }
+            while (gyroSequence != latest) {
+                float dps, fraction;
+                uint32_t tick;
+                gyroSequence++;
+                if (!gyro_get_sample_z(gyroSequence, &dps, &tick, &fraction)) {
+                    gyroValid = FALSE;
+                    continue;
+                }
+                if (gyroValid) { // The ticks are subtracted as integers, so dt stays exact as the tick count grows
+                    gyrZ += (gyroRate + dps - gyroOffset) / 2 * ((float) (tick - gyroTick) + fraction - gyroFraction) / 1000.0f;
+                }
+                gyroRate = dps - gyroOffset;
+                gyroTick = tick;
+                gyroFraction = fraction;
+                gyroValid = TRUE;
+            }
+            if (gyroValid) {
+                float ahead = gyroRate * ((float) (int32_t) (xTaskGetTickCount() - gyroTick) - gyroFraction) / 1000.0f;
+                gyrZ += ahead - gyroAhead;
+                gyroAhead = ahead;
+            }
             
             // If the robot is not really rotating we don't include the gyro measurements, to avoid the trouble with drift while driving in a straight line
-            if (fabs(gyrZ) < 10) {
+            if (fabsf(gyroRate) < 10) {
             	gyroWeight = 0; // Disregard gyro while driving in a straight line
+				#ifdef COMPASS_ENABLED
 				robot_is_turning = FALSE; // Don't update angle estimates
+				#endif
 			} else {
                 gyroWeight = 0.75; // Found by experiment, after 20x90 degree turns, gyro seems 85% more accurate than encoders    
+                #ifdef COMPASS_ENABLED
                 robot_is_turning = TRUE;
+                #endif
             }
             
             // Scale gyro measurement
-            gyrZ *= period_in_S * DEG2RAD;
+            gyrZ *= DEG2RAD;
             
             // Fuse heading from sensors to predict heading:
             dTheta = (1 - gyroWeight) * dTheta + gyroWeight * gyrZ;
             
-            // Estimate global X and Y pos
+            // Predicted (a priori) state and covariance. The distance noise
+            // grows with the distance travelled.
             // Todo; Include accelerator measurements to estimate position and handle wheel slippage
-            predictedX = predictedX + (dRobot * cos(predictedTheta + 0.5 * dTheta)); 
-            predictedY = predictedY + (dRobot * sin(predictedTheta + 0.5 * dTheta));
-
-            // Predicted (a priori) state estimate for theta
-            predictedTheta += dTheta;
-                  
-            // Predicted (a priori) estimate covariance
-            covariance_filter_predicted += variance_gyro_encoder;
+            ekf_predict(&Filter, dRobot, dTheta, EKF_DISTANCE_VARIANCE * fabsf(dRobot), variance_gyro_encoder);
             
             /* UPDATE */
             #ifdef COMPASS_ENABLED
@@ -132,46 +165,24 @@ void vMainPoseEstimatorTask( void *pvParameters )
             xCom += xComOff;
             yCom += yComOff;
             // calculate heading
-            float compassHeading = atan2(yCom, xCom) - compassOffset; // returns -pi, pi
+            float compassHeading = func_atan2(yCom, xCom) - compassOffset; // returns -pi, pi
             //debug("%f", compassHeading);
 
-            // Update predicted state:    
-            float error = (compassHeading - predictedTheta);
-            //float error = 0; // Compass data not included
-            vFunc_Inf2pi(&error);
-            #endif /* COMPASS_ENABLED */
-
-            #ifndef COMPASS_ENABLED
-            float error = 0.0;
-            #endif /* COMPASS_ENABLED */
-
-            kalmanGain = covariance_filter_predicted / (covariance_filter_predicted + CONST_VARIANCE_COMPASS);
-            ///* Commented back in due to fixed encoder
-            if (fabs(error) > (0.8727*period_in_S)) { // 0.8727 rad/s is top speed while turning
+            // Update (a posteriori) state estimate and covariance, only while
+            // standing still
+            float error = ekf_heading_innovation(&Filter, compassHeading);
+            if (fabsf(error) > (0.8727f*period_in_S)) { // 0.8727 rad/s is top speed while turning
                 // If we have a reading over this, we can safely ignore the compass
-                // Ignore compass while driving in a straight line
-                kalmanGain = 0;
-                //led_clear(LED_YELLOW);
             } else if ((robot_is_turning == FALSE) && (dRobot == 0)) {
-                // Updated (a posteriori) state estimate
-                kalmanGain = covariance_filter_predicted / (covariance_filter_predicted + CONST_VARIANCE_COMPASS);
-                //led_set(LED_YELLOW);
-            } else {
-                kalmanGain = 0;
-                //led_clear(LED_YELLOW);
+                ekf_update_heading(&Filter, compassHeading, CONST_VARIANCE_COMPASS * COMPASS_FACTOR);
             }
-           
-            predictedTheta += kalmanGain*(error);
-			vFunc_Inf2pi(&predictedTheta); // Converts to (-pi,pi]
-            
-            // Updated (a posteriori) estimate covariance
-            covariance_filter_predicted = (1 - kalmanGain) * covariance_filter_predicted;  
+            #endif /* COMPASS_ENABLED */
 
-            // Write the predicted pose to the global queue
-            PredictedPose.theta = predictedTheta;
-            PredictedPose.x = predictedX;
-            PredictedPose.y = predictedY;
-            xQueueOverwrite(globalPoseQ, &PredictedPose);
+            // Write the predicted pose and its covariance to the global channels,
+            // and keep the pose for readings taken before this estimate
+            pose_history_add(xTaskGetTickCount(), Filter.Pose);
+            channel_write(&globalPoseChannel, &Filter.Pose);
+            channel_write(&poseCovarianceChannel, &Filter.P);
             
             // Notify the pose controller about the updated position estimate
             xTaskNotifyGive(xPoseCtrlTask);
@@ -185,12 +196,12 @@ void vMainPoseEstimatorTask( void *pvParameters )
                 gyro += gyro_get_dps_z();
             }
             gyroOffset = gyro / (float)i;
+            gyroSequence = gyro_get_sequence();
+            gyroValid = FALSE;
 
             // Initialize pose to 0 and reset offset variables (isn't this done at start of task?)
             /*
-            predictedX = 0;
-            predictedY = 0;
-            predictedTheta = 0;
+            ekf_init(&Filter);
             */
             
             #ifdef COMPASS_ENABLED
@@ -198,9 +209,9 @@ void vMainPoseEstimatorTask( void *pvParameters )
             compass_get(&xCom, &yCom, &zCom);
             xCom += xComOff;
             yCom += yComOff;
-            compassOffset = atan2(yCom, xCom);
+            compassOffset = func_atan2(yCom, xCom);
             #endif
             
         }
     } // While(1) end
-}
\ No newline at end of file
+}
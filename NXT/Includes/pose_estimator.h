@@ -7,11 +7,11 @@
 // 					changes by Geir Eikeland, NTNU spring 2018
 // 
 // Contains the function which implements the task that estimates the
-// pose of the robot. The algorithm is currently using only the ticks
-// from the wheel encoder and the rotational data from the gyro in the
-// estimation process. The code for the compass has been commented out
-// for now, and should not be enabled before exact calibrations have been
-// made.
+// pose of the robot. An extended Kalman filter over (x, y, theta) is
+// predicted with the ticks from the wheel encoder and the rotational data
+// from the gyro. The pose is published on globalPoseChannel and its 3x3
+// covariance on poseCovarianceChannel. The compass update is disabled for now,
+// and should not be enabled before exact calibrations have been made.
 //
 /************************************************************************/
 
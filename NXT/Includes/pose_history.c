@@ -0,0 +1,140 @@
+#include "pose_history.h"
+
+/* Kernel includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "functions.h"
+
+/* Entry n is stored at History[n % POSE_HISTORY_SIZE]. historyCount is only
+written after an entry is complete, so entry n is readable once historyCount
+is past it. */
+static volatile stamped_pose_t History[POSE_HISTORY_SIZE];
+static volatile uint32_t historyCount = 0;
+
+/* Copies entry n. Returns FALSE if the writer may have reused its slot
+before or during the copy. */
+static uint8_t pose_history_read(uint32_t n, stamped_pose_t *Entry) {
+	volatile stamped_pose_t *Slot = &History[n % POSE_HISTORY_SIZE];
+
+	Entry->tick = Slot->tick;
+	Entry->Pose.theta = Slot->Pose.theta;
+	Entry->Pose.x = Slot->Pose.x;
+	Entry->Pose.y = Slot->Pose.y;
+
+	// The slot of entry n is reused by entry n + POSE_HISTORY_SIZE, which is
+	// written while historyCount is n + POSE_HISTORY_SIZE
+	return (historyCount - n) < POSE_HISTORY_SIZE;
+}
+
+static pose_t pose_history_interpolate(stamped_pose_t *Before, stamped_pose_t *After, uint32_t tick) {
+	uint32_t span = After->tick - Before->tick;
+	if (span == 0)
+		return After->Pose;
+
+	float f = (float) (tick - Before->tick) / (float) span;
+
+	// Turn the shortest way from the heading before to the heading after
+	float dTheta = After->Pose.theta - Before->Pose.theta;
+	vFunc_Inf2pi(&dTheta);
+
+	pose_t Pose = {
+		Before->Pose.theta + f * dTheta,
+		Before->Pose.x + f * (After->Pose.x - Before->Pose.x),
+		Before->Pose.y + f * (After->Pose.y - Before->Pose.y)
+	};
+	vFunc_Inf2pi(&Pose.theta);
+
+	return Pose;
+}
+
+void pose_history_add(uint32_t tick, pose_t Pose) {
+	uint32_t n = historyCount;
+	volatile stamped_pose_t *Slot = &History[n % POSE_HISTORY_SIZE];
+
+	Slot->tick = tick;
+	Slot->Pose.theta = Pose.theta;
+	Slot->Pose.x = Pose.x;
+	Slot->Pose.y = Pose.y;
+
+	historyCount = n + 1;
+}
+
+uint8_t pose_history_get(uint32_t tick, pose_t *Pose) {
+	configASSERT(Pose);
+
+	while (1) {
+		uint32_t count = historyCount;
+		if (count == 0)
+			return FALSE;
+
+		// The oldest entry that is not about to be overwritten
+		uint32_t oldest = (count > POSE_HISTORY_SIZE - 1) ? count - (POSE_HISTORY_SIZE - 1) : 0;
+
+		stamped_pose_t After, Before;
+		if (!pose_history_read(count - 1, &After))
+			continue;
+
+		// Newer than the newest pose, ticks are compared modulo 2^32
+		if ((int32_t) (tick - After.tick) >= 0) {
+			*Pose = After.Pose;
+			return tick == After.tick;
+		}
+
+		// Walk backwards from the newest entry, the tick is usually recent
+		uint8_t torn = FALSE;
+		for (uint32_t n = count - 1; n-- > oldest; ) {
+			if (!pose_history_read(n, &Before)) {
+				torn = TRUE;
+				break;
+			}
+
+			if ((int32_t) (tick - Before.tick) >= 0) {
+				*Pose = pose_history_interpolate(&Before, &After, tick);
+				return TRUE;
+			}
+			After = Before;
+		}
+
+		if (torn)
+			continue;
+
+		// Older than the oldest pose
+		*Pose = After.Pose;
+		return FALSE;
+	}
+}
+
+uint8_t pose_history_wait(uint32_t tick, pose_t *Pose, TickType_t xTicksToWait) {
+	configASSERT(Pose);
+
+	TickType_t start = xTaskGetTickCount();
+	while (1) {
+		uint32_t count = historyCount;
+		TickType_t delay = 1;
+
+		if (count > 0) {
+			// The slot of the newest entry is not reused while it is the newest
+			uint32_t newest = History[(count - 1) % POSE_HISTORY_SIZE].tick;
+			if ((int32_t) (tick - newest) <= 0)
+				break;
+
+			// Sleep until the next estimate is due instead of polling
+			int32_t due = (int32_t) (newest + PERIOD_ESTIMATOR_MS / portTICK_PERIOD_MS - xTaskGetTickCount());
+			if (due > 1)
+				delay = (TickType_t) due;
+		}
+
+		TickType_t waited = xTaskGetTickCount() - start;
+		if (waited >= xTicksToWait)
+			break;
+		if (delay > xTicksToWait - waited)
+			delay = xTicksToWait - waited;
+		vTaskDelay(delay);
+	}
+
+	return pose_history_get(tick, Pose);
+}
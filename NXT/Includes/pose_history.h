@@ -0,0 +1,60 @@
+/************************************************************************/
+// File:			pose_history.h
+//
+// Ring buffer of the last POSE_HISTORY_SIZE poses from the pose estimator,
+// each stamped with the tick it was estimated at. Sensor readings carry the
+// tick they were sampled at, and are paired with the pose interpolated to
+// that tick instead of whatever pose is newest when they are processed.
+//
+// The pose estimator is the only writer. Readers never block it and take
+// no lock; a reader that is overtaken while copying an entry just retries.
+//
+/************************************************************************/
+
+#ifndef POSE_HISTORY_H_
+#define POSE_HISTORY_H_
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "types.h"
+
+/**
+ * @brief      Adds a pose to the history, overwriting the oldest one. Must
+ *             only be called from the pose estimator task.
+ *
+ * @param[in]  tick  The tick count the pose was estimated at
+ * @param[in]  Pose  The pose
+ */
+void pose_history_add(uint32_t tick, pose_t Pose);
+
+/**
+ * @brief      Finds the pose at a given tick, interpolated between the two
+ *             poses around it. x and y are interpolated linearly, and theta
+ *             along the shortest way around the circle.
+ *
+ * @param[in]  tick  The tick count
+ * @param      Pose  The pose. Outside the history it is the nearest pose in
+ *                   it, and unchanged if the history is empty.
+ *
+ * @return     TRUE if the tick is inside the history, FALSE if not
+ */
+uint8_t pose_history_get(uint32_t tick, pose_t *Pose);
+
+/**
+ * @brief      Waits until the history has a pose at or after the given tick,
+ *             and then finds the pose at the tick like pose_history_get. The
+ *             sensors are read between estimates, so the estimate after a
+ *             reading is usually less than PERIOD_ESTIMATOR_MS away.
+ *
+ * @param[in]  tick          The tick count
+ * @param      Pose          The pose, as for pose_history_get. If the wait
+ *                           times out it is the newest pose.
+ * @param[in]  xTicksToWait  The longest time to wait [ticks]
+ *
+ * @return     TRUE if the tick is inside the history, FALSE if not
+ */
+uint8_t pose_history_wait(uint32_t tick, pose_t *Pose, TickType_t xTicksToWait);
+
+#endif /* POSE_HISTORY_H_ */
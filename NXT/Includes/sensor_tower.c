@@ -6,31 +6,70 @@
 #include "semphr.h"
 #include "task.h"
 
+#include <math.h>
+
 #include "types.h"
 #include "defines.h"
 #include "functions.h"
 #include "motor.h"
 #include "io.h"
 #include "communication.h"
+#include "pose_history.h"
+#include "channel.h"
 
 extern volatile uint8_t gHandshook;
 extern volatile uint8_t gPaused;
 
-extern QueueHandle_t movementQ;
-extern QueueHandle_t globalPoseQ;
+extern channel_t movementChannel;
 extern QueueHandle_t poseControllerQ;
 extern QueueHandle_t measurementQ;
 extern TaskHandle_t xMappingTask;
 
+/* Degrees to the next tower angle. Standing still, the tower takes small steps
+ * for detail. Driving, the step grows with the speed so the front is revisited
+ * sooner, and the diagonals between the front sectors of the forward sensor
+ * (0-30) and the right sensor (60-90) are crossed in one move. */
+static uint8_t sensor_tower_step(uint8_t servoStep, uint8_t rotationDirection, uint8_t robotMovement) {
+	if (robotMovement == moveForward || robotMovement == moveBackward) {
+		if (rotationDirection == moveCounterClockwise && servoStep >= 30 && servoStep < 60) return 60 - servoStep;
+		if (rotationDirection == moveClockwise && servoStep > 30 && servoStep <= 60) return servoStep - 30;
+	}
+
+	float step = TOWER_MIN_STEP_DEG + fabsf(fMotorGetSpeed()) / TOWER_STEP_SPEED;
+	if (step > TOWER_MAX_STEP_DEG) step = TOWER_MAX_STEP_DEG;
+	return (uint8_t) step;
+}
+
+#ifdef SEND_UPDATE
+/* Sends a measurement to the server with the pose at the tick it was taken */
+static void sensor_tower_send_update(measurement_t *Measurement) {
+	// Waits for the pose estimate after the measurement, or uses the newest
+	pose_t Pose = { 0 };
+	pose_history_wait(Measurement->tick, &Pose, POSE_HISTORY_WAIT_MS / portTICK_PERIOD_MS);
+
+	// Convert to range [0,2pi) for compatibility with server
+	func_wrap_to_2pi(&Pose.theta);
+
+	//Send updates to server in the correct format (centimeter and degrees, rounded)
+	send_update(ROUND(Pose.x/10), ROUND(Pose.y/10), ROUND(Pose.theta*RAD2DEG), Measurement->servoStep,
+		Measurement->data[0], Measurement->data[1], Measurement->data[2], Measurement->data[3]);
+}
+#endif /* SEND_UPDATE */
+
 void vMainSensorTowerTask( void *pvParameters )
 {
 	/* Task init */
 	uint8_t rotationDirection = moveCounterClockwise;
 	uint8_t servoStep = 0;
-    const uint8_t SERVO_RESOLUTION = 5;
 	uint8_t robotMovement = moveStop;
 	uint8_t lastRobotMovement = robotMovement;
 	uint8_t idleCounter = 0;
+	#ifdef SEND_UPDATE
+	// The update of a measurement is sent after the next tower move, when the
+	// pose estimate after the measurement exists
+	measurement_t LastMeasurement;
+	uint8_t updatePending = FALSE;
+	#endif /* SEND_UPDATE */
 	  
 	// Initialise the xLastWakeTime variable with the current time.
 	TickType_t xLastWakeTime;
@@ -40,9 +79,9 @@ void vMainSensorTowerTask( void *pvParameters )
 		if ((gHandshook == TRUE) && (gPaused == FALSE)) {
 			// xLastWakeTime variable with the current time.
 			xLastWakeTime = xTaskGetTickCount();
-			// Set scanning resolution depending on which movement the robot is executing.
+			// The scanning steps depend on which movement the robot is executing.
 			// Note that the iterations are skipped while robot is rotating (see further downbelow)
-			if (xQueuePeek(movementQ, &robotMovement, 150 / portTICK_PERIOD_MS) == pdTRUE) {
+			if (channel_read(&movementChannel, &robotMovement)) {
 				if (robotMovement != lastRobotMovement) {
 					#ifdef MAPPING
 						// Tell mapping task to start line creation.
@@ -54,13 +93,9 @@ void vMainSensorTowerTask( void *pvParameters )
 				switch (robotMovement)
 				{
 					case moveStop:
-						//servoStep *= servoResolution;
-                    	//servoResolution = 2;
                     	idleCounter = 1;
 					case moveForward:
 					case moveBackward:
-						//servoResolution = 2;
-                    	//servoStep /= servoResolution;
                     	idleCounter = 0;
                     	break;
 					case moveClockwise:
@@ -74,20 +109,35 @@ void vMainSensorTowerTask( void *pvParameters )
 				}
 			}
 
+			// The motor driver notifies this task when the tower reaches the set point
+			ulTaskNotifyTake(pdTRUE, 0);
 			vMotorSetAngle(servoTower, servoStep);
-			//vMotorSetAngle(servoTower, servoStep*servoResolution);
 	  
-		  	// Wait total of 200 ms for servo to reach set point and allow previous update message to be transfered.
-		  	vTaskDelayUntil(&xLastWakeTime, 200 / portTICK_PERIOD_MS);   
+		  	// Wait for the servo to reach set point, and then for the sensors to measure in the new direction.
+		  	if (!ucMotorAngleReached(servoTower)) {
+		  		ulTaskNotifyTake(pdTRUE, TOWER_SETTLE_TIMEOUT_MS / portTICK_PERIOD_MS);
+		  	}
+		  	vTaskDelay(TOWER_SETTLE_MARGIN_MS / portTICK_PERIOD_MS);
+		  	// Allow previous update message to be transfered.
+		  	vTaskDelayUntil(&xLastWakeTime, TOWER_MIN_PERIOD_MS / portTICK_PERIOD_MS);
 		  
+		  	#ifdef SEND_UPDATE
+			  	// Send the previous measurement, its pose has been estimated by now
+			  	if (updatePending) {
+			  		sensor_tower_send_update(&LastMeasurement);
+			  		updatePending = FALSE;
+			  	}
+		  	#endif /* SEND_UPDATE */
+
 		  	// Get measurements from sensors
+		  	uint32_t measurementTick = xTaskGetTickCount();
 		  	uint8_t forwardSensor = distance_get_cm(0);
 		  	uint8_t leftSensor = distance_get_cm(1);
 		  	uint8_t rearSensor = distance_get_cm(2);
 		  	uint8_t rightSensor = distance_get_cm(3);
 
 		  	// Add measurements to struct for sending to queue
-		  	measurement_t Measurement = { { forwardSensor, leftSensor, rearSensor, rightSensor }, servoStep };
+		  	measurement_t Measurement = { { forwardSensor, leftSensor, rearSensor, rightSensor }, servoStep, measurementTick };
 
 			// Send Measurement to mapping task
 		  	xQueueSendToBack(measurementQ, &Measurement, 10);
@@ -102,15 +152,9 @@ void vMainSensorTowerTask( void *pvParameters )
 		  	}
 
 		  	#ifdef SEND_UPDATE
-			  	// Get the latest pose estimate, dont't remove from queue
-			  	pose_t Pose = { 0 };
-			  	xQueuePeek(globalPoseQ, &Pose, 0);
-
-			  	// Convert to range [0,2pi) for compatibility with server
-			  	func_wrap_to_2pi(&Pose.theta);
-			  
-			  	//Send updates to server in the correct format (centimeter and degrees, rounded)
-			  	send_update(ROUND(Pose.x/10), ROUND(Pose.y/10), ROUND(Pose.theta*RAD2DEG), servoStep, forwardSensor, leftSensor, rearSensor, rightSensor);
+			  	// Sent with the next step, when the pose at measurementTick is known
+			  	LastMeasurement = Measurement;
+			  	updatePending = TRUE;
 		  	#endif /* SEND_UPDATE */
 
 		  	#ifndef MANUAL
@@ -129,11 +173,13 @@ void vMainSensorTowerTask( void *pvParameters )
 		  	#endif /* MANUAL */
 
 		  	// Iterate in a increasing/decreasing manner and depending on the robots movement
-		  	if ((servoStep <= 90) && (rotationDirection == moveCounterClockwise) && (robotMovement < moveClockwise)) {
-				servoStep += SERVO_RESOLUTION;
-		  	} 
-		  	else if ((servoStep > 0) && (rotationDirection == moveClockwise) && (robotMovement < moveClockwise)) {
-				servoStep -= SERVO_RESOLUTION;
+		  	if (robotMovement < moveClockwise) {
+		  		uint8_t step = sensor_tower_step(servoStep, rotationDirection, robotMovement);
+		  		if (rotationDirection == moveCounterClockwise) {
+					servoStep = (servoStep + step >= 90) ? 90 : servoStep + step;
+		  		} else {
+					servoStep = (servoStep <= step) ? 0 : servoStep - step;
+		  		}
 		  	}
 		  
 		  	if ((servoStep >= 90) && (rotationDirection == moveCounterClockwise)) {
@@ -165,6 +211,9 @@ void vMainSensorTowerTask( void *pvParameters )
 		  	rotationDirection = moveCounterClockwise;
 		  	servoStep = 0;
 		  	idleCounter = 0;
+		  	#ifdef SEND_UPDATE
+		  	updatePending = FALSE;
+		  	#endif /* SEND_UPDATE */
 		  	vTaskDelayUntil(&xLastWakeTime, 200 / portTICK_PERIOD_MS);
 		  	//led_clear(LED_YELLOW);
 		}
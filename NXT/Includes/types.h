@@ -23,6 +23,30 @@ typedef struct {
 	float y;
 } pose_t;
 
+/**
+ * Type for storing a pose together with the tick it was estimated at.
+ */
+typedef struct {
+	uint32_t tick;
+	pose_t Pose;
+} stamped_pose_t;
+
+/**
+ * Type for a 3x3 matrix, row major. Used for the covariance of the pose.
+ */
+typedef struct {
+	float m[3][3];
+} matrix3_t;
+
+/**
+ * Type for the state of the extended Kalman filter in the pose estimator.
+ * The covariance is over (x, y, theta), in that order.
+ */
+typedef struct {
+	pose_t Pose;
+	matrix3_t P;
+} ekf_t;
+
 /**
  * Type for storing the coordinates of a point in the environment.
  */
@@ -32,27 +56,71 @@ typedef struct {
 } point_t;
 
 /**
- * Type for storing the endpoints of a line segment.
+ * Q16.16 fixed-point number, see fixed_point.h.
+ */
+typedef int32_t fix16_t;
+
+/**
+ * Type for storing the coordinates of a point in fixed-point.
+ */
+typedef struct {
+	fix16_t x;
+	fix16_t y;
+} fix_point_t;
+
+/**
+ * Type for storing the endpoints of a line segment, and the RMS distance of
+ * the points it was fitted to from the line. The line is also kept on normal
+ * form, x cos(theta) + y sin(theta) = rho, with theta in [0,pi) and rho
+ * signed, so that vertical lines need no special case.
  */
 typedef struct {
 	point_t P;
 	point_t Q;
+	float residual;
+	float theta;	// [rad] Angle of the line normal
+	float rho;		// [cm] Signed distance from the origin
+	float length;	// [cm]
 } line_t;
 
+/**
+ * Type for the running sums of an incremental least squares line fit. The sums
+ * are taken relative to the first point of the segment to keep the precision
+ * of the floats.
+ */
+typedef struct {
+	point_t Origin;
+	uint8_t n;
+	float sx;
+	float sy;
+	float sxx;
+	float syy;
+	float sxy;
+} line_fit_t;
+
 /**
  * Type for storing IR-measurements.
  */
 typedef struct {
 	uint8_t data[4];
 	uint8_t servoStep;
+	uint32_t tick;		// Tick count the distances were read at
 } measurement_t;
 
+/**
+ * Type for a jerk limited velocity profile
+ */
+typedef struct {
+	float velocity;
+	float acceleration;
+} motion_profile_t;
+
 /**
  * Type for storing wheel ticks
  */
 typedef struct {
-	int16_t left;
-	int16_t right;
+	int32_t left;
+	int32_t right;
 } wheel_ticks_t;
 
 /**
@@ -75,7 +143,7 @@ typedef struct {
  * Type for storing a line repo
  */
 typedef struct {
-  uint8_t len;
+  uint16_t len;
   line_t buffer[L_SIZE];
 } line_repo_t;
 
@@ -115,6 +183,11 @@ typedef struct {
   int16_t y;
 } __attribute__((packed)) order_message_t;
 
+typedef struct {
+  uint8_t count;
+  order_message_t points[ORDER_MULTI_MAX_POINTS];
+} __attribute__((packed)) order_multi_message_t;
+
 typedef struct {
   int16_t x;
   int16_t y;
@@ -125,11 +198,19 @@ typedef struct {
   int16_t q_y;
 } __attribute__((packed)) line_message_t;
 
+typedef struct {
+  uint8_t row;
+  uint8_t column;                            // Of the first cell
+  int8_t cells[GRID_CELLS_PER_MESSAGE];      // Log-odds of being occupied
+} __attribute__((packed)) grid_message_t;
+
 union Message {
   update_message_t update;
   handshake_message_t handshake;
   order_message_t order;
+  order_multi_message_t order_multi;
   line_message_t line;
+  grid_message_t grid;
 };
 
 typedef struct {